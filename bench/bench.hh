@@ -0,0 +1,280 @@
+#ifndef _SUBSYSTEM_BENCH_HH_3735928559_
+#define _SUBSYSTEM_BENCH_HH_3735928559_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "subsystem_metrics.hh"
+
+/**
+ * @file bench.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Minimal benchmark harness. Every benchmark produces Result rows that are
+ * printed as CSV (default) or JSON (--json) so runs of different builds can
+ * be diffed or loaded into a spreadsheet.
+ */
+
+namespace bench
+{
+    using management::detail::now_ns;
+
+    /**
+     * @brief Exact latency samples
+     */
+    class Samples final
+    {
+    private:
+        std::vector<std::uint64_t> m_values;
+        bool m_sorted = false;
+
+    public:
+        explicit Samples(std::size_t expected = 0) { m_values.reserve(expected); }
+
+        void add(std::uint64_t ns) { m_values.push_back(ns); m_sorted = false; }
+
+        void merge(Samples const & other)
+        {
+            m_values.insert(m_values.end(), other.m_values.begin(), other.m_values.end());
+            m_sorted = false;
+        }
+
+        std::size_t size() const { return m_values.size(); }
+
+        /**
+         * @param p Percentile in [0, 100]
+         * @return Nearest-rank percentile, 0 if empty
+         */
+        std::uint64_t percentile(double p)
+        {
+            if (m_values.empty())
+                return 0;
+
+            if (!m_sorted) {
+                std::sort(m_values.begin(), m_values.end());
+                m_sorted = true;
+            }
+
+            std::size_t rank = static_cast<std::size_t>(p / 100.0 * static_cast<double>(m_values.size() - 1));
+            return m_values[rank];
+        }
+
+        std::uint64_t mean() const
+        {
+            if (m_values.empty())
+                return 0;
+
+            std::uint64_t sum = 0;
+            for (auto v : m_values)
+                sum += v;
+            return sum / m_values.size();
+        }
+    };
+
+    /**
+     * @brief One row of output
+     */
+    struct Result
+    {
+        std::string benchmark;
+        std::string bus;
+        unsigned producers = 0;
+        std::uint64_t operations = 0;
+        std::uint64_t elapsed_ns = 0;
+        /**< Latency columns, 0 when not measured */
+        std::uint64_t p50_ns = 0;
+        std::uint64_t p99_ns = 0;
+        std::uint64_t p999_ns = 0;
+        std::uint64_t mean_ns = 0;
+        /**< Benchmark specific extra column, see each benchmark */
+        std::uint64_t extra = 0;
+        /**< Process resources during the run, 0 when not measured */
+        std::uint64_t peak_threads = 0;
+        std::uint64_t peak_rss_kb = 0;
+        std::uint64_t context_switches = 0;
+
+        double ops_per_sec() const
+        {
+            return elapsed_ns ? static_cast<double>(operations) * 1e9 / static_cast<double>(elapsed_ns) : 0.0;
+        }
+
+        void set_latency(Samples & s)
+        {
+            p50_ns = s.percentile(50.0);
+            p99_ns = s.percentile(99.0);
+            p999_ns = s.percentile(99.9);
+            mean_ns = s.mean();
+        }
+    };
+
+    /**
+     * @brief Samples process wide resource usage while a benchmark runs
+     * @details Thread count and RSS come from /proc/self/status, context
+     *          switches (voluntary and involuntary, all threads) from getrusage.
+     */
+    class ResourceMonitor final
+    {
+    private:
+        std::uint64_t m_start_switches = 0;
+        std::uint64_t m_peak_threads = 0;
+        std::uint64_t m_peak_rss_kb = 0;
+
+        static std::uint64_t context_switches()
+        {
+            struct rusage usage;
+            if (::getrusage(RUSAGE_SELF, &usage) != 0)
+                return 0;
+            return static_cast<std::uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+        }
+
+    public:
+        ResourceMonitor() : m_start_switches(context_switches()) { sample(); }
+
+        /**
+         * @brief Updates the peaks, call periodically during the run
+         */
+        void sample()
+        {
+            std::FILE * f = std::fopen("/proc/self/status", "r");
+            if (!f)
+                return;
+
+            char line[128];
+            unsigned long long value;
+
+            while (std::fgets(line, sizeof(line), f))
+            {
+                if (std::sscanf(line, "Threads: %llu", &value) == 1)
+                    m_peak_threads = std::max<std::uint64_t>(m_peak_threads, value);
+                else if (std::sscanf(line, "VmRSS: %llu", &value) == 1)
+                    m_peak_rss_kb = std::max<std::uint64_t>(m_peak_rss_kb, value);
+            }
+
+            std::fclose(f);
+        }
+
+        /**
+         * @brief Copies the peaks and the context switches since construction
+         */
+        void finish(Result & r)
+        {
+            sample();
+            r.peak_threads = m_peak_threads;
+            r.peak_rss_kb = m_peak_rss_kb;
+            r.context_switches = context_switches() - m_start_switches;
+        }
+    };
+
+    /**
+     * @brief Command line options shared by all benchmark programs
+     */
+    struct Options
+    {
+        bool json = false;
+        /**< Shrinks iteration counts, for smoke testing */
+        bool quick = false;
+
+        Options(int argc, char ** argv)
+        {
+            for (int i = 1; i < argc; ++i) {
+                if (!std::strcmp(argv[i], "--json"))
+                    json = true;
+                else if (!std::strcmp(argv[i], "--quick"))
+                    quick = true;
+            }
+        }
+
+        /**
+         * @return n, or a small fraction of it with --quick
+         */
+        std::uint64_t iterations(std::uint64_t n) const { return quick ? std::max<std::uint64_t>(n / 100, 100) : n; }
+    };
+
+    /**
+     * @brief Collects and prints results
+     */
+    class Report final
+    {
+    private:
+        std::vector<Result> m_results;
+        Options const & m_options;
+
+    public:
+        explicit Report(Options const & options) : m_options(options) { }
+
+        void add(Result const & r)
+        {
+            m_results.push_back(r);
+            std::fprintf(stderr, "%-28s %-22s producers=%-3u %14.0f ops/s p50=%lluns p99=%lluns\n",
+                         r.benchmark.c_str(), r.bus.c_str(), r.producers, r.ops_per_sec(),
+                         static_cast<unsigned long long>(r.p50_ns),
+                         static_cast<unsigned long long>(r.p99_ns));
+        }
+
+        void print(std::FILE * out = stdout) const
+        {
+            if (m_options.json)
+                print_json(out);
+            else
+                print_csv(out);
+        }
+
+    private:
+        void print_csv(std::FILE * out) const
+        {
+            std::fprintf(out, "benchmark,bus,producers,operations,elapsed_ns,ops_per_sec,p50_ns,p99_ns,p999_ns,mean_ns,extra,"
+                         "peak_threads,peak_rss_kb,context_switches\n");
+
+            for (auto & r : m_results)
+                std::fprintf(out, "%s,%s,%u,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                             r.benchmark.c_str(), r.bus.c_str(), r.producers,
+                             static_cast<unsigned long long>(r.operations),
+                             static_cast<unsigned long long>(r.elapsed_ns), r.ops_per_sec(),
+                             static_cast<unsigned long long>(r.p50_ns),
+                             static_cast<unsigned long long>(r.p99_ns),
+                             static_cast<unsigned long long>(r.p999_ns),
+                             static_cast<unsigned long long>(r.mean_ns),
+                             static_cast<unsigned long long>(r.extra),
+                             static_cast<unsigned long long>(r.peak_threads),
+                             static_cast<unsigned long long>(r.peak_rss_kb),
+                             static_cast<unsigned long long>(r.context_switches));
+        }
+
+        void print_json(std::FILE * out) const
+        {
+            std::fprintf(out, "[\n");
+
+            for (std::size_t i = 0; i < m_results.size(); ++i)
+            {
+                Result const & r = m_results[i];
+                std::fprintf(out, "  {\"benchmark\":\"%s\",\"bus\":\"%s\",\"producers\":%u,\"operations\":%llu,"
+                             "\"elapsed_ns\":%llu,\"ops_per_sec\":%.1f,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+                             "\"p999_ns\":%llu,\"mean_ns\":%llu,\"extra\":%llu,\"peak_threads\":%llu,"
+                             "\"peak_rss_kb\":%llu,\"context_switches\":%llu}%s\n",
+                             r.benchmark.c_str(), r.bus.c_str(), r.producers,
+                             static_cast<unsigned long long>(r.operations),
+                             static_cast<unsigned long long>(r.elapsed_ns), r.ops_per_sec(),
+                             static_cast<unsigned long long>(r.p50_ns),
+                             static_cast<unsigned long long>(r.p99_ns),
+                             static_cast<unsigned long long>(r.p999_ns),
+                             static_cast<unsigned long long>(r.mean_ns),
+                             static_cast<unsigned long long>(r.extra),
+                             static_cast<unsigned long long>(r.peak_threads),
+                             static_cast<unsigned long long>(r.peak_rss_kb),
+                             static_cast<unsigned long long>(r.context_switches),
+                             i + 1 < m_results.size() ? "," : "");
+            }
+
+            std::fprintf(out, "]\n");
+        }
+    };
+
+} /* end namespace bench */
+
+#endif // guard
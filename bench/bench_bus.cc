@@ -0,0 +1,465 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <malloc.h>
+
+#include "bench.hh"
+#include "subsystem.hh"
+
+/**
+ * @file bench_bus.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Bus throughput and latency.
+ *  - bus_push_pop: N producer threads push into one Bus, the main thread pops.
+ *    Latency is enqueue to dequeue. extra = futex wake and wait syscalls of
+ *    the bus, divide by operations for syscalls per message.
+ *  - ping_pong: two ThreadedSubsystems bounce a message back and forth.
+ *    Latency is one hop, post_message to handler. extra = round trips.
+ *    ping_pong_adaptive does the same with WaitStrategy::adaptive().
+ *  - worker_drain: the main thread floods one ThreadedSubsystem, throughput of
+ *    its message loop. extra = yield_after, 1 yields after every message as
+ *    the loop used to, 0 never yields while the bus has messages.
+ *  - hooks_virtual / hooks_static: a subsystem handles a backlog of child
+ *    events, its on_child counts them. ThreadedSubsystem calls the hook
+ *    through the vtable, StaticSubsystem by name.
+ *  - ipc_layout_packed / ipc_layout_legacy: fills a bus with SubsystemIPC, or
+ *    with the 16 byte layout it had before, then drains it on one thread.
+ *    Throughput is push plus pop. extra = heap bytes held per queued message.
+ *  - arena_new_delete / arena_pool: the same fill and drain on a ThreadsafeQueue
+ *    allocating from global new, or from a PoolResource over a caller buffer.
+ *    extra = malloc bytes held per queued message.
+ */
+
+using namespace management;
+
+namespace
+{
+    struct Item
+    {
+        std::uint64_t sent_ns;
+    };
+
+    /**
+     * @return Wakeup syscalls made by a bus so far, 0 if it does not count them
+     */
+    template<typename B>
+        auto wakeup_syscalls(B const & bus, int) -> decltype(bus.wakeup().wake_calls())
+        {
+            return bus.wakeup().wake_calls() + bus.wakeup().wait_calls();
+        }
+
+    template<typename B>
+        std::uint64_t wakeup_syscalls(B const &, long) { return 0; }
+
+    /**
+     * @brief Pushes items from producers threads, pops them on the calling thread
+     */
+    template<template<typename...> class Bus>
+        bench::Result bus_push_pop(char const * bus_name, unsigned producers, std::uint64_t total)
+        {
+            Bus<Item> bus;
+            std::atomic_bool go{false};
+            std::vector<std::thread> threads;
+            std::uint64_t per_producer = total / producers;
+            total = per_producer * producers;
+
+            for (unsigned p = 0; p < producers; ++p)
+                threads.emplace_back([&bus, &go, per_producer] {
+                    while (!go.load(std::memory_order_acquire))
+                        std::this_thread::yield();
+
+                    for (std::uint64_t i = 0; i < per_producer; ++i)
+                        bus.push(Item{bench::now_ns()});
+                });
+
+            bench::Samples samples{total};
+            std::uint64_t start = bench::now_ns();
+            go.store(true, std::memory_order_release);
+
+            for (std::uint64_t i = 0; i < total; ++i)
+            {
+                auto item = bus.wait_and_pop();
+                std::uint64_t now = bench::now_ns();
+                samples.add(now > item->sent_ns ? now - item->sent_ns : 0);
+            }
+
+            std::uint64_t elapsed = bench::now_ns() - start;
+
+            for (auto & t : threads)
+                t.join();
+
+            bench::Result r;
+            r.benchmark = producers == 1 ? "bus_push_pop_spsc" : "bus_push_pop_mpsc";
+            r.bus = bus_name;
+            r.producers = producers;
+            r.operations = total;
+            r.elapsed_ns = elapsed;
+            r.set_latency(samples);
+            r.extra = wakeup_syscalls(bus, 0);
+            return r;
+        }
+
+    struct Ping
+    {
+        std::uint64_t sent_ns;
+        std::uint64_t remaining;
+    };
+
+    using PingIPC = SubsystemIPC_Extended<Ping>;
+
+    /**
+     * @brief One side of the ping pong pair
+     */
+    template<template<typename...> class Bus>
+        struct PingPong : ThreadedSubsystem<Bus, PingIPC, PingPong<Bus>>,
+            helpers::extended_ipc_dispatcher<PingPong<Bus>>
+    {
+        using Base = ThreadedSubsystem<Bus, PingIPC, PingPong<Bus>>;
+
+        PingPong<Bus> * peer = nullptr;
+        std::atomic_bool * done = nullptr;
+        /* only touched by this subsystem's worker */
+        bench::Samples samples;
+
+        PingPong(char const * name, SubsystemMap & m, std::size_t expected, ThreadedSubsystemOptions options) :
+            Base(name, m, {}, options),
+            samples(expected)
+        { }
+
+        using Base::operator();
+
+        bool operator() (Ping & ping)
+        {
+            std::uint64_t now = bench::now_ns();
+            samples.add(now - ping.sent_ns);
+
+            if (ping.remaining == 0)
+                done->store(true, std::memory_order_release);
+            else
+                peer->post_message(Ping{bench::now_ns(), ping.remaining - 1});
+
+            return true;
+        }
+    };
+
+    template<template<typename...> class Bus>
+        bench::Result ping_pong(char const * bus_name, std::uint64_t rounds,
+                               WaitStrategy const & strategy = WaitStrategy{})
+        {
+            ThreadedSubsystemOptions options;
+            options.wait = strategy;
+
+            SubsystemMap map;
+            std::atomic_bool done{false};
+            std::uint64_t elapsed;
+
+            {
+                PingPong<Bus> a{"ping", map, rounds + 1, options};
+                PingPong<Bus> b{"pong", map, rounds + 1, options};
+                a.peer = &b;
+                b.peer = &a;
+                a.done = b.done = &done;
+
+                std::uint64_t start = bench::now_ns();
+                a.post_message(Ping{bench::now_ns(), rounds * 2});
+
+                while (!done.load(std::memory_order_acquire))
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+                elapsed = bench::now_ns() - start;
+
+                a.samples.merge(b.samples);
+
+                bench::Result r;
+                r.benchmark = strategy.spins || strategy.yields ? "ping_pong_adaptive" : "ping_pong";
+                r.bus = bus_name;
+                r.producers = 1;
+                r.operations = rounds * 2 + 1;
+                r.elapsed_ns = elapsed;
+                r.set_latency(a.samples);
+                r.extra = rounds;
+
+                a.destroy();
+                b.destroy();
+                return r;
+            }
+        }
+
+    struct Count
+    {
+        std::uint64_t sent_ns;
+    };
+
+    using CountIPC = SubsystemIPC_Extended<Count>;
+
+    /**
+     * @brief Counts what it receives, nothing else
+     */
+    template<template<typename...> class Bus>
+        struct Drain : ThreadedSubsystem<Bus, CountIPC, Drain<Bus>>,
+            helpers::extended_ipc_dispatcher<Drain<Bus>>
+    {
+        using Base = ThreadedSubsystem<Bus, CountIPC, Drain<Bus>>;
+
+        std::atomic<std::uint64_t> received{0};
+
+        Drain(SubsystemMap & m, ThreadedSubsystemOptions options) :
+            Base("drain", m, {}, options)
+        { }
+
+        using Base::operator();
+
+        bool operator() (Count &)
+        {
+            received.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    /**
+     * @brief One producer floods a ThreadedSubsystem, measures the worker loop
+     * @param yield_after Fairness budget, 1 is the old yield after every message
+     */
+    template<template<typename...> class Bus>
+        bench::Result worker_drain(char const * bus_name, std::uint32_t yield_after, std::uint64_t total)
+        {
+            SubsystemMap map;
+            ThreadedSubsystemOptions options;
+            options.yield_after = yield_after;
+
+            Drain<Bus> drain{map, options};
+            bench::ResourceMonitor monitor;
+            std::uint64_t start = bench::now_ns();
+
+            for (std::uint64_t i = 0; i < total; ++i)
+                drain.post_message(Count{0});
+
+            while (drain.received.load(std::memory_order_acquire) < total)
+                std::this_thread::yield();
+
+            bench::Result r;
+            r.benchmark = "worker_drain";
+            r.bus = bus_name;
+            r.producers = 1;
+            r.operations = total;
+            r.elapsed_ns = bench::now_ns() - start;
+            r.extra = yield_after;
+            monitor.finish(r);
+
+            drain.destroy();
+            return r;
+        }
+
+    /**
+     * @brief Counts child events, on_child through the vtable
+     */
+    struct VirtualHooks : ThreadedSubsystem<>
+    {
+        std::atomic<std::uint64_t> received{0};
+        std::atomic_bool open{false};
+
+        explicit VirtualHooks(SubsystemMap & m) : ThreadedSubsystem("virtual", m) { }
+
+        void on_child(SubsystemIPC) override
+        {
+            while (!open.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            received.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+    /**
+     * @brief Counts child events, on_child called by name
+     */
+    struct StaticHooks : StaticSubsystem<StaticHooks>
+    {
+        std::atomic<std::uint64_t> received{0};
+        std::atomic_bool open{false};
+
+        explicit StaticHooks(SubsystemMap & m) : StaticSubsystem("static", m) { }
+
+        void on_child(SubsystemIPC)
+        {
+            while (!open.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            received.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+    /**
+     * @brief Queues child events on one subsystem, then times their handling
+     * @details The first on_child holds the worker until everything is queued.
+     */
+    template<typename Node>
+        bench::Result hooks(char const * benchmark, std::uint64_t total)
+        {
+            SubsystemMap map;
+            Node node{map};
+            detail::SubsystemLink & link = node;
+            /* an unknown child tag, handle_child_event only forwards it */
+            SubsystemIPC event{SubsystemIPC::CHILD, 0, SubsystemState::RUNNING};
+
+            for (std::uint64_t i = 0; i < total; ++i)
+                link.put_message(event);
+
+            std::uint64_t start = bench::now_ns();
+            node.open.store(true, std::memory_order_release);
+
+            while (node.received.load(std::memory_order_acquire) < total)
+                std::this_thread::yield();
+
+            bench::Result r;
+            r.benchmark = benchmark;
+            r.bus = "ThreadsafeQueue";
+            r.producers = 1;
+            r.operations = total;
+            r.elapsed_ns = bench::now_ns() - start;
+
+            node.destroy();
+            return r;
+        }
+
+    /**
+     * @brief SubsystemIPC as it was laid out before it was packed
+     */
+    struct LegacyIPC
+    {
+        enum Origin { PARENT, CHILD, SELF };
+
+        Origin from;
+        SubsystemTag tag;
+        SubsystemState state;
+        std::uint32_t seq;
+    };
+
+    static_assert(sizeof(LegacyIPC) == 16, "LegacyIPC must keep the old padding");
+
+    /**
+     * @brief Fills a bus to depth and drains it, rounds times
+     */
+    template<template<typename...> class Bus, typename Message>
+        bench::Result ipc_layout(char const * bus_name, char const * benchmark,
+                                 std::size_t depth, std::uint64_t total)
+        {
+            Bus<Message> bus;
+            std::uint64_t rounds = std::max<std::uint64_t>(total / depth, 1);
+
+            /* untimed warm-up round, the heap probe costs more than the pushes */
+            std::size_t before = ::mallinfo2().uordblks;
+
+            for (std::size_t i = 0; i < depth; ++i)
+                bus.push(Message{});
+
+            std::size_t heap_bytes = ::mallinfo2().uordblks - before;
+
+            for (std::size_t i = 0; i < depth; ++i)
+                (void)bus.try_pop();
+
+            std::uint64_t start = bench::now_ns();
+
+            for (std::uint64_t round = 0; round < rounds; ++round)
+            {
+                for (std::size_t i = 0; i < depth; ++i)
+                    bus.push(Message{});
+
+                for (std::size_t i = 0; i < depth; ++i)
+                    (void)bus.try_pop();
+            }
+
+            bench::Result r;
+            r.benchmark = benchmark;
+            r.bus = bus_name;
+            r.producers = 1;
+            r.operations = rounds * depth;
+            r.elapsed_ns = bench::now_ns() - start;
+            r.extra = heap_bytes / depth;
+            return r;
+        }
+
+    /**
+     * @brief Fills a ThreadsafeQueue on resource and drains it, depth at a time
+     */
+    bench::Result arena(char const * benchmark, MemoryResource * resource,
+                        std::size_t depth, std::uint64_t total)
+    {
+        ThreadsafeQueue<SubsystemIPC> bus{resource};
+        std::uint64_t rounds = std::max<std::uint64_t>(total / depth, 1);
+
+        /* untimed warm-up round, see ipc_layout */
+        std::size_t before = ::mallinfo2().uordblks;
+
+        for (std::size_t i = 0; i < depth; ++i)
+            bus.push(SubsystemIPC{});
+
+        std::size_t heap_bytes = ::mallinfo2().uordblks - before;
+
+        for (std::size_t i = 0; i < depth; ++i)
+            (void)bus.try_pop();
+
+        std::uint64_t start = bench::now_ns();
+
+        for (std::uint64_t round = 0; round < rounds; ++round)
+        {
+            for (std::size_t i = 0; i < depth; ++i)
+                bus.push(SubsystemIPC{});
+
+            for (std::size_t i = 0; i < depth; ++i)
+                (void)bus.try_pop();
+        }
+
+        bench::Result r;
+        r.benchmark = benchmark;
+        r.bus = "ThreadsafeQueue";
+        r.producers = 1;
+        r.operations = rounds * depth;
+        r.elapsed_ns = bench::now_ns() - start;
+        r.extra = heap_bytes / depth;
+        return r;
+    }
+
+    /**
+     * @brief Every benchmark for one Bus implementation
+     */
+    template<template<typename...> class Bus>
+        void run_suite(char const * bus_name, bench::Options const & options, bench::Report & report)
+        {
+            for (unsigned producers : {1u, 4u, 16u})
+                report.add(bus_push_pop<Bus>(bus_name, producers, options.iterations(1000000)));
+
+            report.add(ping_pong<Bus>(bus_name, options.iterations(100000)));
+            report.add(ping_pong<Bus>(bus_name, options.iterations(100000), WaitStrategy::adaptive()));
+
+            for (std::uint32_t yield_after : {1u, 64u, 0u})
+                report.add(worker_drain<Bus>(bus_name, yield_after, options.iterations(1000000)));
+
+            report.add(ipc_layout<Bus, LegacyIPC>(bus_name, "ipc_layout_legacy", 512, options.iterations(1000000)));
+            report.add(ipc_layout<Bus, SubsystemIPC>(bus_name, "ipc_layout_packed", 512, options.iterations(1000000)));
+        }
+}
+
+int main(int argc, char ** argv)
+{
+    bench::Options options{argc, argv};
+    bench::Report report{options};
+
+    run_suite<ThreadsafeQueue>("ThreadsafeQueue", options, report);
+    run_suite<NumaQueue>("NumaQueue", options, report);
+    run_suite<SpscQueue>("SpscQueue", options, report);
+    run_suite<MultiLaneQueue>("MultiLaneQueue", options, report);
+
+    report.add(hooks<VirtualHooks>("hooks_virtual", options.iterations(1000000)));
+    report.add(hooks<StaticHooks>("hooks_static", options.iterations(1000000)));
+
+    static char buffer[1 << 20];
+    MonotonicResource arena_buffer{buffer, sizeof(buffer)};
+    PoolResource pool{&arena_buffer};
+    report.add(arena("arena_new_delete", new_delete_resource(), 512, options.iterations(1000000)));
+    report.add(arena("arena_pool", &pool, 512, options.iterations(1000000)));
+
+    report.print();
+    return 0;
+}
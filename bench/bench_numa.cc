@@ -0,0 +1,124 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "bench.hh"
+#include "subsystem.hh"
+
+/**
+ * @file bench_numa.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Cost of crossing NUMA nodes. One producer thread pinned to node P posts to
+ * a ThreadedSubsystem homed on node S (ThreadedSubsystemOptions::numa_node).
+ * Every (P, S) pair is run, numa_local when P == S and numa_remote
+ * otherwise. Latency is post_message to handler. extra = P * 100 + S.
+ * On a single node machine only the local rows are produced.
+ */
+
+using namespace management;
+
+namespace
+{
+    struct Item
+    {
+        std::uint64_t sent_ns;
+    };
+
+    using ItemIPC = SubsystemIPC_Extended<Item>;
+
+    template<template<typename...> class Bus>
+        struct Sink : ThreadedSubsystem<Bus, ItemIPC, Sink<Bus>>,
+            helpers::extended_ipc_dispatcher<Sink<Bus>>
+    {
+        using Base = ThreadedSubsystem<Bus, ItemIPC, Sink<Bus>>;
+
+        std::atomic<std::uint64_t> received{0};
+        /* only touched by this subsystem's worker */
+        bench::Samples samples;
+
+        Sink(SubsystemMap & m, ThreadedSubsystemOptions options, std::size_t expected) :
+            Base("sink", m, {}, options),
+            samples(expected)
+        { }
+
+        using Base::operator();
+
+        bool operator() (Item & item)
+        {
+            std::uint64_t now = bench::now_ns();
+            samples.add(now > item.sent_ns ? now - item.sent_ns : 0);
+            received.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    template<template<typename...> class Bus>
+        bench::Result cross(char const * bus_name, int producer_node, int sink_node, std::uint64_t total)
+        {
+            SubsystemMap map;
+            ThreadedSubsystemOptions options;
+            options.numa_node = sink_node;
+
+            Sink<Bus> sink{map, options, total};
+
+            std::uint64_t start = bench::now_ns();
+
+            std::thread producer{[&sink, producer_node, total] {
+                ThreadedSubsystemOptions pin;
+                pin.numa_node = producer_node;
+                pin.set_name = false;
+                (void)detail::configure_thread("producer", pin);
+
+                for (std::uint64_t i = 0; i < total; ++i)
+                {
+                    sink.post_message(Item{bench::now_ns()});
+
+                    /* keep the bus short so the run measures transfer, not backlog */
+                    while (sink.received.load(std::memory_order_acquire) + 64 < i)
+                        std::this_thread::yield();
+                }
+            }};
+
+            producer.join();
+
+            while (sink.received.load(std::memory_order_acquire) < total)
+                std::this_thread::yield();
+
+            bench::Result r;
+            r.benchmark = producer_node == sink_node ? "numa_local" : "numa_remote";
+            r.bus = bus_name;
+            r.producers = 1;
+            r.operations = total;
+            r.elapsed_ns = bench::now_ns() - start;
+            r.set_latency(sink.samples);
+            r.extra = static_cast<std::uint64_t>(producer_node * 100 + sink_node);
+
+            sink.destroy();
+            return r;
+        }
+
+    template<template<typename...> class Bus>
+        void run_suite(char const * bus_name, bench::Options const & options, bench::Report & report)
+        {
+            int nodes = numa::node_count();
+
+            for (int p = 0; p < nodes; ++p)
+                for (int s = 0; s < nodes; ++s)
+                    if (!numa::node_cpus(p).empty() && !numa::node_cpus(s).empty())
+                        report.add(cross<Bus>(bus_name, p, s, options.iterations(200000)));
+        }
+}
+
+int main(int argc, char ** argv)
+{
+    bench::Options options{argc, argv};
+    bench::Report report{options};
+
+    run_suite<ThreadsafeQueue>("ThreadsafeQueue", options, report);
+    run_suite<NumaQueue>("NumaQueue", options, report);
+
+    report.print();
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.hh"
+#include "subsystem.hh"
+
+/**
+ * @file bench_startup.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Boot time of a large graph, a tree with fan-out 4.
+ *  - *_build: constructing every node, operations = nodes
+ *  - *_running: root.start() until every node committed RUNNING
+ * eager builds node by node, batch builds through a SubsystemBatch with
+ * lazily started workers. extra = threads alive right after the build.
+ */
+
+using namespace management;
+
+namespace
+{
+    using Node = ThreadedSubsystem<>;
+
+    std::uint64_t current_threads()
+    {
+        bench::ResourceMonitor monitor;
+        bench::Result r;
+        monitor.finish(r);
+        return r.peak_threads;
+    }
+
+    bool wait_running(SubsystemMap & map, std::size_t nodes, bench::ResourceMonitor & monitor)
+    {
+        std::vector<SubsystemSnapshot> entries(nodes);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+        unsigned polls = 0;
+
+        for (;;)
+        {
+            std::size_t n = std::min(map.snapshot(entries.data(), entries.size()), entries.size());
+
+            if (n == nodes && std::all_of(entries.begin(), entries.end(), [] (SubsystemSnapshot const & e) {
+                    return e.state == SubsystemState::RUNNING;
+                }))
+                return true;
+
+            if (++polls % 64 == 0) {
+                monitor.sample();
+                if (std::chrono::steady_clock::now() > deadline)
+                    return false;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    template<typename Build>
+        void run(char const * mode, std::size_t count, Build && build, bench::Report & report)
+        {
+            SubsystemMap map{static_cast<std::uint32_t>(count)};
+            std::vector<std::unique_ptr<Node>> nodes;
+            nodes.reserve(count);
+
+            bench::Result r;
+            r.bus = "ThreadsafeQueue";
+            r.operations = count;
+
+            {
+                bench::ResourceMonitor monitor;
+                std::uint64_t start = bench::now_ns();
+                build(map, nodes, count);
+                r.elapsed_ns = bench::now_ns() - start;
+                r.benchmark = std::string("startup_") + mode + "_build";
+                r.extra = current_threads();
+                monitor.finish(r);
+                report.add(r);
+            }
+
+            {
+                bench::ResourceMonitor monitor;
+                std::uint64_t start = bench::now_ns();
+                nodes.front()->start();
+                bool ok = wait_running(map, count, monitor);
+                r.elapsed_ns = bench::now_ns() - start;
+                r.benchmark = std::string("startup_") + mode + (ok ? "_running" : "_running_timeout");
+                monitor.finish(r);
+                report.add(r);
+            }
+
+            nodes.front()->destroy();
+
+            /* leaves first, each destructor joins its worker */
+            while (!nodes.empty())
+                nodes.pop_back();
+        }
+
+    void build_eager(SubsystemMap & map, std::vector<std::unique_ptr<Node>> & nodes, std::size_t count)
+    {
+        nodes.emplace_back(new Node{"n0", map});
+
+        for (std::size_t i = 1; i < count; ++i)
+            nodes.emplace_back(new Node{"n" + std::to_string(i), map, {*nodes[(i - 1) / 4]}});
+    }
+
+    void build_batch(SubsystemMap & map, std::vector<std::unique_ptr<Node>> & nodes, std::size_t count)
+    {
+        SubsystemBatch batch{map, static_cast<std::uint32_t>(count)};
+
+        nodes.emplace_back(new Node{"n0", batch});
+
+        for (std::size_t i = 1; i < count; ++i)
+            nodes.emplace_back(new Node{"n" + std::to_string(i), batch, {*nodes[(i - 1) / 4]}});
+
+        batch.commit();
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    bench::Options options{argc, argv};
+    bench::Report report{options};
+
+    std::size_t count = options.quick ? 200 : 2000;
+
+    run("eager", count, build_eager, report);
+    run("batch", count, build_batch, report);
+
+    report.print();
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "bench.hh"
+#include "subsystem.hh"
+
+/**
+ * @file bench_topology.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * How state propagation scales with graph shape. Each run builds a graph on
+ * one SubsystemMap and measures the time from root.start() (and later
+ * root.destroy()) until every node has committed the new state, as seen
+ * through SubsystemMap::snapshot.
+ *  - chain: depth 1 to 1000, every node has one parent
+ *  - star: one root with 1 to 10000 children
+ *  - dag: random layered DAG, nodes take 1-3 parents so diamonds are common
+ * operations = nodes, extra = edges.
+ */
+
+using namespace management;
+
+namespace
+{
+    using Node = ThreadedSubsystem<>;
+
+    struct Graph
+    {
+        SubsystemMap map;
+        std::vector<std::unique_ptr<Node>> nodes;
+        std::uint64_t edges = 0;
+
+        /**
+         * @brief Adds a node, SubsystemParentsList is an initializer_list so
+         *        the parent count is spelled out
+         */
+        Node & add(std::vector<Node *> const & parents)
+        {
+            std::string name = "n" + std::to_string(nodes.size());
+            Node * node;
+
+            switch(parents.size())
+            {
+            case 0: node = new Node{name, map, {}}; break;
+            case 1: node = new Node{name, map, {*parents[0]}}; break;
+            case 2: node = new Node{name, map, {*parents[0], *parents[1]}}; break;
+            default: node = new Node{name, map, {*parents[0], *parents[1], *parents[2]}}; break;
+            }
+
+            edges += std::min<std::size_t>(parents.size(), 3);
+            nodes.emplace_back(node);
+            return *node;
+        }
+
+        ~Graph()
+        {
+            /* leaves first, each destructor joins its worker */
+            while (!nodes.empty())
+                nodes.pop_back();
+        }
+    };
+
+    void build_chain(Graph & g, std::size_t n)
+    {
+        Node * prev = &g.add({});
+        for (std::size_t i = 1; i < n; ++i)
+            prev = &g.add({prev});
+    }
+
+    void build_star(Graph & g, std::size_t children)
+    {
+        Node * root = &g.add({});
+        for (std::size_t i = 0; i < children; ++i)
+            g.add({root});
+    }
+
+    void build_dag(Graph & g, std::size_t n)
+    {
+        std::mt19937 rng{42};
+        std::size_t window = std::max<std::size_t>(2, static_cast<std::size_t>(std::sqrt(static_cast<double>(n))));
+
+        g.add({});
+
+        for (std::size_t i = 1; i < n; ++i)
+        {
+            std::size_t lo = i > window ? i - window : 0;
+            std::size_t want = 1 + rng() % 3;
+            std::vector<Node *> parents;
+
+            while (parents.size() < want && parents.size() < i - lo)
+            {
+                Node * p = g.nodes[lo + rng() % (i - lo)].get();
+                if (std::find(parents.begin(), parents.end(), p) == parents.end())
+                    parents.push_back(p);
+            }
+
+            g.add(parents);
+        }
+    }
+
+    /**
+     * @brief Polls the map until every node reports state
+     * @return F, on timeout
+     */
+    bool wait_all(Graph & g, SubsystemState state, bench::ResourceMonitor & monitor,
+                  std::chrono::seconds timeout)
+    {
+        std::vector<SubsystemSnapshot> entries(g.nodes.size());
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        unsigned polls = 0;
+
+        for (;;)
+        {
+            std::size_t n = g.map.snapshot(entries.data(), entries.size());
+            n = std::min(n, entries.size());
+
+            bool all = n == g.nodes.size() && std::all_of(entries.begin(), entries.begin() + n,
+                [state] (SubsystemSnapshot const & e) { return e.state == state; });
+
+            if (all)
+                return true;
+
+            /* /proc reads are not free, sample every so often */
+            if (++polls % 64 == 0) {
+                monitor.sample();
+                if (std::chrono::steady_clock::now() > deadline)
+                    return false;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Leaves room for the rest of the process under RLIMIT_NPROC
+     */
+    bool fits_thread_limit(std::size_t nodes)
+    {
+        struct rlimit lim;
+        if (::getrlimit(RLIMIT_NPROC, &lim) != 0 || lim.rlim_cur == RLIM_INFINITY)
+            return true;
+        return nodes + 64 < lim.rlim_cur;
+    }
+
+    template<typename Builder>
+        void run(char const * shape, std::size_t size, Builder && build, bench::Report & report)
+        {
+            Graph g;
+            build(g, size);
+
+            bench::Result r;
+            r.bus = "ThreadsafeQueue";
+            r.operations = g.nodes.size();
+            r.extra = g.edges;
+
+            {
+                bench::ResourceMonitor monitor;
+                std::uint64_t start = bench::now_ns();
+                g.nodes.front()->start();
+                bool ok = wait_all(g, SubsystemState::RUNNING, monitor, std::chrono::seconds(60));
+                r.elapsed_ns = bench::now_ns() - start;
+                r.benchmark = std::string(shape) + (ok ? "_start" : "_start_timeout");
+                monitor.finish(r);
+                report.add(r);
+            }
+
+            {
+                bench::ResourceMonitor monitor;
+                std::uint64_t start = bench::now_ns();
+                g.nodes.front()->destroy();
+                bool ok = wait_all(g, SubsystemState::DESTROY, monitor, std::chrono::seconds(60));
+                r.elapsed_ns = bench::now_ns() - start;
+                r.benchmark = std::string(shape) + (ok ? "_destroy" : "_destroy_timeout");
+                monitor.finish(r);
+                report.add(r);
+            }
+        }
+}
+
+int main(int argc, char ** argv)
+{
+    bench::Options options{argc, argv};
+    bench::Report report{options};
+
+    std::size_t limit = options.quick ? 100 : 10000;
+
+    for (std::size_t n : {1u, 10u, 100u, 1000u})
+        if (n <= limit && fits_thread_limit(n))
+            run("chain", n, build_chain, report);
+
+    for (std::size_t n : {1u, 10u, 100u, 1000u, 10000u})
+        if (n <= limit && fits_thread_limit(n + 1))
+            run("star", n, build_star, report);
+
+    for (std::size_t n : {10u, 100u, 1000u})
+        if (n <= limit && fits_thread_limit(n))
+            run("dag", n, build_dag, report);
+
+    report.print();
+    return 0;
+}
@@ -0,0 +1,189 @@
+#ifndef _SHARED_FUTEX_NOTIFIER_H_
+#define _SHARED_FUTEX_NOTIFIER_H_
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @file futex_notifier.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Single consumer wakeup on a bare futex word. A producer only enters the
+ * kernel when the consumer announced that it is going to sleep, a consumer
+ * that is busy handling messages costs its producers nothing but a fence.
+ */
+
+namespace management
+{
+    /**
+     * @brief Wakeup for one consumer and any number of producers
+     * @details Consumer side:
+     *
+     *          auto epoch = notifier.prepare_wait();
+     *          if (ready())
+     *              notifier.cancel_wait();
+     *          else
+     *              notifier.wait(epoch);
+     *
+     *          The condition has to be checked between prepare_wait and wait,
+     *          a producer that published before prepare_wait does not wake.
+     *          Producers publish, then call notify.
+     */
+    class FutexNotifier final
+    {
+    private:
+        /**< The futex word, bumped by every notify that finds a sleeper */
+        std::atomic<std::uint32_t> m_epoch{0};
+        /**< Non-zero while the consumer is between prepare_wait and the end of wait */
+        std::atomic<std::uint32_t> m_sleepers{0};
+        /**< FUTEX_WAKE calls, by producers */
+        std::atomic<std::uint64_t> m_wake_calls{0};
+        /**< FUTEX_WAIT calls, by the consumer */
+        std::atomic<std::uint64_t> m_wait_calls{0};
+
+        static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+                      "the futex word must be a plain 32 bit integer");
+
+        long futex(int op, std::uint32_t value, struct timespec const * timeout)
+        {
+            return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&m_epoch),
+                             op | FUTEX_PRIVATE_FLAG, value, timeout, nullptr, 0);
+        }
+
+    public:
+        FutexNotifier() = default;
+        FutexNotifier(FutexNotifier const &) = delete;
+
+        /**
+         * @brief Announces that the consumer is about to sleep
+         * @return The epoch to pass to wait
+         */
+        std::uint32_t prepare_wait()
+        {
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            /* pairs with the fence in notify: either the producer sees us, or we see its data */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            /* acquire: a bump we see brings the data published before it */
+            return m_epoch.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief The condition became true after prepare_wait, not sleeping after all
+         */
+        void cancel_wait()
+        {
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Sleeps until a notify after prepare_wait
+         * @details May return early, the caller re-checks its condition.
+         * @param epoch From prepare_wait
+         */
+        void wait(std::uint32_t epoch)
+        {
+            m_wait_calls.fetch_add(1, std::memory_order_relaxed);
+            (void)futex(FUTEX_WAIT, epoch, nullptr);
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Sleeps until a notify after prepare_wait, at most timeout
+         * @return F, if the timeout expired
+         */
+        bool wait_for(std::uint32_t epoch, std::chrono::nanoseconds timeout)
+        {
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+            ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+
+            m_wait_calls.fetch_add(1, std::memory_order_relaxed);
+            bool expired = futex(FUTEX_WAIT, epoch, &ts) != 0 && errno == ETIMEDOUT;
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            return !expired;
+        }
+
+        /**
+         * @brief Sleeps until ready() holds
+         * @param ready Condition, published by the producers before notify
+         */
+        template<typename Ready>
+            void await(Ready && ready)
+            {
+                while (!ready())
+                {
+                    std::uint32_t epoch = prepare_wait();
+
+                    if (ready()) {
+                        cancel_wait();
+                        return;
+                    }
+
+                    wait(epoch);
+                }
+            }
+
+        /**
+         * @brief Sleeps until ready() holds or deadline passed
+         * @return T, if ready() holds
+         */
+        template<typename Ready>
+            bool await_until(Ready && ready, std::chrono::steady_clock::time_point deadline)
+            {
+                while (!ready())
+                {
+                    auto left = deadline - std::chrono::steady_clock::now();
+
+                    if (left <= std::chrono::steady_clock::duration::zero())
+                        return false;
+
+                    std::uint32_t epoch = prepare_wait();
+
+                    if (ready()) {
+                        cancel_wait();
+                        return true;
+                    }
+
+                    wait_for(epoch, std::chrono::duration_cast<std::chrono::nanoseconds>(left));
+                }
+
+                return true;
+            }
+
+        /**
+         * @brief Wakes the consumer, if it sleeps or is about to
+         * @details Call after publishing whatever the consumer waits for.
+         */
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            /* a running consumer costs a fence, nothing is written */
+            if (m_sleepers.load(std::memory_order_relaxed) != 0) {
+                m_epoch.fetch_add(1, std::memory_order_relaxed);
+                m_wake_calls.fetch_add(1, std::memory_order_relaxed);
+                (void)futex(FUTEX_WAKE, 1, nullptr);
+            }
+        }
+
+        /**
+         * @return FUTEX_WAKE syscalls made by producers
+         */
+        std::uint64_t wake_calls() const { return m_wake_calls.load(std::memory_order_relaxed); }
+
+        /**
+         * @return FUTEX_WAIT syscalls made by the consumer
+         */
+        std::uint64_t wait_calls() const { return m_wait_calls.load(std::memory_order_relaxed); }
+    };
+
+} // end namespace management
+
+#endif // guard
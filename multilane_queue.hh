@@ -0,0 +1,557 @@
+#ifndef _SHARED_MULTILANE_QUEUE_H_
+#define _SHARED_MULTILANE_QUEUE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "futex_notifier.hh"
+#include "spsc_queue.hh"
+#include "wait_strategy.hh"
+
+namespace sizes
+{
+    /**< Default MultiLaneQueue producer lanes */
+    constexpr const std::size_t multilane_lanes = 16;
+    /**< Ring slots per lane */
+    constexpr const std::size_t multilane_lane_capacity = 64;
+}
+
+namespace management
+{
+    namespace detail
+    {
+        /**
+         * @brief Lanes a thread holds, given back when the thread exits
+         */
+        struct LaneLeases
+        {
+            /**< Outlives its queue, tells an exiting thread whether the lane still exists */
+            struct Guard {
+                std::mutex mutex;
+                bool alive = true;
+            };
+
+            struct Lease {
+                std::weak_ptr<Guard> guard;
+                std::atomic<std::thread::id> * owner;
+            };
+
+            std::vector<Lease> leases;
+
+            void add(std::shared_ptr<Guard> const & guard, std::atomic<std::thread::id> & owner)
+            {
+                /* forget queues destroyed meanwhile */
+                for (auto it = leases.begin(); it != leases.end();)
+                    it = it->guard.expired() ? leases.erase(it) : it + 1;
+
+                leases.push_back(Lease{guard, &owner});
+            }
+
+            ~LaneLeases()
+            {
+                for (auto & lease : leases)
+                {
+                    std::shared_ptr<Guard> guard = lease.guard.lock();
+                    if (!guard)
+                        continue;
+
+                    std::lock_guard<std::mutex> lk{guard->mutex};
+                    if (guard->alive)
+                        lease.owner->store(std::thread::id{}, std::memory_order_release);
+                }
+            }
+        };
+
+        /**
+         * @return The calling thread's leases
+         */
+        inline LaneLeases & lane_leases()
+        {
+            static thread_local LaneLeases leases;
+            return leases;
+        }
+    }
+
+    /**
+     * @brief Bus with one lane per producer thread
+     * @detail Every producer thread claims a lane on its first push and
+     *      from then on writes to a wait-free ring that no other producer
+     *      touches, so many children reporting to one parent do not contend.
+     *      A lane whose ring is full spills into a small list that only its
+     *      owner and the consumer lock. Threads that find every lane taken
+     *      share one locked lane. A thread gives its lanes back when it
+     *      exits, so workers that come and go do not use them up.
+     *
+     *      Messages of one producer are always delivered in order. The
+     *      consumer takes one message per lane in turn. With
+     *      set_global_order(true) every push draws a ticket from a shared
+     *      counter instead and messages are delivered in ticket order.
+     *
+     *      Drop-in for ThreadsafeQueue.
+     *
+     * @tparam T The type of data to hold
+     * @tparam Lanes Number of producer lanes
+     */
+    template<typename T, typename Lanes = std::integral_constant<std::size_t, sizes::multilane_lanes>>
+        class MultiLaneQueue final
+        {
+        public:
+            /**< Underlaying type */
+            using type = T;
+            /**< Queue type */
+            using data_type = std::unique_ptr<T>;
+            /**< Termination type */
+            using terminator = std::nullptr_t;
+            /**< Enqueue timestamp type */
+            using time_point = std::chrono::steady_clock::time_point;
+
+        private:
+            static constexpr const std::size_t lane_count = Lanes::value;
+
+            /**< Lane entry, the item, when it was pushed and its ticket */
+            struct entry {
+                T * data;
+                time_point enqueued;
+                std::uint64_t ticket;
+            };
+
+            /**< Locked part of a lane */
+            struct spill_list {
+                std::mutex mutex;
+                std::deque<entry> entries;
+                /**< Number of entries, readable without the lock */
+                std::atomic<int> depth{0};
+            };
+
+            struct lane {
+                /**< Producer thread, none until claimed */
+                std::atomic<std::thread::id> owner;
+                detail::SpscRing<entry, sizes::multilane_lane_capacity> ring;
+                spill_list spill;
+                /**< Owner only: entries are in spill, new ones go there too */
+                bool spilled = false;
+
+                lane() : owner(std::thread::id{}) { }
+            };
+
+            lane lanes[lane_count];
+            /**< For threads without a lane */
+            spill_list shared;
+            /**< Keeps exiting producers off the lanes once the queue is gone */
+            std::shared_ptr<detail::LaneLeases::Guard> guard = std::make_shared<detail::LaneLeases::Guard>();
+
+            /**< See set_global_order */
+            bool global_order = false;
+            /**< Next ticket to hand out, global order only */
+            std::atomic<std::uint64_t> next_ticket{0};
+            /**< Consumer only: next ticket to deliver, global order only */
+            std::uint64_t expected_ticket = 0;
+            /**< Consumer only: lane to look at first, per producer order only */
+            std::size_t cursor = 0;
+
+            /**< Wakes the consumer, only when it sleeps */
+            FutexNotifier notifier;
+            /**< How the consumer waits, see set_wait_strategy */
+            WaitStrategy strategy;
+            /**< Where the consumer's waits ended */
+            WaitStats stats;
+
+        public:
+            /**
+             * @brief Default constructor
+             */
+            MultiLaneQueue() = default;
+
+            MultiLaneQueue(MultiLaneQueue const &) = delete;
+
+            ~MultiLaneQueue()
+            {
+                {
+                    std::lock_guard<std::mutex> lk{guard->mutex};
+                    guard->alive = false;
+                }
+
+                for (auto & l : lanes)
+                {
+                    entry e;
+                    while (l.ring.pop(e))
+                        delete e.data;
+                    for (auto & s : l.spill.entries)
+                        delete s.data;
+                }
+
+                for (auto & s : shared.entries)
+                    delete s.data;
+            }
+
+            /**
+             * @brief Delivers messages in push order across producers
+             * @details Call before the first push. Every push then touches one
+             *          shared counter, and the consumer looks at every lane.
+             */
+            void set_global_order(bool value) { global_order = value; }
+
+            /**
+             * @brief Wait for poping
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop()
+            {
+                time_point enqueued;
+                return wait_and_pop(enqueued);
+            }
+
+            /**
+             * @brief Wait for poping
+             * @param enqueued Set to the time the value was pushed
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop(time_point & enqueued)
+            {
+                if (!detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                    stats.record(WaitPhase::PARK);
+                    notifier.await([this] { return size() != 0; });
+                }
+
+                data_type value;
+                pop_visible(value, enqueued);
+                return value;
+            }
+
+            /**
+             * @brief Wait for poping, at most timeout
+             * @param timeout How long to wait for an item
+             * @param value Set to the value at the top of the queue
+             * @param enqueued Set to the time the value was pushed
+             * @return T, if value was set; F, on timeout
+             */
+            template<typename Rep, typename Period>
+                bool wait_and_pop_for(std::chrono::duration<Rep, Period> timeout,
+                                      data_type & value, time_point & enqueued)
+                {
+                    /* a zero timeout is a poll, not a wait */
+                    if (timeout.count() > 0 &&
+                        detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                        pop_visible(value, enqueued);
+                        return true;
+                    }
+
+                    if (timeout.count() > 0)
+                        stats.record(WaitPhase::PARK);
+
+                    if (!notifier.await_until([this] { return size() != 0; },
+                                              std::chrono::steady_clock::now() + timeout))
+                        return false;
+
+                    pop_visible(value, enqueued);
+                    return true;
+                }
+
+            /**
+             * @brief Pop the queue without waiting
+             * @return nullptr or data_type instance
+             */
+            data_type try_pop()
+            {
+                data_type value;
+                time_point enqueued;
+                (void)pop_front(value, enqueued);
+                return value;
+            }
+
+            /**
+             * @brief Pushes a new item into the queue
+             * @details Warning: The data is now owned by the queue
+             * @param new_value The new queue item
+             */
+            void push(T new_value)
+            {
+                /* Copy/move construct T */
+                link(new T(std::move(new_value)));
+            }
+
+            /**
+             * @brief pushes terminator type to tell any queue listeners to stop
+             */
+            void terminate() { link(nullptr); }
+
+            /**
+             * @return The size of the queue
+             * @details Lock free, the value may be stale by the time it is used
+             */
+            int size() const
+            {
+                std::size_t total = static_cast<std::size_t>(shared.depth.load(std::memory_order_relaxed));
+
+                for (auto & l : lanes)
+                    total += l.ring.size() + static_cast<std::size_t>(l.spill.depth.load(std::memory_order_relaxed));
+
+                return static_cast<int>(total);
+            }
+
+            /**
+             * @return Lanes currently owned by a producer thread
+             */
+            std::size_t lanes_in_use() const
+            {
+                std::size_t count = 0;
+
+                for (auto & l : lanes)
+                    if (l.owner.load(std::memory_order_relaxed) != std::thread::id{})
+                        ++count;
+
+                return count;
+            }
+
+            /**
+             * @brief Sets how the consumer waits for items
+             * @details Call before the consumer starts waiting.
+             */
+            void set_wait_strategy(WaitStrategy const & value) { strategy = value; }
+
+            /**
+             * @return Where the consumer's waits ended
+             */
+            WaitStats const & wait_stats() const { return stats; }
+
+            /**
+             * @return The consumer wakeup, for its syscall counters
+             */
+            FutexNotifier const & wakeup() const { return notifier; }
+
+        private:
+            /**
+             * @return The calling thread's lane, nullptr if all are taken
+             */
+            lane * own_lane()
+            {
+                std::thread::id self = std::this_thread::get_id();
+                std::size_t start = std::hash<std::thread::id>()(self) % lane_count;
+
+                for (std::size_t i = 0; i < lane_count; ++i)
+                {
+                    lane & l = lanes[(start + i) % lane_count];
+                    std::thread::id current = l.owner.load(std::memory_order_relaxed);
+
+                    if (current == self)
+                        return &l;
+
+                    /* acquire, the ring may come from a thread that exited */
+                    if (current == std::thread::id{} &&
+                        l.owner.compare_exchange_strong(current, self, std::memory_order_acquire)) {
+                        detail::lane_leases().add(guard, l.owner);
+                        return &l;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            static void spill_push(spill_list & s, entry const & e)
+            {
+                s.entries.push_back(e);
+                s.depth.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Pushes an item, nullptr being the terminator
+             */
+            void link(T * data)
+            {
+                entry e{data, std::chrono::steady_clock::now(), 0};
+                lane * l = own_lane();
+
+                if (!l) {
+                    std::lock_guard<std::mutex> lk{shared.mutex};
+                    /* under the lock, so the shared list stays in ticket order */
+                    if (global_order)
+                        e.ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+                    spill_push(shared, e);
+                }
+                else {
+                    if (global_order)
+                        e.ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+
+                    if (l->spilled || !l->ring.push(e)) {
+                        std::lock_guard<std::mutex> lk{l->spill.mutex};
+
+                        /* back to the ring once the consumer took every spilled entry */
+                        if (l->spill.entries.empty() && l->ring.push(e))
+                            l->spilled = false;
+                        else {
+                            spill_push(l->spill, e);
+                            l->spilled = true;
+                        }
+                    }
+                }
+
+                /* no syscall unless the consumer is asleep */
+                notifier.notify();
+            }
+
+            /**
+             * @brief Oldest entry of a lane without removing it
+             * @details A lane's ring always holds older entries than its spill list.
+             * @param lk Holds the spill lock if the entry is on the spill list
+             * @return nullptr, if the lane is empty
+             */
+            entry const * lane_front(lane & l, std::unique_lock<std::mutex> & lk)
+            {
+                if (entry const * e = l.ring.front())
+                    return e;
+
+                if (l.spill.depth.load(std::memory_order_relaxed) == 0)
+                    return nullptr;
+
+                lk = std::unique_lock<std::mutex>{l.spill.mutex};
+
+                /* the owner may have refilled the ring before spilling again */
+                if (entry const * e = l.ring.front()) {
+                    lk.unlock();
+                    return e;
+                }
+
+                return l.spill.entries.empty() ? nullptr : &l.spill.entries.front();
+            }
+
+            /**
+             * @brief Removes the entry lane_front returned
+             */
+            void lane_pop(lane & l, std::unique_lock<std::mutex> & lk, entry & out)
+            {
+                if (lk.owns_lock()) {
+                    out = l.spill.entries.front();
+                    l.spill.entries.pop_front();
+                    l.spill.depth.fetch_sub(1, std::memory_order_relaxed);
+                }
+                else
+                    (void)l.ring.pop(out);
+            }
+
+            /**
+             * @brief Removes the front of the shared lane
+             * @param want_ticket Only if it carries the next ticket
+             * @return F, if there is nothing to take
+             */
+            bool shared_pop(entry & out, bool want_ticket)
+            {
+                if (shared.depth.load(std::memory_order_relaxed) == 0)
+                    return false;
+
+                std::lock_guard<std::mutex> lk{shared.mutex};
+
+                if (shared.entries.empty())
+                    return false;
+
+                if (want_ticket && shared.entries.front().ticket != expected_ticket)
+                    return false;
+
+                out = shared.entries.front();
+                shared.entries.pop_front();
+                shared.depth.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            /**
+             * @brief Takes the next entry, one lane after the other
+             */
+            bool pop_round_robin(entry & out)
+            {
+                for (std::size_t i = 0; i <= lane_count; ++i)
+                {
+                    std::size_t index = (cursor + i) % (lane_count + 1);
+
+                    if (index == lane_count) {
+                        if (shared_pop(out, false)) {
+                            cursor = 0;
+                            return true;
+                        }
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lk;
+                    lane & l = lanes[index];
+
+                    if (lane_front(l, lk)) {
+                        lane_pop(l, lk, out);
+                        cursor = index + 1;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            /**
+             * @brief Takes the entry with the next ticket, if it was published yet
+             */
+            bool pop_in_order(entry & out)
+            {
+                for (auto & l : lanes)
+                {
+                    std::unique_lock<std::mutex> lk;
+                    entry const * e = lane_front(l, lk);
+
+                    if (e && e->ticket == expected_ticket) {
+                        lane_pop(l, lk, out);
+                        ++expected_ticket;
+                        return true;
+                    }
+                }
+
+                if (shared_pop(out, true)) {
+                    ++expected_ticket;
+                    return true;
+                }
+
+                return false;
+            }
+
+            /**
+             * @brief Removes the next entry
+             * @return F, if there is none yet
+             */
+            bool pop_front(data_type & value, time_point & enqueued)
+            {
+                entry e{};
+
+                if (!(global_order ? pop_in_order(e) : pop_round_robin(e)))
+                    return false;
+
+                value.reset(e.data);
+                enqueued = e.enqueued;
+                return true;
+            }
+
+            /**
+             * @brief Removes the next entry after size() saw one
+             * @details In global order the next ticket may still be on its way
+             *          from a producer that drew it, wait for it like for any
+             *          other item. Its push wakes the notifier.
+             */
+            void pop_visible(data_type & value, time_point & enqueued)
+            {
+                auto popped = [&] { return pop_front(value, enqueued); };
+
+                if (popped())
+                    return;
+
+                if (!detail::spin_wait(strategy, popped, stats)) {
+                    stats.record(WaitPhase::PARK);
+                    notifier.await(popped);
+                }
+            }
+        };
+
+} // end namespace management
+
+#endif // guard
@@ -0,0 +1,313 @@
+#ifndef _SHARED_NUMA_QUEUE_H_
+#define _SHARED_NUMA_QUEUE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#include "subsystem_config.hh"
+#include "subsystem_numa.hh"
+#include "futex_notifier.hh"
+#include "wait_strategy.hh"
+
+namespace management
+{
+    /**
+     * @brief Locking MPSC queue whose entries live on a home NUMA node
+     * @detail Drop-in Bus for ThreadsafeQueue. Entries are linked in place,
+     *      the entry and the item it holds come out of one NodePool block, so
+     *      a push costs no heap allocation once the pool is warm and the
+     *      consumer only touches memory of its own node.
+     *
+     *      Call set_home_node before the first push, slabs that already
+     *      exist stay where they were placed.
+     *
+     * @tparam T The type of data to hold
+     */
+    template<typename T>
+        class NumaQueue final
+        {
+        public:
+            /**< Underlaying type */
+            using type = T;
+            /**< Termination type */
+            using terminator = std::nullptr_t;
+            /**< Enqueue timestamp type */
+            using time_point = std::chrono::steady_clock::time_point;
+
+        private:
+            /**< Queue entry, the item is constructed in place */
+            struct entry {
+                entry * next;
+                time_point enqueued;
+                typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+                T * get() { return reinterpret_cast<T *>(&storage); }
+            };
+
+        public:
+            /**
+             * @brief Destroys the item and gives its block back to the pool
+             */
+            class deleter
+            {
+            private:
+                numa::NodePool * m_pool = nullptr;
+
+            public:
+                deleter() = default;
+                explicit deleter(numa::NodePool & pool) : m_pool(&pool) { }
+
+                void operator()(T * value) const
+                {
+                    value->~T();
+                    /* storage is not the first member, walk back to the entry */
+                    m_pool->deallocate(reinterpret_cast<char *>(value) - offsetof(entry, storage));
+                }
+            };
+
+            /**< Queue type */
+            using data_type = std::unique_ptr<T, deleter>;
+
+        private:
+            /**< Entry and item storage */
+            numa::NodePool pool{sizeof(entry)};
+            /**< Oldest and newest entry */
+            entry * head = nullptr;
+            entry * tail = nullptr;
+            /**< Mutex */
+            std::mutex mutex;
+            /**< Wakes the consumer, only when it sleeps */
+            FutexNotifier notifier;
+            /**< Number of queued entries, readable without the lock */
+            std::atomic<int> depth{0};
+            /**< How the consumer waits, see set_wait_strategy */
+            WaitStrategy strategy;
+            /**< Where the consumer's waits ended */
+            WaitStats stats;
+
+        public:
+            /**
+             * @brief Default constructor
+             */
+            NumaQueue() = default;
+
+            NumaQueue(NumaQueue const &) = delete;
+
+            ~NumaQueue()
+            {
+                while (head)
+                {
+                    entry * e = head;
+                    head = e->next;
+                    if (!is_terminator(e))
+                        e->get()->~T();
+                    pool.deallocate(e);
+                }
+            }
+
+            /**
+             * @brief Places new entries on node
+             * @param node NUMA node, negative for no preference
+             */
+            void set_home_node(int node) { pool.set_node(node); }
+
+            /**
+             * @return The node new entries are placed on
+             */
+            int home_node() const { return pool.get_node(); }
+
+            /**
+             * @brief Wait for poping
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop()
+            {
+                time_point enqueued;
+                return wait_and_pop(enqueued);
+            }
+
+            /**
+             * @brief Wait for poping
+             * @param enqueued Set to the time the value was pushed
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop(time_point & enqueued)
+            {
+                if (detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                    std::lock_guard<std::mutex> lk{mutex};
+                    return pop_front(enqueued);
+                }
+
+                stats.record(WaitPhase::PARK);
+                notifier.await([this] { return size() != 0; });
+
+                std::lock_guard<std::mutex> lk{mutex};
+                return pop_front(enqueued);
+            }
+
+            /**
+             * @brief Wait for poping, at most timeout
+             * @param timeout How long to wait for an item
+             * @param value Set to the value at the top of the queue
+             * @param enqueued Set to the time the value was pushed
+             * @return T, if value was set; F, on timeout
+             */
+            template<typename Rep, typename Period>
+                bool wait_and_pop_for(std::chrono::duration<Rep, Period> timeout,
+                                      data_type & value, time_point & enqueued)
+                {
+                    /* a zero timeout is a poll, not a wait */
+                    if (timeout.count() > 0 &&
+                        detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                        std::lock_guard<std::mutex> lk{mutex};
+                        value = pop_front(enqueued);
+                        return true;
+                    }
+
+                    if (timeout.count() > 0)
+                        stats.record(WaitPhase::PARK);
+
+                    if (!notifier.await_until([this] { return size() != 0; },
+                                              std::chrono::steady_clock::now() + timeout))
+                        return false;
+
+                    std::lock_guard<std::mutex> lk{mutex};
+
+                    value = pop_front(enqueued);
+                    return true;
+                }
+
+            /**
+             * @brief Pop the queue without waiting
+             * @return nullptr or data_type instance
+             */
+            data_type try_pop()
+            {
+                std::lock_guard<std::mutex> lk{mutex};
+
+                if (!head)
+                    return data_type{nullptr, deleter{pool}};
+
+                time_point enqueued;
+                return pop_front(enqueued);
+            }
+
+            /**
+             * @brief Pushes a new item into the queue
+             * @details Warning: The data is now owned by the queue
+             * @param new_value The new queue item
+             */
+            void push(T new_value)
+            {
+                /* allocate and construct outside the queue lock */
+                entry * e = static_cast<entry *>(pool.allocate());
+
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+                try {
+                    ::new (&e->storage) T(std::move(new_value));
+                }
+                catch (...) {
+                    pool.deallocate(e);
+                    throw;
+                }
+#else
+                ::new (&e->storage) T(std::move(new_value));
+#endif
+
+                link(e, std::chrono::steady_clock::now());
+            }
+
+            /**
+             * @brief pushes terminator type to tell any queue listeners to stop
+             */
+            void terminate()
+            {
+                link(static_cast<entry *>(pool.allocate()), time_point::min());
+            }
+
+            /**
+             * @return The size of the queue
+             * @details Lock free, the value may be stale by the time it is used
+             */
+            int size() const
+            {
+                return depth.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Sets how the consumer waits for items
+             * @details Call before the consumer starts waiting.
+             */
+            void set_wait_strategy(WaitStrategy const & value) { strategy = value; }
+
+            /**
+             * @return Where the consumer's waits ended
+             */
+            WaitStats const & wait_stats() const { return stats; }
+
+            /**
+             * @return The consumer wakeup, for its syscall counters
+             */
+            FutexNotifier const & wakeup() const { return notifier; }
+
+        private:
+            /**< The terminator has no item and the smallest enqueue time */
+            static bool is_terminator(entry const * e) { return e->enqueued == time_point::min(); }
+
+            /**
+             * @brief Appends an entry and wakes the consumer
+             */
+            void link(entry * e, time_point enqueued)
+            {
+                e->next = nullptr;
+                e->enqueued = enqueued;
+
+                {
+                    std::lock_guard<std::mutex> lk{mutex};
+
+                    if (tail)
+                        tail->next = e;
+                    else
+                        head = e;
+
+                    tail = e;
+                    depth.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                /* no syscall unless the consumer is asleep */
+                notifier.notify();
+            }
+
+            /**
+             * @brief Removes the front entry, mutex must be held
+             * @param enqueued Set to the time the entry was pushed
+             * @return The front value, nullptr for the terminator
+             */
+            data_type pop_front(time_point & enqueued)
+            {
+                entry * e = head;
+
+                head = e->next;
+                if (!head)
+                    tail = nullptr;
+
+                depth.fetch_sub(1, std::memory_order_relaxed);
+
+                if (is_terminator(e)) {
+                    enqueued = std::chrono::steady_clock::now();
+                    pool.deallocate(e);
+                    return data_type{nullptr, deleter{pool}};
+                }
+
+                enqueued = e->enqueued;
+                return data_type{e->get(), deleter{pool}};
+            }
+        };
+
+} // end namespace management
+
+#endif // guard
@@ -0,0 +1,763 @@
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shm_subsystem.hh"
+
+/**
+ * @file shm_subsystem.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ */
+
+namespace management
+{
+    namespace
+    {
+        /**< Written last by the segment creator */
+        constexpr std::uint32_t segment_magic = 0x5ab5e55e;
+        /**< Ring index mask */
+        constexpr std::uint32_t ring_mask = sizes::default_shared_ring_capacity - 1;
+        /**< How often the pump refreshes proxies and looks for dead peers */
+        constexpr auto housekeeping_interval = std::chrono::milliseconds(50);
+
+        static_assert((sizes::default_shared_ring_capacity & ring_mask) == 0,
+                      "shared ring capacity must be a power of two");
+
+        /**
+         * @brief Process shared futex call on a word inside the segment
+         */
+        long futex(std::atomic<std::uint32_t> & word, int op, std::uint32_t value,
+                   struct timespec const * timeout)
+        {
+            return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word),
+                             op, value, timeout, nullptr, 0);
+        }
+
+        /**
+         * @brief Enters the seqlock write side of a slot
+         * @details Writers inside one process serialize on the odd version
+         * @return The odd version to hand to write_unlock
+         */
+        std::uint32_t write_lock(shm::Slot & s)
+        {
+            std::uint32_t version = s.version.load(std::memory_order_relaxed);
+
+            do {
+                version &= ~1u;
+            } while (!s.version.compare_exchange_weak(version, version + 1, std::memory_order_acquire));
+
+            return version + 1;
+        }
+
+        /**
+         * @brief Leaves the seqlock write side of a slot
+         */
+        void write_unlock(shm::Slot & s, std::uint32_t version)
+        {
+            s.version.store(version + 1, std::memory_order_release);
+        }
+    }
+
+    namespace shm
+    {
+        SharedSubsystemLink::SharedSubsystemLink(SharedSubsystemMap & owner, SlotIndex slot,
+                                                 std::uint32_t generation) :
+            detail::SubsystemLink(owner.m_local.memory_resource()),
+            m_owner(owner),
+            m_slot(slot),
+            m_generation(generation)
+        {
+            m_tag = SubsystemMap::generate_subsystem_tag();
+        }
+
+        void SharedSubsystemLink::add_child(SubsystemLink & child)
+        {
+            /* the remote parent must be able to address the child */
+            SlotIndex child_slot = m_owner.slot_of(child);
+
+            {
+                std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+                m_children.insert(child.get_tag());
+            }
+
+            m_owner.push(m_slot, WireMessage{WireMessage::LINK_CHILD, 0, SubsystemState::INIT, child_slot});
+        }
+
+        void SharedSubsystemLink::add_parent(SubsystemLink & parent)
+        {
+            std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+            m_parents.insert(parent.get_tag());
+        }
+
+        void SharedSubsystemLink::remove_child(SubsystemTag tag)
+        {
+            SlotIndex child_slot;
+
+            {
+                std::lock_guard<decltype(m_owner.m_lock)> lk{m_owner.m_lock};
+                auto it = m_owner.m_tags.find(tag);
+                if (it == m_owner.m_tags.end())
+                    return;
+                child_slot = it->second;
+            }
+
+            {
+                std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+                m_children.erase(tag);
+            }
+
+            m_owner.push(m_slot, WireMessage{WireMessage::UNLINK_CHILD, 0, SubsystemState::INIT, child_slot});
+        }
+
+        void SharedSubsystemLink::remove_parent(SubsystemTag tag)
+        {
+            std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+            m_parents.erase(tag);
+        }
+
+        void SharedSubsystemLink::put_message(SubsystemIPC msg)
+        {
+            if (m_crashed)
+                return;
+
+            SlotIndex sender = m_slot;
+
+            /* messages directed at the proxy itself carry its own tag */
+            if (msg.tag != m_tag)
+            {
+                detail::SubsystemLink * local = m_owner.m_local.find(msg.tag);
+                if (!local)
+                    return;
+
+                sender = m_owner.slot_of(*local);
+                /* keep the table in step with what the peers are told */
+                m_owner.publish_state(sender, msg.state);
+            }
+
+            m_owner.push(m_slot, WireMessage{WireMessage::IPC, static_cast<std::uint8_t>(msg.from),
+                                              msg.state, sender});
+        }
+
+        void SharedSubsystemLink::get_edges(detail::SubsystemEdgeSet & parents, detail::SubsystemEdgeSet & children)
+        {
+            std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+            parents = m_parents;
+            children = m_children;
+        }
+
+    } /* end namespace shm */
+
+    SharedSubsystemMap::SharedSubsystemMap(std::string const & segment_name, SubsystemMap & local,
+                                           std::uint32_t capacity) :
+        m_segment_name(segment_name),
+        m_local(local),
+        m_pid(static_cast<std::int32_t>(::getpid())),
+        m_skipped(0),
+        m_dropped(0),
+        m_running(true)
+    {
+        bool creator = true;
+        int fd = ::shm_open(m_segment_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+        if (fd < 0 && errno == EEXIST) {
+            creator = false;
+            fd = ::shm_open(m_segment_name.c_str(), O_RDWR, 0600);
+        }
+
+        if (fd < 0) {
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+            throw std::runtime_error("shm_open failed for " + m_segment_name);
+#else
+            return;
+#endif
+        }
+
+        if (creator) {
+            m_mapped_size = shm::slots_offset() + capacity * sizeof(shm::Slot);
+
+            if (::ftruncate(fd, static_cast<off_t>(m_mapped_size)) != 0) {
+                ::close(fd);
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+                throw std::runtime_error("ftruncate failed for " + m_segment_name);
+#else
+                return;
+#endif
+            }
+        }
+        else {
+            /* the creator sizes the segment right after creating it */
+            struct stat st{};
+
+            while (::fstat(fd, &st) == 0 && st.st_size == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            m_mapped_size = static_cast<std::size_t>(st.st_size);
+        }
+
+        void * base = ::mmap(nullptr, m_mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (base == MAP_FAILED) {
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+            throw std::runtime_error("mmap failed for " + m_segment_name);
+#else
+            return;
+#endif
+        }
+
+        if (creator) {
+            m_header = new (base) shm::SegmentHeader{};
+            m_header->capacity = capacity;
+
+            for (shm::SlotIndex i = 0; i < capacity; ++i)
+            {
+                shm::Slot * s = new (static_cast<char *>(base) + shm::slots_offset() + i * sizeof(shm::Slot)) shm::Slot{};
+                s->state.store(static_cast<std::uint8_t>(SubsystemState::INIT), std::memory_order_relaxed);
+
+                for (std::uint32_t c = 0; c < sizes::default_shared_ring_capacity; ++c) {
+                    s->cells[c].sequence.store(c, std::memory_order_relaxed);
+                    /* the lap before the first, so position c starts out unsigned */
+                    s->cells[c].claim.store(shm::claim_word(c - sizes::default_shared_ring_capacity, 0),
+                                            std::memory_order_relaxed);
+                }
+            }
+
+            m_header->magic.store(segment_magic, std::memory_order_release);
+        }
+        else {
+            m_header = static_cast<shm::SegmentHeader *>(base);
+
+            while (m_header->magic.load(std::memory_order_acquire) != segment_magic)
+                std::this_thread::yield();
+        }
+
+        m_pump = std::thread{[this] () { pump(); }};
+    }
+
+    SharedSubsystemMap::~SharedSubsystemMap()
+    {
+        if (!m_header)
+            return;
+
+        m_running = false;
+        m_header->doorbell.fetch_add(1);
+        futex(m_header->doorbell, FUTEX_WAKE, INT_MAX, nullptr);
+
+        if (m_pump.joinable())
+            m_pump.join();
+
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+            for (auto & pair : m_slots)
+            {
+                if (pair.second.proxy)
+                    m_local.remove(pair.second.proxy->get_tag());
+                else
+                    release_slot(pair.first);
+            }
+
+            m_slots.clear();
+            m_tags.clear();
+        }
+
+        ::munmap(m_header, m_mapped_size);
+    }
+
+    void SharedSubsystemMap::unlink(std::string const & segment_name)
+    {
+        (void)::shm_unlink(segment_name.c_str());
+    }
+
+    void SharedSubsystemMap::export_subsystem(detail::SubsystemLink & link)
+    {
+        (void)slot_of(link);
+    }
+
+    detail::SubsystemLink * SharedSubsystemMap::import_subsystem(std::string const & name)
+    {
+        if (!m_header)
+            return nullptr;
+
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+        for (shm::SlotIndex i = 0; i < m_header->capacity; ++i)
+        {
+            std::int32_t owner;
+            std::uint32_t generation;
+            SubsystemState state;
+            char slot_name[sizes::max_shared_name_length];
+
+            if (!read_slot(i, owner, generation, state, slot_name) || !owner_alive(owner))
+                continue;
+
+            if (name.compare(0, sizes::max_shared_name_length - 1, slot_name) != 0)
+                continue;
+
+            auto it = m_slots.find(i);
+            if (it != m_slots.end())
+                return it->second.proxy ? it->second.proxy.get() : m_local.find(it->second.tag);
+
+            return proxy_locked(i);
+        }
+
+        return nullptr;
+    }
+
+    shm::Slot & SharedSubsystemMap::slot(shm::SlotIndex index) const
+    {
+        return *reinterpret_cast<shm::Slot *>(reinterpret_cast<char *>(m_header) + shm::slots_offset()
+                                              + index * sizeof(shm::Slot));
+    }
+
+    shm::SlotIndex SharedSubsystemMap::claim_slot(std::string const & name)
+    {
+        for (shm::SlotIndex i = 0; i < m_header->capacity; ++i)
+        {
+            shm::Slot & s = slot(i);
+            std::int32_t owner = s.owner.load();
+
+            if (owner != 0 && owner_alive(owner))
+                continue;
+
+            if (!s.owner.compare_exchange_strong(owner, m_pid))
+                continue;
+
+            /* a dead writer may have left the seqlock odd */
+            std::uint32_t version = s.version.load() | 1u;
+            s.version.store(version);
+
+            s.generation.fetch_add(1, std::memory_order_relaxed);
+            s.state.store(static_cast<std::uint8_t>(SubsystemState::INIT), std::memory_order_relaxed);
+            std::strncpy(s.name, name.c_str(), sizeof(s.name) - 1);
+            s.name[sizeof(s.name) - 1] = '\0';
+
+            s.version.store(version + 1, std::memory_order_release);
+
+            /* throw away whatever a previous owner left unconsumed */
+            shm::WireMessage trash;
+            while (pop(i, trash)) { }
+
+            return i;
+        }
+
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+        throw std::runtime_error("No free slot in shared segment " + m_segment_name);
+#else
+        return m_header->capacity;
+#endif
+    }
+
+    void SharedSubsystemMap::release_slot(shm::SlotIndex index)
+    {
+        shm::Slot & s = slot(index);
+        std::uint32_t version = write_lock(s);
+
+        s.state.store(static_cast<std::uint8_t>(SubsystemState::DESTROY), std::memory_order_relaxed);
+        s.name[0] = '\0';
+        s.owner.store(0, std::memory_order_relaxed);
+
+        write_unlock(s, version);
+    }
+
+    void SharedSubsystemMap::publish_state(shm::SlotIndex index, SubsystemState state)
+    {
+        shm::Slot & s = slot(index);
+        std::uint32_t version = write_lock(s);
+
+        s.state.store(static_cast<std::uint8_t>(state), std::memory_order_relaxed);
+
+        write_unlock(s, version);
+    }
+
+    bool SharedSubsystemMap::read_slot(shm::SlotIndex index, std::int32_t & owner, std::uint32_t & generation,
+                                       SubsystemState & state, char (&name)[sizes::max_shared_name_length]) const
+    {
+        shm::Slot & s = slot(index);
+
+        for (;;)
+        {
+            std::uint32_t before = s.version.load(std::memory_order_acquire);
+            owner = s.owner.load(std::memory_order_relaxed);
+
+            if (before & 1u)
+            {
+                /* a writer that died mid-update never finishes */
+                if (owner != 0 && !owner_alive(owner))
+                    return false;
+
+                std::this_thread::yield();
+                continue;
+            }
+
+            generation = s.generation.load(std::memory_order_relaxed);
+            state = static_cast<SubsystemState>(s.state.load(std::memory_order_relaxed));
+            std::memcpy(name, s.name, sizeof(name));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (s.version.load(std::memory_order_relaxed) == before)
+            {
+                name[sizeof(name) - 1] = '\0';
+                return owner != 0;
+            }
+        }
+    }
+
+    bool SharedSubsystemMap::owner_alive(std::int32_t owner) const
+    {
+        return owner == m_pid || ::kill(owner, 0) == 0 || errno != ESRCH;
+    }
+
+    bool SharedSubsystemMap::push(shm::SlotIndex index, shm::WireMessage const & message)
+    {
+        shm::Slot & s = slot(index);
+        std::uint32_t pos = s.head.load(std::memory_order_relaxed);
+        std::uint32_t retries = 0;
+
+        for (;;)
+        {
+            shm::RingCell & cell = s.cells[pos & ring_mask];
+            std::uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::int32_t diff = static_cast<std::int32_t>(sequence - pos);
+
+            if (diff == 0)
+            {
+                if (s.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    /* sign the cell before touching the message. A claim for
+                     * this position or a later one means the owner skipped us
+                     * as stuck and the cell may belong to another producer. */
+                    std::uint64_t claim = cell.claim.load(std::memory_order_relaxed);
+
+                    if (static_cast<std::int32_t>(shm::claim_pos(claim) - pos) >= 0 ||
+                        !cell.claim.compare_exchange_strong(claim, shm::claim_word(pos, m_pid),
+                                                            std::memory_order_acquire, std::memory_order_relaxed)) {
+                        m_dropped.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+
+                    cell.message = message;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                /* full, wait for the owner unless it is gone */
+                std::int32_t owner = s.owner.load(std::memory_order_relaxed);
+                if (owner == 0 || !owner_alive(owner))
+                    return false;
+
+                /* a live owner that does not drain must not hold our worker */
+                if (++retries > sizes::shared_push_retries) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                std::this_thread::yield();
+                pos = s.head.load(std::memory_order_relaxed);
+            }
+            else
+            {
+                pos = s.head.load(std::memory_order_relaxed);
+            }
+        }
+
+        m_header->doorbell.fetch_add(1);
+
+        if (m_header->sleepers.load())
+            futex(m_header->doorbell, FUTEX_WAKE, INT_MAX, nullptr);
+
+        return true;
+    }
+
+    bool SharedSubsystemMap::pop(shm::SlotIndex index, shm::WireMessage & message)
+    {
+        shm::Slot & s = slot(index);
+
+        for (;;)
+        {
+            std::uint32_t pos = s.tail.load(std::memory_order_relaxed);
+            shm::RingCell & cell = s.cells[pos & ring_mask];
+            std::uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+            if (sequence == pos + 1)
+            {
+                message = cell.message;
+                cell.sequence.store(pos + sizes::default_shared_ring_capacity, std::memory_order_release);
+                s.tail.store(pos + 1, std::memory_order_relaxed);
+                return true;
+            }
+
+            /* empty, or claimed and still being written */
+            if (sequence != pos || static_cast<std::int32_t>(s.head.load(std::memory_order_acquire) - pos) <= 0)
+                return false;
+
+            std::uint64_t claim = cell.claim.load(std::memory_order_acquire);
+
+            if (!abandoned(index, pos, claim))
+                return false;
+
+            /* the producer died between claiming the cell and publishing it,
+             * take the claim so it can never write the cell afterwards */
+            if (!cell.claim.compare_exchange_strong(claim, shm::claim_word(pos, shm::skipped_claimer),
+                                                    std::memory_order_acq_rel))
+                continue;
+
+            cell.sequence.store(pos + sizes::default_shared_ring_capacity, std::memory_order_release);
+            s.tail.store(pos + 1, std::memory_order_relaxed);
+            m_skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool SharedSubsystemMap::abandoned(shm::SlotIndex index, std::uint32_t pos, std::uint64_t claim)
+    {
+        if (shm::claim_pos(claim) == pos)
+            return !owner_alive(shm::claim_pid(claim));
+
+        /* claimed but not signed yet: normally a matter of instructions, give
+         * up on it only once it stays that way for long */
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<decltype(m_stuck_lock)> lk{m_stuck_lock};
+        auto & seen = m_stuck[index];
+
+        if (seen.first != pos || seen.second == std::chrono::steady_clock::time_point{}) {
+            seen = std::make_pair(pos, now);
+            return false;
+        }
+
+        return now - seen.second >= sizes::shared_stuck_cell_timeout;
+    }
+
+    shm::SlotIndex SharedSubsystemMap::export_locked(detail::SubsystemLink & link)
+    {
+        auto it = m_tags.find(link.get_tag());
+        if (it != m_tags.end())
+            return it->second;
+
+        shm::SlotIndex index = claim_slot(link.get_name());
+        if (index >= m_header->capacity)
+            return index;
+
+        m_slots[index] = Entry{link.get_tag(), nullptr};
+        m_tags[link.get_tag()] = index;
+        publish_state(index, link.get_state());
+
+        return index;
+    }
+
+    shm::SharedSubsystemLink * SharedSubsystemMap::proxy_locked(shm::SlotIndex index)
+    {
+        auto it = m_slots.find(index);
+        if (it != m_slots.end())
+            return it->second.proxy.get();
+
+        std::int32_t owner;
+        std::uint32_t generation;
+        SubsystemState state;
+        char name[sizes::max_shared_name_length];
+
+        if (!read_slot(index, owner, generation, state, name))
+            return nullptr;
+
+        std::unique_ptr<shm::SharedSubsystemLink> proxy{new shm::SharedSubsystemLink{*this, index, generation}};
+        proxy->set_name(m_local, name);
+        proxy->m_state = state;
+
+        shm::SharedSubsystemLink * ret = proxy.get();
+        m_tags[ret->get_tag()] = index;
+        m_slots[index] = Entry{ret->get_tag(), std::move(proxy)};
+        m_local.put(ret->get_tag(), std::ref<detail::SubsystemLink>(*ret));
+
+        return ret;
+    }
+
+    shm::SlotIndex SharedSubsystemMap::slot_of(detail::SubsystemLink & link)
+    {
+        if (!m_header)
+            return 0;
+
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        return export_locked(link);
+    }
+
+    bool SharedSubsystemMap::drain()
+    {
+        std::vector<shm::SlotIndex> exported;
+
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+            for (auto & pair : m_slots)
+                if (!pair.second.proxy)
+                    exported.push_back(pair.first);
+        }
+
+        bool any = false;
+        shm::WireMessage message;
+
+        for (auto index : exported)
+        {
+            while (pop(index, message)) {
+                deliver(index, message);
+                any = true;
+            }
+        }
+
+        return any;
+    }
+
+    void SharedSubsystemMap::deliver(shm::SlotIndex target, shm::WireMessage const & message)
+    {
+        SubsystemTag tag = 0;
+        shm::SharedSubsystemLink * sender = nullptr;
+
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+            auto it = m_slots.find(target);
+            if (it == m_slots.end() || it->second.proxy)
+                return;
+
+            tag = it->second.tag;
+            sender = (message.sender == target) ? nullptr : proxy_locked(message.sender);
+
+            if (sender && message.kind == shm::WireMessage::IPC)
+                sender->m_state = message.state;
+        }
+
+        /* the exported subsystem may have been destroyed since */
+        detail::SubsystemLink * local = m_local.find(tag);
+        if (!local)
+            return;
+
+        switch(message.kind)
+        {
+        case shm::WireMessage::IPC:
+            {
+                SubsystemIPC msg { static_cast<decltype(SubsystemIPC::from)>(message.from),
+                                   sender ? sender->get_tag() : local->get_tag(), message.state };
+                local->put_message(msg);
+                break;
+            }
+        case shm::WireMessage::LINK_CHILD:
+            if (sender) {
+                sender->add_parent(*local);
+                local->add_child(*sender);
+            }
+            break;
+        case shm::WireMessage::UNLINK_CHILD:
+            if (sender) {
+                local->remove_child(sender->get_tag());
+                sender->remove_parent(local->get_tag());
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void SharedSubsystemMap::housekeeping()
+    {
+        std::vector<shm::SharedSubsystemLink *> crashed;
+
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+            for (auto it = m_slots.begin(); it != m_slots.end(); )
+            {
+                if (!it->second.proxy)
+                {
+                    /* exported subsystem went away without telling us */
+                    detail::SubsystemLink * local = m_local.find(it->second.tag);
+                    if (!local) {
+                        m_tags.erase(it->second.tag);
+                        release_slot(it->first);
+                        it = m_slots.erase(it);
+                        continue;
+                    }
+
+                    publish_state(it->first, local->get_state());
+                }
+                else if (!it->second.proxy->m_crashed)
+                {
+                    shm::SharedSubsystemLink & proxy = *it->second.proxy;
+                    std::int32_t owner;
+                    std::uint32_t generation;
+                    SubsystemState state;
+                    char name[sizes::max_shared_name_length];
+
+                    bool valid = read_slot(it->first, owner, generation, state, name);
+
+                    if (!valid || !owner_alive(owner) || generation != proxy.m_generation) {
+                        /* a released slot in DESTROY is an orderly exit */
+                        if (proxy.get_state() != SubsystemState::DESTROY) {
+                            proxy.m_crashed = true;
+                            proxy.m_state = SubsystemState::ERROR;
+                            crashed.push_back(&proxy);
+                        }
+                    }
+                    else {
+                        proxy.m_state = state;
+                    }
+                }
+
+                ++it;
+            }
+        }
+
+        /* tell local neighbours about the dead peer */
+        for (auto proxy : crashed)
+        {
+            detail::SubsystemEdgeSet parents, children;
+            proxy->get_edges(parents, children);
+
+            for (auto tag : children)
+                if (detail::SubsystemLink * child = m_local.find(tag))
+                    child->put_message({SubsystemIPC::PARENT, proxy->get_tag(), SubsystemState::ERROR});
+
+            for (auto tag : parents)
+                if (detail::SubsystemLink * parent = m_local.find(tag))
+                    parent->put_message({SubsystemIPC::CHILD, proxy->get_tag(), SubsystemState::ERROR});
+        }
+    }
+
+    void SharedSubsystemMap::pump()
+    {
+        auto next_housekeeping = std::chrono::steady_clock::now();
+
+        while (m_running)
+        {
+            std::uint32_t seen = m_header->doorbell.load(std::memory_order_acquire);
+
+            if (drain())
+                continue;
+
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_housekeeping) {
+                housekeeping();
+                next_housekeeping = now + housekeeping_interval;
+            }
+
+            struct timespec timeout{0, static_cast<long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(housekeeping_interval).count())};
+
+            m_header->sleepers.fetch_add(1);
+            if (m_running)
+                futex(m_header->doorbell, FUTEX_WAIT, seen, &timeout);
+            m_header->sleepers.fetch_sub(1);
+        }
+    }
+
+} // end namespace management
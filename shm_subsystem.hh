@@ -0,0 +1,324 @@
+#ifndef _SHM_SUBSYSTEM_HH_3735928559_
+#define _SHM_SUBSYSTEM_HH_3735928559_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "subsystem.hh"
+
+/**
+ * @file shm_subsystem.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Lets one subsystem graph span several processes. Every process maps the same
+ * POSIX shared memory segment which holds a fixed capacity state table. Each
+ * table slot carries a subsystem's published state and a lock-free ring that
+ * other processes push state-change messages into.
+ *
+ * Remote subsystems appear in the local SubsystemMap as proxy links, so a
+ * remote parent can be handed to a local child's SubsystemParentsList like
+ * any other subsystem.
+ */
+
+namespace sizes
+{
+    constexpr const std::size_t default_shared_ring_capacity = 64;
+    constexpr const std::size_t max_shared_name_length = 32;
+    /**< Yields a push waits for room in a live peer's full ring before it drops the message */
+    constexpr const std::uint32_t shared_push_retries = 4096;
+    /**< How long a claimed cell without a known producer may stay unpublished */
+    constexpr const std::chrono::milliseconds shared_stuck_cell_timeout{1000};
+}
+
+namespace management
+{
+    class SharedSubsystemMap;
+
+    namespace shm
+    {
+        /**< Index of a subsystem's slot in the shared state table */
+        using SlotIndex = std::uint32_t;
+
+        /**
+         * @brief A message as it travels through a shared ring.
+         * @details Subsystem tags are process local, the originator is therefore
+         *          identified by its slot and translated back to a tag on receipt.
+         */
+        struct WireMessage
+        {
+            enum Kind : std::uint8_t { IPC, LINK_CHILD, UNLINK_CHILD } kind; /**< payload type */
+            std::uint8_t from; /**< SubsystemIPC::from, valid for IPC */
+            SubsystemState state; /**< SubsystemIPC::state, valid for IPC */
+            SlotIndex sender; /**< Slot of the originator */
+        };
+
+        /**
+         * @brief Single ring cell, see Vyukov's bounded MPMC queue
+         */
+        struct RingCell
+        {
+            std::atomic<std::uint32_t> sequence;
+            /**< Ring position and process of the last claim, see claim_word.
+             * The producer signs the cell with a CAS before writing the
+             * message and the owner takes it with a CAS before skipping it,
+             * so only one of them ever owns a position. */
+            std::atomic<std::uint64_t> claim;
+            WireMessage message;
+        };
+
+        /**< Process recorded in the claim of a cell the owner skipped */
+        constexpr const std::int32_t skipped_claimer = -1;
+
+        /**
+         * @return The claim of ring position pos by process pid
+         */
+        constexpr std::uint64_t claim_word(std::uint32_t pos, std::int32_t pid)
+        {
+            return (static_cast<std::uint64_t>(pos) << 32) | static_cast<std::uint32_t>(pid);
+        }
+
+        /**
+         * @return The ring position a claim is for
+         */
+        constexpr std::uint32_t claim_pos(std::uint64_t claim)
+        {
+            return static_cast<std::uint32_t>(claim >> 32);
+        }
+
+        /**
+         * @return The process a claim was made by
+         */
+        constexpr std::int32_t claim_pid(std::uint64_t claim)
+        {
+            return static_cast<std::int32_t>(static_cast<std::uint32_t>(claim));
+        }
+
+        /**
+         * @brief One entry of the shared state table
+         * @details The descriptive fields are guarded by a seqlock (version is odd
+         *          while a writer is active), so a reader never blocks on a peer.
+         *          A peer that dies mid-write leaves an odd version behind, which
+         *          readers resolve by checking whether the owner is still alive.
+         */
+        struct Slot
+        {
+            /**< Seqlock version */
+            std::atomic<std::uint32_t> version;
+            /**< Bumped every time the slot is claimed */
+            std::atomic<std::uint32_t> generation;
+            /**< Owning process id, 0 when free */
+            std::atomic<std::int32_t> owner;
+            /**< Published SubsystemState */
+            std::atomic<std::uint8_t> state;
+            /**< Subsystem name, NUL terminated */
+            char name[sizes::max_shared_name_length];
+
+            /**< Ring producer position */
+            alignas(64) std::atomic<std::uint32_t> head;
+            /**< Ring consumer position, only touched by the owner */
+            alignas(64) std::atomic<std::uint32_t> tail;
+            /**< Ring storage */
+            RingCell cells[sizes::default_shared_ring_capacity];
+        };
+
+        /**
+         * @brief Segment header, followed by the slot table
+         */
+        struct SegmentHeader
+        {
+            /**< Set last by the creator once the table is usable */
+            std::atomic<std::uint32_t> magic;
+            /**< Number of slots */
+            std::uint32_t capacity;
+            /**< Futex word bumped on every push */
+            std::atomic<std::uint32_t> doorbell;
+            /**< Number of pumps sleeping on the doorbell */
+            std::atomic<std::uint32_t> sleepers;
+        };
+
+        /**
+         * @return Offset of the first slot inside the segment
+         */
+        constexpr std::size_t slots_offset()
+        {
+            return ((sizeof(SegmentHeader) + alignof(Slot) - 1) / alignof(Slot)) * alignof(Slot);
+        }
+
+        /**
+         * @brief Local stand-in for a subsystem owned by another process
+         * @details Edge changes and state messages are pushed into the remote
+         *          slot's ring. The state is refreshed by the owning SharedSubsystemMap.
+         */
+        class SharedSubsystemLink final : public detail::SubsystemLink
+        {
+        private:
+            /**< Map that created this proxy */
+            SharedSubsystemMap & m_owner;
+            /**< Guards m_parents and m_children */
+            std::mutex m_edge_lock;
+
+        public:
+            /**< Remote slot */
+            SlotIndex const m_slot;
+            /**< Slot generation at import time */
+            std::uint32_t const m_generation;
+            /**< Set by the pump once the remote owner was found dead */
+            std::atomic_bool m_crashed{false};
+
+            SharedSubsystemLink(SharedSubsystemMap & owner, SlotIndex slot, std::uint32_t generation);
+
+            void add_child(SubsystemLink & child) override;
+            void add_parent(SubsystemLink & parent) override;
+            void remove_child(SubsystemTag tag) override;
+            void remove_parent(SubsystemTag tag) override;
+            void put_message(SubsystemIPC msg) override;
+
+            /**
+             * @brief Copies the current edges
+             */
+            void get_edges(detail::SubsystemEdgeSet & parents, detail::SubsystemEdgeSet & children);
+        };
+
+    } /* end namespace shm */
+
+    /**
+     * @brief Bridges a local SubsystemMap with a shared memory segment
+     * @details Subsystems are made visible to other processes with export_subsystem()
+     *          and remote ones are pulled in with import_subsystem(). A pump thread
+     *          drains the rings of exported subsystems and forwards each message to
+     *          the local subsystem, so a remote parent's commit_state reaches local
+     *          children without sockets or serialization.
+     *
+     *          Every process attached to the same segment name shares one graph.
+     *          The SharedSubsystemMap must outlive the subsystems linked through it.
+     */
+    class SharedSubsystemMap final
+    {
+    private:
+        friend class shm::SharedSubsystemLink;
+
+        /**< What this process knows about a slot */
+        struct Entry
+        {
+            /**< Local tag of the exported subsystem or of the proxy. An exported
+             * subsystem is only ever looked up through m_local by this tag, it
+             * may be gone already */
+            SubsystemTag tag;
+            /**< Owning pointer if the entry is a proxy */
+            std::unique_ptr<shm::SharedSubsystemLink> proxy;
+        };
+
+        /**< Segment name given to shm_open */
+        std::string m_segment_name;
+        /**< The process local map proxies are registered with */
+        SubsystemMap & m_local;
+        /**< Mapped segment */
+        shm::SegmentHeader * m_header = nullptr;
+        /**< Mapped size */
+        std::size_t m_mapped_size = 0;
+        /**< Cached getpid() */
+        std::int32_t m_pid;
+
+        /**< Guards the lookup tables below */
+        mutable std::mutex m_lock;
+        /**< slot -> entry */
+        std::unordered_map<shm::SlotIndex, Entry> m_slots;
+        /**< local tag -> slot, for both exported subsystems and proxies */
+        std::unordered_map<SubsystemTag, shm::SlotIndex> m_tags;
+
+        /**< First sighting of an unsigned, unpublished cell per slot, pump only */
+        std::mutex m_stuck_lock;
+        std::unordered_map<shm::SlotIndex, std::pair<std::uint32_t, std::chrono::steady_clock::time_point>> m_stuck;
+        /**< Cells skipped because their producer died before publishing */
+        std::atomic<std::uint64_t> m_skipped;
+        /**< Messages dropped because a live peer's ring stayed full */
+        std::atomic<std::uint64_t> m_dropped;
+
+        /**< Pump shutdown flag */
+        std::atomic_bool m_running;
+        /**< Pump thread */
+        std::thread m_pump;
+
+    public:
+        /**
+         * @brief Attaches to (creating if needed) a shared segment
+         * @param segment_name POSIX shm name, e.g. "/my_graph"
+         * @param local The process local map
+         * @param capacity Number of slots, only used by the creating process
+         */
+        SharedSubsystemMap(std::string const & segment_name, SubsystemMap & local,
+                           std::uint32_t capacity = sizes::default_max_subsystem_count);
+
+        SharedSubsystemMap(SharedSubsystemMap const &) = delete;
+
+        /**
+         * @brief Destructor, releases exported slots and unmaps the segment
+         */
+        ~SharedSubsystemMap();
+
+        /**
+         * @brief Publishes a local subsystem under its name
+         * @details Exporting the same subsystem twice is a no-op.
+         * @param link The local subsystem
+         */
+        void export_subsystem(detail::SubsystemLink & link);
+
+        /**
+         * @brief Looks up a subsystem published by any attached process
+         * @details The returned link is registered with the local map and can be
+         *          used as a parent of local subsystems.
+         * @param name The published name
+         * @return The link or nullptr if nothing is published under name
+         */
+        detail::SubsystemLink * import_subsystem(std::string const & name);
+
+        /**
+         * @return Ring cells skipped because the process that claimed them died
+         *         before publishing; the message in them is lost
+         */
+        std::uint64_t skipped_cells() const { return m_skipped.load(std::memory_order_relaxed); }
+
+        /**
+         * @return Messages this process dropped, because a live peer's ring
+         *         stayed full for sizes::shared_push_retries yields
+         */
+        std::uint64_t dropped_messages() const { return m_dropped.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Removes the segment name from the system
+         * @param segment_name POSIX shm name
+         */
+        static void unlink(std::string const & segment_name);
+
+    private:
+        shm::Slot & slot(shm::SlotIndex index) const;
+        shm::SlotIndex claim_slot(std::string const & name);
+        void release_slot(shm::SlotIndex index);
+        void publish_state(shm::SlotIndex index, SubsystemState state);
+        bool read_slot(shm::SlotIndex index, std::int32_t & owner, std::uint32_t & generation,
+                       SubsystemState & state, char (&name)[sizes::max_shared_name_length]) const;
+        bool owner_alive(std::int32_t owner) const;
+
+        bool push(shm::SlotIndex index, shm::WireMessage const & message);
+        bool pop(shm::SlotIndex index, shm::WireMessage & message);
+        bool abandoned(shm::SlotIndex index, std::uint32_t pos, std::uint64_t claim);
+
+        shm::SlotIndex export_locked(detail::SubsystemLink & link);
+        shm::SharedSubsystemLink * proxy_locked(shm::SlotIndex index);
+        shm::SlotIndex slot_of(detail::SubsystemLink & link);
+
+        bool drain();
+        void deliver(shm::SlotIndex target, shm::WireMessage const & message);
+        void housekeeping();
+        void pump();
+    };
+
+} /* end namespace management */
+
+#endif // guard
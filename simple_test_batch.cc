@@ -0,0 +1,51 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* A batch publishes only on an explicit commit(). A subsystem declared after
+ * the batch is destroyed first, so a batch that goes away uncommitted must
+ * not register it with the map or its live parent.
+ */
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+int main(void)
+{
+    SubsystemMap map{};
+    ThreadedSubsystem<> root{"root", map, {}};
+
+    SubsystemTag discarded = 0;
+
+    {
+        SubsystemBatch batch{map};
+        ThreadedSubsystem<> leaf{"discarded", batch, SubsystemParentsList{root}};
+        discarded = leaf.get_tag();
+    }
+
+    bool ok = !map.contains(discarded) && root.m_children.empty();
+
+    SubsystemBatch batch{map};
+    ThreadedSubsystem<> leaf{"leaf", batch, SubsystemParentsList{root}};
+    ok = ok && !map.contains(leaf.get_tag());
+
+    batch.commit();
+    ok = ok && map.contains(leaf.get_tag()) && root.m_children.count(leaf.get_tag()) == 1;
+
+    root.start();
+    for (int i = 0; i < 500 && leaf.get_state() != SubsystemState::RUNNING; ++i)
+        simulate_work(10);
+
+    ok = ok && leaf.get_state() == SubsystemState::RUNNING;
+
+    root.destroy();
+    for (int i = 0; i < 500 && leaf.get_state() != SubsystemState::DESTROY; ++i)
+        simulate_work(10);
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* A child started before its parent waits in commit_state until its deadline
+ * runs out, then proceeds, gives the transition up or fails, by policy. The
+ * worker is free again afterwards and the miss shows in the metrics. An
+ * abandoned transition never ran its hook.
+ */
+
+struct Child : ThreadedSubsystem<>
+{
+    std::atomic_int starts{0};
+    std::atomic_int errors{0};
+
+    Child(char const * name, SubsystemMap & m, SubsystemParentsList parents, ThreadedSubsystemOptions options) :
+        ThreadedSubsystem(name, m, parents, options)
+    { }
+
+    void on_start() override { ++starts; }
+    void on_error() override { ++errors; }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+template<typename Ready>
+static bool eventually(Ready && ready)
+{
+    for (int i = 0; i < 400 && !ready(); ++i)
+        simulate_work(5);
+    return ready();
+}
+
+static std::uint64_t misses(SubsystemMap const & m, SubsystemTag tag, SubsystemState to)
+{
+    for (auto const & snap : m.snapshot_metrics())
+        if (snap.tag == tag)
+            return snap.deadline_misses[static_cast<std::size_t>(to)];
+
+    return 0;
+}
+
+static bool run_policy(DeadlinePolicy policy, SubsystemState expected, int starts, int errors)
+{
+    SubsystemMap m{};
+    ThreadedSubsystemOptions options;
+    options.deadlines.set(SubsystemState::RUNNING, std::chrono::milliseconds{100}, policy);
+
+    ThreadedSubsystem<> parent{"parent", m};
+    Child child{"child", m, {parent}, options};
+
+    /* the parent stays in INIT */
+    auto start = std::chrono::steady_clock::now();
+    child.start();
+    bool ok = eventually([&] { return misses(m, child.get_tag(), SubsystemState::RUNNING) == 1; });
+    ok = ok && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds{100};
+
+    simulate_work(20);
+    ok = ok && child.get_state() == expected && child.starts == starts && child.errors == errors;
+
+    /* not held hostage: the next transition is handled */
+    if (policy == DeadlinePolicy::ABANDON) {
+        parent.start();
+        ok = ok && eventually([&] { return child.get_state() == SubsystemState::RUNNING; }) &&
+             child.starts == 1;
+    }
+
+    parent.destroy();
+    simulate_work(100);
+    return ok && misses(m, child.get_tag(), SubsystemState::RUNNING) == 1;
+}
+
+int main(void)
+{
+    bool ok = run_policy(DeadlinePolicy::PROCEED, SubsystemState::RUNNING, 1, 0);
+    ok = run_policy(DeadlinePolicy::ABANDON, SubsystemState::INIT, 0, 0) && ok;
+    ok = run_policy(DeadlinePolicy::FAIL, SubsystemState::ERROR, 0, 1) && ok;
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
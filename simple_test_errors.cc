@@ -0,0 +1,57 @@
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* A hook that throws is counted, not fatal: the worker stays up and handles
+ * the next message. A malformed state is dropped and counted too.
+ */
+
+struct Throwing : ThreadedSubsystem<>
+{
+    Throwing(char const * name, SubsystemMap & m) :
+        ThreadedSubsystem(name, m, {})
+    { }
+
+    void on_start() override { throw std::runtime_error("on_start"); }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+static std::uint64_t errors(SubsystemMap const & m, SubsystemTag tag, SubsystemError error)
+{
+    for (auto const & snap : m.snapshot_metrics())
+        if (snap.tag == tag)
+            return snap.errors[static_cast<std::size_t>(error)];
+
+    return 0;
+}
+
+int main(void)
+{
+    SubsystemMap m{};
+    Throwing t{"throwing", m};
+    detail::SubsystemLink & link = t;
+
+    t.start();
+    link.put_message({SubsystemIPC::PARENT, 0, static_cast<SubsystemState>(42)});
+    t.stop();
+
+    for (int i = 0; i < 200 && t.get_state() != SubsystemState::STOPPED; ++i)
+        simulate_work(5);
+
+    bool ok = t.get_state() == SubsystemState::STOPPED &&
+              errors(m, t.get_tag(), SubsystemError::HOOK_THREW) == 1 &&
+              errors(m, t.get_tag(), SubsystemError::INVALID_STATE) == 1;
+
+    t.destroy();
+    simulate_work(100);
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
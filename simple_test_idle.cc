@@ -0,0 +1,103 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* Threads come and go with ThreadedSubsystemOptions: the parent only gets a
+ * thread on its first message and both give theirs back after 50ms idle.
+ * Afterwards a small graph shares one SubsystemThreadGroup thread.
+ */
+
+struct Counting : ThreadedSubsystem<>
+{
+    std::atomic_int starts{0};
+    std::atomic_int stops{0};
+    std::thread::id ran_on;
+
+    Counting(char const * name, SubsystemMap & m, SubsystemParentsList parents, ThreadedSubsystemOptions o) :
+        ThreadedSubsystem(name, m, parents, o)
+    { }
+
+    void on_start() override { ran_on = std::this_thread::get_id(); ++starts; }
+    void on_stop() override { ++stops; }
+};
+
+static int thread_count()
+{
+    std::FILE * f = std::fopen("/proc/self/status", "r");
+    char line[128];
+    int threads = -1;
+
+    while (f && std::fgets(line, sizeof(line), f))
+        if (std::sscanf(line, "Threads: %d", &threads) == 1)
+            break;
+
+    if (f)
+        std::fclose(f);
+    return threads;
+}
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+int main(void)
+{
+    SubsystemMap m{};
+    std::chrono::milliseconds idle{50};
+
+    Counting parent{"parent", m, {}, ThreadedSubsystemOptions{true, idle}};
+    Counting child{"child", m, {parent}, ThreadedSubsystemOptions{false, idle}};
+
+    int base = thread_count();
+
+    /* both idle: the lazy parent never had a thread, the child gave its own back */
+    simulate_work(200);
+    bool reclaimed = thread_count() == base - 1;
+
+    parent.start();
+    for (int i = 0; i < 200 && child.starts == 0; ++i)
+        simulate_work(5);
+
+    simulate_work(200);
+    bool idle_again = thread_count() == base - 1;
+
+    /* respawn on the next message */
+    parent.stop();
+    for (int i = 0; i < 200 && child.stops == 0; ++i)
+        simulate_work(5);
+
+    parent.destroy();
+    simulate_work(100);
+
+    bool ok = reclaimed && idle_again && parent.starts == 1 && child.starts == 1 &&
+              parent.stops == 1 && child.stops == 1;
+
+    {
+        SubsystemThreadGroup group{"group"};
+        ThreadedSubsystemOptions shared;
+        shared.group = &group;
+
+        int before = thread_count();
+
+        Counting a{"a", m, {}, shared};
+        Counting b{"b", m, {a}, shared};
+        Counting c{"c", m, {b}, shared};
+
+        a.start();
+        for (int i = 0; i < 200 && c.starts == 0; ++i)
+            simulate_work(5);
+
+        ok = ok && thread_count() == before && c.starts == 1 &&
+             a.ran_on == b.ran_on && b.ran_on == c.ran_on;
+
+        a.destroy();
+        simulate_work(100);
+    }
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <thread>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* The map, the edge sets and the ThreadsafeQueue bus allocate from the
+ * resource the map was given. A pool stops growing once the graph is built
+ * and messages flow, and an arena over a buffer large enough never reaches
+ * its upstream.
+ */
+
+/* Counts what passes through to new and delete */
+struct CountingResource final : MemoryResource
+{
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> bytes{0};
+
+protected:
+    void * do_allocate(std::size_t size, std::size_t) override
+    {
+        allocations.fetch_add(1);
+        bytes.fetch_add(size);
+        return ::operator new(size);
+    }
+
+    void do_deallocate(void * p, std::size_t, std::size_t) override { ::operator delete(p); }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+static bool await_state(detail::SubsystemLink const & link, SubsystemState state)
+{
+    for (int i = 0; i < 500 && link.get_state() != state; ++i)
+        simulate_work(1);
+    return link.get_state() == state;
+}
+
+/* Runs rounds of start/stop through parent, child follows */
+static bool run_rounds(Subsystem<> & parent, detail::SubsystemLink const & child, int rounds)
+{
+    for (int i = 0; i < rounds; ++i)
+    {
+        parent.start();
+        if (!await_state(child, SubsystemState::RUNNING))
+            return false;
+
+        parent.stop();
+        if (!await_state(child, SubsystemState::STOPPED))
+            return false;
+    }
+
+    return true;
+}
+
+static bool routed_to_resource()
+{
+    CountingResource counting;
+    SubsystemMap map{sizes::default_max_subsystem_count, &counting};
+
+    std::size_t before = counting.allocations;
+    ThreadedSubsystem<> parent{"parent", map, {}};
+    ThreadedSubsystem<> child{"child", map, {parent}};
+
+    bool ok = counting.allocations > before &&
+              child.m_parents.get_allocator().resource() == &counting &&
+              parent.m_children.get_allocator().resource() == &counting &&
+              parent.m_children.count(child.get_tag()) == 1;
+
+    /* bus nodes and items */
+    before = counting.allocations;
+    ok = ok && run_rounds(parent, child, 1) && counting.allocations > before;
+
+    ThreadsafeQueue<int> queue{&counting};
+    before = counting.allocations;
+    queue.push(1);
+    ok = ok && counting.allocations > before && *queue.try_pop() == 1;
+
+    parent.destroy();
+    return ok && await_state(child, SubsystemState::DESTROY);
+}
+
+static bool pool_stays_flat()
+{
+    CountingResource upstream;
+    /* small chunks, so growth shows at the granularity of a few blocks */
+    PoolResource pool{&upstream, 1024};
+    SubsystemMap map{sizes::default_max_subsystem_count, &pool};
+
+    std::size_t empty = pool.upstream_bytes();
+    ThreadedSubsystem<> parent{"parent", map, {}};
+    ThreadedSubsystem<> child{"child", map, {parent}};
+    std::size_t built = pool.upstream_bytes();
+    bool ok = built > empty;
+
+    /* the first rounds fill the free lists */
+    ok = ok && run_rounds(parent, child, 5);
+    std::size_t warm = pool.upstream_bytes();
+
+    ok = ok && run_rounds(parent, child, 100) && pool.upstream_bytes() == warm;
+
+    std::fprintf(stderr, "pool: %zu bytes empty, %zu built, %zu warm\n", empty, built, warm);
+
+    parent.destroy();
+    return ok && await_state(child, SubsystemState::DESTROY);
+}
+
+static bool arena_bounded()
+{
+    static char buffer[256 * 1024];
+    CountingResource overflow;
+    bool ok;
+
+    {
+        MonotonicResource arena{buffer, sizeof(buffer), &overflow};
+        PoolResource pool{&arena};
+        SubsystemMap map{sizes::default_max_subsystem_count, &pool};
+        ThreadedSubsystem<> parent{"parent", map, {}};
+        ThreadedSubsystem<> child{"child", map, {parent}};
+
+        ok = run_rounds(parent, child, 20);
+
+        parent.destroy();
+        ok = ok && await_state(child, SubsystemState::DESTROY);
+        ok = ok && arena.upstream_bytes() == 0;
+    }
+
+    return ok && overflow.allocations == 0;
+}
+
+int main(void)
+{
+    bool ok = routed_to_resource() && pool_stays_flat() && arena_bounded();
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "multilane_queue.hh"
+
+using namespace management;
+
+/* Producers give their lane back when they exit, workers that come and go
+ * keep finding a free lane. A queue destroyed before its producers exit is
+ * left alone by them.
+ */
+
+using Queue = MultiLaneQueue<int, std::integral_constant<std::size_t, 2>>;
+
+static bool respawned_producers()
+{
+    Queue q;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        std::thread([&q, i] { q.push(i); }).join();
+
+        if (q.lanes_in_use() != 0)
+            return false;
+
+        auto value = q.try_pop();
+        if (!value || *value != i)
+            return false;
+    }
+
+    return true;
+}
+
+static bool global_order()
+{
+    constexpr int producers = 4;
+    constexpr int per_producer = 1000;
+
+    Queue q;
+    q.set_global_order(true);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&q] {
+            for (int i = 0; i < per_producer; ++i)
+                q.push(i);
+        });
+
+    int received = 0;
+    while (received < producers * per_producer && q.wait_and_pop())
+        ++received;
+
+    for (auto & t : threads)
+        t.join();
+
+    return received == producers * per_producer;
+}
+
+static bool queue_gone_first()
+{
+    std::unique_ptr<Queue> q{new Queue};
+    std::atomic_bool pushed{false}, gone{false};
+
+    std::thread producer([&] {
+        q->push(1);
+        pushed = true;
+        while (!gone)
+            std::this_thread::yield();
+    });
+
+    while (!pushed)
+        std::this_thread::yield();
+
+    q.reset();
+    gone = true;
+    producer.join();
+
+    return true;
+}
+
+int main(void)
+{
+    bool ok = respawned_producers() && global_order() && queue_gone_first();
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
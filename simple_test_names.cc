@@ -0,0 +1,52 @@
+#include <cstdio>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* Subsystems created and removed over and over keep the name tables
+ * bounded: one entry per distinct name, and names for only the most
+ * recently removed tags.
+ */
+
+struct Named : detail::SubsystemLink
+{
+    Named(SubsystemMap & m, SubsystemTag tag)
+    {
+        m_tag = tag;
+        set_name(m, "Worker");
+    }
+
+    void add_child(SubsystemLink &) override { }
+    void add_parent(SubsystemLink &) override { }
+    void remove_child(SubsystemTag) override { }
+    void remove_parent(SubsystemTag) override { }
+    void put_message(SubsystemIPC) override { }
+};
+
+int main(void)
+{
+    SubsystemMap map{};
+    SubsystemNameId id = map.intern_name("Worker");
+    SubsystemTag first = 0, last = 0;
+
+    for (std::size_t i = 0; i < 2 * sizes::retired_tag_names; ++i)
+    {
+        Named link{map, SubsystemMap::generate_subsystem_tag()};
+
+        map.put(link.get_tag(), std::ref<detail::SubsystemLink>(link));
+        map.remove(link.get_tag());
+
+        if (!first)
+            first = link.get_tag();
+        last = link.get_tag();
+    }
+
+    bool ok = map.name_id_of(first) == 0 &&
+              map.name_id_of(last) == id &&
+              map.intern_name("Worker") == id &&
+              map.intern_name("Other") == id + 1;
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
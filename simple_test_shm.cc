@@ -0,0 +1,276 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shm_subsystem.hh"
+
+using namespace management;
+
+/* Parent lives in this process, the child in a forked one. Both attach to the
+ * same segment and the child's start/destroy cascade is driven purely through
+ * shared memory.
+ */
+
+//-- PARENT (owning process)
+struct RemoteParent : ThreadedSubsystem<>
+{
+    RemoteParent(SubsystemMap & m, char const * name = "RemoteParent") :
+        ThreadedSubsystem(name, m, {})
+    { }
+
+    void on_start() override { std::fprintf(stderr, "PARENT STARTED\n"); }
+    void on_destroy() override { std::fprintf(stderr, "PARENT DESTROYING\n"); }
+};
+
+//-- CHILD (forked process)
+struct LocalChild : ThreadedSubsystem<>
+{
+    std::atomic_bool started{false};
+    std::atomic_bool destroyed{false};
+
+    LocalChild(SubsystemMap & m, SubsystemParentsList parents) :
+        ThreadedSubsystem("LocalChild", m, parents)
+    { }
+
+    void on_start() override { std::fprintf(stderr, "CHILD STARTED\n"); started = true; }
+    void on_destroy() override { std::fprintf(stderr, "CHILD DESTROYING\n"); destroyed = true; }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+static int run_child(std::string const & segment)
+{
+    SubsystemMap map{};
+    SharedSubsystemMap shared{segment, map};
+
+    detail::SubsystemLink * parent = nullptr;
+
+    for (int i = 0; i < 500 && !parent; ++i) {
+        parent = shared.import_subsystem("RemoteParent");
+        simulate_work(10);
+    }
+
+    if (!parent)
+        return 2;
+
+    LocalChild child{map, SubsystemParentsList{*parent}};
+
+    for (int i = 0; i < 500 && !child.destroyed; ++i)
+        simulate_work(10);
+
+    return (child.started && child.destroyed) ? 0 : 1;
+}
+
+/* Claims a cell of the Sink ring by hand and stops short of publishing it,
+ * the state a producer killed mid push leaves behind.
+ */
+static int run_torn(std::string const & segment, int go, int ack)
+{
+    char byte = 0;
+    if (::read(go, &byte, 1) != 1)
+        return 2;
+
+    int fd = ::shm_open(segment.c_str(), O_RDWR, 0600);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0)
+        return 2;
+
+    void * base = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return 2;
+
+    auto header = static_cast<shm::SegmentHeader *>(base);
+
+    for (shm::SlotIndex i = 0; i < header->capacity; ++i)
+    {
+        auto & s = *reinterpret_cast<shm::Slot *>(static_cast<char *>(base) + shm::slots_offset() + i * sizeof(shm::Slot));
+        if (std::strcmp(s.name, "Sink") != 0)
+            continue;
+
+        std::uint32_t pos = s.head.fetch_add(1);
+        s.cells[pos % sizes::default_shared_ring_capacity].claim.store(
+            shm::claim_word(pos, static_cast<std::int32_t>(::getpid())));
+
+        if (::write(ack, &byte, 1) != 1)
+            return 2;
+
+        for (;;)
+            ::pause();
+    }
+
+    return 3;
+}
+
+static int run_producer(std::string const & segment, int go)
+{
+    char byte = 0;
+    if (::read(go, &byte, 1) != 1)
+        return 2;
+
+    SubsystemMap map{};
+    SharedSubsystemMap shared{segment, map};
+
+    detail::SubsystemLink * sink = shared.import_subsystem("Sink");
+    if (!sink)
+        return 2;
+
+    LocalChild child{map, SubsystemParentsList{*sink}};
+    child.start();
+
+    for (int i = 0; i < 500 && !child.destroyed; ++i)
+        simulate_work(10);
+
+    return (child.started && child.destroyed) ? 0 : 1;
+}
+
+/* A producer dies between claiming a ring cell and publishing it. The owner
+ * must skip the cell instead of stalling, so a later producer still gets
+ * through.
+ */
+static int killed_producer()
+{
+    std::string segment = "/subsystem_test_torn_" + std::to_string(::getpid());
+    SharedSubsystemMap::unlink(segment);
+
+    int torn_go[2], torn_ack[2], producer_go[2];
+    if (::pipe(torn_go) != 0 || ::pipe(torn_ack) != 0 || ::pipe(producer_go) != 0)
+        return 1;
+
+    /* fork before any thread exists */
+    pid_t torn = ::fork();
+    if (torn == 0)
+        ::_exit(run_torn(segment, torn_go[0], torn_ack[1]));
+
+    pid_t producer = ::fork();
+    if (producer == 0)
+        ::_exit(run_producer(segment, producer_go[0]));
+
+    int rc = 1;
+    char byte = 0;
+
+    {
+        SubsystemMap map{};
+        SharedSubsystemMap shared{segment, map};
+        RemoteParent sink{map, "Sink"};
+
+        shared.export_subsystem(sink);
+        sink.start();
+
+        if (::write(torn_go[1], &byte, 1) == 1 && ::read(torn_ack[0], &byte, 1) == 1)
+        {
+            ::kill(torn, SIGKILL);
+            ::waitpid(torn, nullptr, 0);
+
+            if (::write(producer_go[1], &byte, 1) == 1)
+                for (int i = 0; i < 500 && sink.m_children.empty(); ++i)
+                    simulate_work(10);
+
+            std::fprintf(stderr, "skipped %llu\n", static_cast<unsigned long long>(shared.skipped_cells()));
+            rc = (!sink.m_children.empty() && shared.skipped_cells() == 1) ? 0 : 1;
+        }
+        else
+        {
+            ::kill(torn, SIGKILL);
+            ::waitpid(torn, nullptr, 0);
+        }
+
+        sink.destroy();
+
+        if (rc == 0) {
+            int status = 0;
+            ::waitpid(producer, &status, 0);
+            rc = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+        else {
+            ::kill(producer, SIGKILL);
+            ::waitpid(producer, nullptr, 0);
+        }
+    }
+
+    SharedSubsystemMap::unlink(segment);
+    return rc;
+}
+
+/* An exported subsystem destroyed while the map lives on. Housekeeping must
+ * release its slot without touching the dead subsystem.
+ */
+static int destroyed_export()
+{
+    std::string segment = "/subsystem_test_gone_" + std::to_string(::getpid());
+    SharedSubsystemMap::unlink(segment);
+
+    int rc = 1;
+
+    {
+        SubsystemMap map{};
+        SharedSubsystemMap shared{segment, map};
+
+        {
+            RemoteParent gone{map, "Gone"};
+            shared.export_subsystem(gone);
+            gone.destroy();
+        }
+
+        simulate_work(200);
+        rc = shared.import_subsystem("Gone") == nullptr ? 0 : 1;
+    }
+
+    SharedSubsystemMap::unlink(segment);
+    return rc;
+}
+
+int main(void)
+{
+    std::string segment = "/subsystem_test_" + std::to_string(::getpid());
+    SharedSubsystemMap::unlink(segment);
+
+    /* fork before any thread exists */
+    pid_t pid = ::fork();
+    if (pid == 0)
+        ::_exit(run_child(segment));
+
+    int rc = 0;
+
+    {
+        SubsystemMap map{};
+        SharedSubsystemMap shared{segment, map};
+        RemoteParent parent{map};
+
+        shared.export_subsystem(parent);
+
+        /* wait for the remote child to link itself */
+        for (int i = 0; i < 500 && parent.m_children.empty(); ++i)
+            simulate_work(10);
+
+        parent.start();
+        simulate_work(200);
+        parent.destroy();
+
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        rc = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+
+    SharedSubsystemMap::unlink(segment);
+
+    /* every thread of the first run is joined, forking again is safe */
+    if (rc == 0)
+        rc = killed_producer();
+
+    if (rc == 0)
+        rc = destroyed_export();
+
+    std::fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FAILED");
+    return rc;
+}
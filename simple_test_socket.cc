@@ -0,0 +1,139 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "socket_subsystem.hh"
+
+using namespace management;
+
+/* Two independent graphs, each with its own SubsystemMap, connected through
+ * a socketpair. In production each side lives in its own process.
+ */
+
+/* Example of extended IPC type */
+using SubsystemIPC_Extended_Example = SubsystemIPC_Extended<int, std::string>;
+
+//-- PARENT (side A)
+struct SocketParent : ThreadedSubsystem<>
+{
+    SocketParent(SubsystemMap & m, char const * name = "SocketParent") :
+        ThreadedSubsystem(name, m, {})
+    { }
+
+    void on_start() override { std::fprintf(stderr, "PARENT STARTED\n"); }
+    void on_destroy() override { std::fprintf(stderr, "PARENT DESTROYING\n"); }
+};
+
+//-- CHILD (side B)
+struct SocketChild : ThreadedSubsystem<ThreadsafeQueue, SubsystemIPC_Extended_Example, SocketChild>,
+    helpers::extended_ipc_dispatcher<SocketChild>
+{
+    std::atomic_bool started{false};
+    std::atomic_bool destroyed{false};
+    std::atomic_int number{0};
+    std::string text;
+
+    SocketChild(SubsystemMap & m, SubsystemParentsList parents) :
+        ThreadedSubsystem("SocketChild", m, parents)
+    { }
+
+    using Subsystem::operator();
+
+    bool operator() (int & i) { number = i; return true; }
+    bool operator() (std::string & s) { text = s; return true; }
+
+    void on_start() override { std::fprintf(stderr, "CHILD STARTED\n"); started = true; }
+    void on_destroy() override { std::fprintf(stderr, "CHILD DESTROYING\n"); destroyed = true; }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+/* A subsystem exported on A and destroyed before B links to it. A refuses
+ * the frames aimed at it instead of touching the dead subsystem.
+ */
+static bool destroyed_export()
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0)
+        return false;
+
+    SubsystemMap map_a{};
+    SubsystemMap map_b{};
+    SocketSubsystemBridge<SubsystemIPC_Extended_Example> bridge_a{fds[0], map_a};
+    SocketSubsystemBridge<SubsystemIPC_Extended_Example> bridge_b{fds[1], map_b};
+
+    {
+        SocketParent gone{map_a, "Gone"};
+        bridge_a.export_subsystem(gone);
+        gone.destroy();
+    }
+
+    auto remote = bridge_b.import_subsystem("Gone");
+    if (!remote)
+        return false;
+
+    SocketChild child{map_b, SubsystemParentsList{*remote}};
+    remote->post_message(7);
+    remote->put_message({SubsystemIPC::CHILD, child.get_tag(), SubsystemState::RUNNING});
+    simulate_work(100);
+
+    child.destroy();
+    for (int i = 0; i < 500 && !child.destroyed; ++i)
+        simulate_work(10);
+
+    return child.destroyed && !child.started;
+}
+
+int main(void)
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0)
+        return 2;
+
+    SubsystemMap map_a{};
+    SubsystemMap map_b{};
+    SocketSubsystemBridge<SubsystemIPC_Extended_Example> bridge_a{fds[0], map_a};
+    SocketSubsystemBridge<SubsystemIPC_Extended_Example> bridge_b{fds[1], map_b};
+
+    SocketParent parent{map_a};
+    bridge_a.export_subsystem(parent);
+
+    auto remote_parent = bridge_b.import_subsystem("SocketParent");
+    if (!remote_parent)
+        return 3;
+
+    SocketChild child{map_b, SubsystemParentsList{*remote_parent}};
+    bridge_b.export_subsystem(child);
+
+    auto remote_child = bridge_a.import_subsystem("SocketChild");
+    if (!remote_child)
+        return 4;
+
+    /* wait for the remote child to link itself */
+    for (int i = 0; i < 500 && parent.m_children.empty(); ++i)
+        simulate_work(10);
+
+    parent.start();
+
+    remote_child->post_message(42);
+    remote_child->post_message(std::string{"over the wire"});
+
+    for (int i = 0; i < 500 && child.number != 42; ++i)
+        simulate_work(10);
+
+    parent.destroy();
+
+    for (int i = 0; i < 500 && !child.destroyed; ++i)
+        simulate_work(10);
+
+    bool ok = child.started && child.destroyed && child.number == 42 && child.text == "over the wire" &&
+              destroyed_export();
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
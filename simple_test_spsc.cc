@@ -0,0 +1,58 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "subsystem.hh"
+
+using namespace management;
+
+/* A child on an SpscQueue follows its parent through a few transitions. Its
+ * own start() and stop() from on_parent come from its worker, the consumer;
+ * the parent's worker stays the only producer and keeps the ring.
+ */
+
+struct Child : ThreadedSubsystem<SpscQueue>
+{
+    Child(char const * name, SubsystemMap & m, SubsystemParentsList parents) :
+        ThreadedSubsystem(name, m, parents)
+    { }
+
+    bool bus_shared() const { return m_bus.is_shared(); }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+template<typename Ready>
+static bool eventually(Ready && ready)
+{
+    for (int i = 0; i < 400 && !ready(); ++i)
+        simulate_work(5);
+    return ready();
+}
+
+int main(void)
+{
+    SubsystemMap m{};
+    ThreadedSubsystem<> parent{"parent", m};
+    Child child{"child", m, {parent}};
+
+    parent.start();
+    bool ok = eventually([&] { return child.get_state() == SubsystemState::RUNNING; }) && !child.bus_shared();
+
+    for (int i = 0; i < 10; ++i)
+    {
+        parent.stop();
+        ok = ok && eventually([&] { return child.get_state() == SubsystemState::STOPPED; });
+        parent.start();
+        ok = ok && eventually([&] { return child.get_state() == SubsystemState::RUNNING; });
+    }
+
+    ok = ok && !child.bus_shared();
+
+    parent.destroy();
+    simulate_work(100);
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "subsystem_supervisor.hh"
+
+using namespace management;
+
+/* Supervisors restart what faulted and leave the rest alone: one child with
+ * ONE_FOR_ONE, the tail with REST_FOR_ONE, everyone with ONE_FOR_ALL. A
+ * Supervisor over its restart limit faults itself and the one above restarts
+ * it, children included.
+ */
+
+struct Worker : ThreadedSubsystem<>
+{
+    std::atomic_int starts{0};
+
+    Worker(char const * name, SubsystemMap & m, SubsystemParentsList parents) :
+        ThreadedSubsystem(name, m, parents)
+    { }
+
+    void on_start() override { ++starts; }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+template<typename Ready>
+static bool eventually(Ready && ready)
+{
+    for (int i = 0; i < 400 && !ready(); ++i)
+        simulate_work(5);
+    return ready();
+}
+
+static bool run_strategy(RestartStrategy strategy, int a_starts, int b_starts, int c_starts)
+{
+    SubsystemMap m{};
+    SupervisorOptions options;
+    options.strategy = strategy;
+    options.backoff = std::chrono::milliseconds{5};
+
+    Supervisor<> supervisor{"supervisor", m, {}, options};
+    Worker a{"a", m, {supervisor}};
+    Worker b{"b", m, {supervisor}};
+    Worker c{"c", m, {supervisor}};
+    Worker b_child{"b_child", m, {b}};
+
+    supervisor.start();
+    bool ok = eventually([&] { return a.starts == 1 && b.starts == 1 && c.starts == 1 && b_child.starts == 1; });
+
+    b.error();
+    ok = ok && eventually([&] { return b.starts == 2 && b_child.starts == 2; });
+    simulate_work(50);
+
+    ok = ok && a.starts == a_starts && b.starts == b_starts && c.starts == c_starts &&
+         b_child.starts == 2 && supervisor.restarts() == 1;
+
+    supervisor.destroy();
+    simulate_work(100);
+    return ok;
+}
+
+static bool run_escalation()
+{
+    SubsystemMap m{};
+    SupervisorOptions limited;
+    limited.max_restarts = 1;
+    limited.backoff = std::chrono::milliseconds{0};
+
+    Supervisor<> top{"top", m};
+    Supervisor<> inner{"inner", m, {top}, limited};
+    Worker w{"w", m, {inner}};
+
+    top.start();
+    bool ok = eventually([&] { return w.starts == 1; });
+
+    /* first fault is restarted by inner */
+    w.error();
+    ok = ok && eventually([&] { return w.starts == 2; });
+
+    /* second one is over inner's limit, top restarts inner and with it w */
+    w.error();
+    ok = ok && eventually([&] { return w.starts == 3 && top.restarts() == 1; });
+    simulate_work(50);
+
+    ok = ok && inner.restarts() == 1 && !inner.gave_up() && !top.gave_up() &&
+         inner.get_state() == SubsystemState::RUNNING && w.get_state() == SubsystemState::RUNNING;
+
+    top.destroy();
+    simulate_work(100);
+    return ok;
+}
+
+int main(void)
+{
+    bool ok = run_strategy(RestartStrategy::ONE_FOR_ONE, 1, 2, 1);
+    ok = run_strategy(RestartStrategy::REST_FOR_ONE, 1, 2, 2) && ok;
+    ok = run_strategy(RestartStrategy::ONE_FOR_ALL, 2, 2, 2) && ok;
+    ok = run_escalation() && ok;
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "subsystem_watchdog.hh"
+
+using namespace management;
+
+/* A handler that sleeps past its budget is reported once. A child started
+ * before its parent waits in commit_state for good, until the Watchdog
+ * releases it and escalates to ERROR.
+ */
+
+struct Sleeper : ThreadedSubsystem<>
+{
+    Sleeper(char const * name, SubsystemMap & m, SubsystemParentsList parents = {}) :
+        ThreadedSubsystem(name, m, parents)
+    { }
+
+    void on_start() override { std::this_thread::sleep_for(std::chrono::milliseconds(300)); }
+};
+
+#define simulate_work(ms) \
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+int main(void)
+{
+    std::mutex lock;
+    std::vector<SubsystemStall> stalls;
+
+    WatchdogOptions options;
+    options.budget = std::chrono::milliseconds{100};
+    options.interval = std::chrono::milliseconds{20};
+    options.on_stall = [&] (SubsystemStall const & stall) {
+        std::lock_guard<std::mutex> lk{lock};
+        stalls.push_back(stall);
+    };
+
+    SubsystemMap m{};
+    bool ok = true;
+
+    {
+        Watchdog watchdog{m, options};
+        Sleeper slow{"slow", m};
+
+        slow.start();
+        simulate_work(500);
+
+        std::lock_guard<std::mutex> lk{lock};
+        ok = stalls.size() == 1 && stalls[0].tag == slow.get_tag() &&
+             stalls[0].stall == StallKind::HANDLER && stalls[0].kind == MessageKind::SELF &&
+             stalls[0].busy_ns >= 100000000u && watchdog.stalls() == 1;
+
+        slow.destroy();
+        simulate_work(100);
+        stalls.clear();
+    }
+
+    {
+        options.escalate = true;
+        Watchdog watchdog{m, options};
+        ThreadedSubsystem<> parent{"parent", m};
+        ThreadedSubsystem<> child{"child", m, {parent}};
+
+        /* the parent is never started, the child's commit_state waits on it */
+        child.start();
+        for (int i = 0; i < 200 && child.get_state() != SubsystemState::ERROR; ++i)
+            simulate_work(5);
+
+        /* committing ERROR waits on the parent too, that is a second stall */
+        std::lock_guard<std::mutex> lk{lock};
+        ok = ok && !stalls.empty() && child.get_state() == SubsystemState::ERROR;
+
+        for (auto const & stall : stalls)
+            ok = ok && stall.tag == child.get_tag() && stall.stall == StallKind::COMMIT_WAIT;
+
+        parent.destroy();
+        simulate_work(100);
+    }
+
+    std::fprintf(stderr, "%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "socket_subsystem.hh"
+
+/**
+ * @file socket_subsystem.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ */
+
+namespace management
+{
+    namespace detail
+    {
+        SocketChannel::SocketChannel(int fd) :
+            m_fd(fd)
+        {
+            m_pending.reserve(sizes::socket_batch_size * sizeof(wire::FrameHeader));
+            m_sending.reserve(sizes::socket_batch_size * sizeof(wire::FrameHeader));
+        }
+
+        SocketChannel::~SocketChannel()
+        {
+            if (m_fd >= 0)
+                ::close(m_fd);
+        }
+
+        bool SocketChannel::send(char const * frame, std::size_t size)
+        {
+            std::unique_lock<decltype(m_out_lock)> lk{m_out_lock};
+
+            m_pending.insert(m_pending.end(), frame, frame + size);
+            m_pending_sizes.push_back(static_cast<std::uint32_t>(size));
+
+            /* the active flusher picks this frame up */
+            if (m_flushing)
+                return true;
+
+            m_flushing = true;
+            bool ok = true;
+
+            while (!m_pending_sizes.empty())
+            {
+                m_pending.swap(m_sending);
+                m_pending_sizes.swap(m_sending_sizes);
+
+                lk.unlock();
+                ok = transmit() && ok;
+                lk.lock();
+            }
+
+            m_flushing = false;
+            return ok;
+        }
+
+        bool SocketChannel::transmit()
+        {
+            struct mmsghdr headers[sizes::socket_batch_size];
+            struct iovec vectors[sizes::socket_batch_size];
+
+            std::size_t offset = 0;
+            std::size_t frame = 0;
+            bool ok = true;
+
+            while (frame < m_sending_sizes.size())
+            {
+                unsigned batch = 0;
+
+                for (; batch < sizes::socket_batch_size && frame + batch < m_sending_sizes.size(); ++batch)
+                {
+                    vectors[batch].iov_base = &m_sending[offset];
+                    vectors[batch].iov_len = m_sending_sizes[frame + batch];
+                    offset += m_sending_sizes[frame + batch];
+
+                    headers[batch] = mmsghdr{};
+                    headers[batch].msg_hdr.msg_iov = &vectors[batch];
+                    headers[batch].msg_hdr.msg_iovlen = 1;
+                }
+
+                unsigned sent = 0;
+
+                while (sent < batch)
+                {
+                    int ret = ::sendmmsg(m_fd, headers + sent, batch - sent, MSG_NOSIGNAL);
+
+                    if (ret < 0) {
+                        if (errno == EINTR)
+                            continue;
+
+                        /* peer is gone, drop the rest */
+                        ok = false;
+                        break;
+                    }
+
+                    sent += static_cast<unsigned>(ret);
+                }
+
+                if (!ok)
+                    break;
+
+                frame += batch;
+            }
+
+            m_sending.clear();
+            m_sending_sizes.clear();
+            return ok;
+        }
+
+        void SocketChannel::receive(std::function<void(char const *, std::size_t)> const & handler)
+        {
+            std::vector<char> buffers(sizes::socket_batch_size * sizes::max_socket_frame_size);
+            struct mmsghdr headers[sizes::socket_batch_size];
+            struct iovec vectors[sizes::socket_batch_size];
+
+            for (;;)
+            {
+                for (std::size_t i = 0; i < sizes::socket_batch_size; ++i)
+                {
+                    vectors[i].iov_base = &buffers[i * sizes::max_socket_frame_size];
+                    vectors[i].iov_len = sizes::max_socket_frame_size;
+
+                    headers[i] = mmsghdr{};
+                    headers[i].msg_hdr.msg_iov = &vectors[i];
+                    headers[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                /* block for the first frame, then take whatever else is queued */
+                int ret = ::recvmmsg(m_fd, headers, sizes::socket_batch_size, MSG_WAITFORONE, nullptr);
+
+                if (ret < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+
+                if (ret == 0)
+                    return;
+
+                for (int i = 0; i < ret; ++i)
+                {
+                    /* a zero length frame is an orderly shutdown */
+                    if (headers[i].msg_len == 0)
+                        return;
+
+                    handler(static_cast<char const *>(vectors[i].iov_base), headers[i].msg_len);
+                }
+            }
+        }
+
+        void SocketChannel::shutdown()
+        {
+            (void)::shutdown(m_fd, SHUT_RDWR);
+        }
+
+    } /* end namespace detail */
+
+} // end namespace management
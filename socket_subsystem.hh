@@ -0,0 +1,730 @@
+#ifndef _SOCKET_SUBSYSTEM_HH_3735928559_
+#define _SOCKET_SUBSYSTEM_HH_3735928559_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "subsystem.hh"
+
+/**
+ * @file socket_subsystem.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Connects the subsystem graphs of two processes that cannot share memory
+ * through a unix domain socket. Subsystems exported on one side appear on
+ * the other as proxy links, put_message on a proxy is encoded into a compact
+ * binary frame and delivered to the real subsystem on the far side.
+ *
+ * The socket must preserve message boundaries (SOCK_SEQPACKET or SOCK_DGRAM),
+ * e.g. one end of a socketpair() or an accept()ed AF_UNIX connection.
+ */
+
+namespace sizes
+{
+    constexpr const std::size_t max_socket_frame_size = 4096;
+    constexpr const std::size_t socket_batch_size = 32;
+}
+
+namespace management
+{
+    namespace wire
+    {
+        /**
+         * @brief Binary encoding of a bus message type
+         * @details Specialize this to register a type carried by SubsystemIPC_Extended.
+         *          Both ends live on the same host, so values are kept in host order.
+         *          - std::size_t size(T const &)
+         *          - void encode(T const &, char * out)
+         *          - bool decode(char const * in, std::size_t size, T & out)
+         */
+        template<typename T, typename Enable = void>
+            struct codec;
+
+        /**
+         * @brief Arithmetic and enum types are copied verbatim
+         */
+        template<typename T>
+            struct codec<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+        {
+            static std::size_t size(T const &) { return sizeof(T); }
+            static void encode(T const & v, char * out) { std::memcpy(out, &v, sizeof(T)); }
+            static bool decode(char const * in, std::size_t size, T & out)
+            {
+                if (size < sizeof(T))
+                    return false;
+
+                std::memcpy(&out, in, sizeof(T));
+                return true;
+            }
+        };
+
+        /**
+         * @brief Length prefixed string
+         */
+        template<>
+            struct codec<std::string>
+        {
+            static std::size_t size(std::string const & v) { return sizeof(std::uint32_t) + v.size(); }
+            static void encode(std::string const & v, char * out)
+            {
+                std::uint32_t length = static_cast<std::uint32_t>(v.size());
+                std::memcpy(out, &length, sizeof(length));
+                std::memcpy(out + sizeof(length), v.data(), v.size());
+            }
+            static bool decode(char const * in, std::size_t size, std::string & out)
+            {
+                std::uint32_t length;
+
+                if (size < sizeof(length))
+                    return false;
+
+                std::memcpy(&length, in, sizeof(length));
+                if (size - sizeof(length) < length)
+                    return false;
+
+                out.assign(in + sizeof(length), length);
+                return true;
+            }
+        };
+
+        /**
+         * @brief SubsystemIPC as from/state/tag
+         */
+        template<>
+            struct codec<SubsystemIPC>
+        {
+            static constexpr std::size_t encoded_size = 2 + sizeof(SubsystemTag);
+
+            static std::size_t size(SubsystemIPC const &) { return encoded_size; }
+            static void encode(SubsystemIPC const & v, char * out)
+            {
+                out[0] = static_cast<char>(v.from);
+                out[1] = static_cast<char>(v.state);
+                std::memcpy(out + 2, &v.tag, sizeof(v.tag));
+            }
+            static bool decode(char const * in, std::size_t size, SubsystemIPC & out)
+            {
+                if (size < encoded_size)
+                    return false;
+
+                out.from = static_cast<decltype(out.from)>(in[0]);
+                out.state = static_cast<SubsystemState>(in[1]);
+                std::memcpy(&out.tag, in + 2, sizeof(out.tag));
+                return true;
+            }
+        };
+
+#ifdef SUBSYSTEM_HAS_BOOST
+        namespace detail
+        {
+            struct size_visitor : boost::static_visitor<std::size_t>
+            {
+                template<typename A>
+                    std::size_t operator()(A const & a) const { return codec<A>::size(a); }
+            };
+
+            struct encode_visitor : boost::static_visitor<void>
+            {
+                char * out;
+                explicit encode_visitor(char * o) : out(o) { }
+
+                template<typename A>
+                    void operator()(A const & a) const { codec<A>::encode(a, out); }
+            };
+
+            template<typename V, typename... Alts>
+                struct variant_decoder;
+
+            template<typename V>
+                struct variant_decoder<V>
+            {
+                static bool decode(unsigned, char const *, std::size_t, V &) { return false; }
+            };
+
+            template<typename V, typename A, typename... Rest>
+                struct variant_decoder<V, A, Rest...>
+            {
+                static bool decode(unsigned index, char const * in, std::size_t size, V & out)
+                {
+                    if (index != 0)
+                        return variant_decoder<V, Rest...>::decode(index - 1, in, size, out);
+
+                    A value;
+                    if (!codec<A>::decode(in, size, value))
+                        return false;
+
+                    out = std::move(value);
+                    return true;
+                }
+            };
+        } /* end namespace detail */
+
+        /**
+         * @brief Variant as alternative index followed by the alternative
+         */
+        template<typename... Ts>
+            struct codec<boost::variant<Ts...>>
+        {
+            using type = boost::variant<Ts...>;
+
+            static std::size_t size(type const & v)
+            {
+                return 1 + boost::apply_visitor(detail::size_visitor{}, v);
+            }
+
+            static void encode(type const & v, char * out)
+            {
+                out[0] = static_cast<char>(v.which());
+                boost::apply_visitor(detail::encode_visitor{out + 1}, v);
+            }
+
+            static bool decode(char const * in, std::size_t size, type & out)
+            {
+                if (size < 1)
+                    return false;
+
+                return detail::variant_decoder<type, Ts...>::decode(static_cast<unsigned char>(in[0]),
+                                                                    in + 1, size - 1, out);
+            }
+        };
+#endif
+
+        /**
+         * @brief Fixed frame header, an IPC frame is nothing but this
+         */
+        struct FrameHeader
+        {
+            enum Kind : std::uint8_t { ANNOUNCE, LINK_CHILD, UNLINK_CHILD, IPC, EXTENDED } kind;
+            std::uint8_t from; /**< SubsystemIPC::from, valid for IPC */
+            SubsystemState state; /**< SubsystemIPC::state, valid for IPC */
+            std::uint8_t reserved;
+            SubsystemTag sender; /**< Sender's tag on its own side, 0 if the frame targets itself */
+            SubsystemTag target; /**< Target's tag on the receiving side */
+        };
+
+        static_assert(sizeof(FrameHeader) == 12, "FrameHeader must stay packed");
+
+    } /* end namespace wire */
+
+    namespace detail
+    {
+        /**
+         * @brief Batched, message oriented transport over a connected socket
+         * @details Frames are queued by any thread. Whichever thread finds the
+         *          queue idle becomes the flusher and hands everything queued
+         *          meanwhile to sendmmsg, so batches grow with contention without
+         *          adding a sender thread or latency. receive() drains the socket
+         *          with recvmmsg.
+         */
+        class SocketChannel final
+        {
+        private:
+            /**< Connected socket, owned */
+            int m_fd;
+            /**< Guards m_pending and m_flushing */
+            std::mutex m_out_lock;
+            /**< Frames waiting for the flusher, back to back */
+            std::vector<char> m_pending;
+            /**< Sizes of the frames in m_pending */
+            std::vector<std::uint32_t> m_pending_sizes;
+            /**< Frames currently being sent, only touched by the flusher */
+            std::vector<char> m_sending;
+            /**< Sizes of the frames in m_sending */
+            std::vector<std::uint32_t> m_sending_sizes;
+            /**< Someone is inside transmit() */
+            bool m_flushing = false;
+
+            bool transmit();
+
+        public:
+            /**
+             * @param fd Connected SOCK_SEQPACKET or SOCK_DGRAM socket, closed on destruction
+             */
+            explicit SocketChannel(int fd);
+            ~SocketChannel();
+
+            SocketChannel(SocketChannel const &) = delete;
+
+            /**
+             * @brief Queues a frame and flushes unless another thread already is
+             * @return F, if the peer is gone
+             */
+            bool send(char const * frame, std::size_t size);
+
+            /**
+             * @brief Blocks handing every received frame to handler until the peer closes
+             */
+            void receive(std::function<void(char const *, std::size_t)> const & handler);
+
+            /**
+             * @brief Unblocks receive()
+             */
+            void shutdown();
+        };
+    } /* end namespace detail */
+
+    template<typename T>
+        class SocketSubsystemBridge;
+
+    /**
+     * @brief Local stand-in for a subsystem living on the other end of a socket
+     * @tparam T Bus message type shared by both ends
+     */
+    template<typename T>
+        class SocketSubsystemLink final : public detail::SubsystemLink
+    {
+    private:
+        /**< Bridge that created this proxy */
+        SocketSubsystemBridge<T> & m_bridge;
+        /**< Guards m_parents and m_children */
+        std::mutex m_edge_lock;
+
+    public:
+        /**< Tag of the real subsystem on its own side */
+        SubsystemTag const m_remote_tag;
+        /**< Set once the peer went away */
+        bool m_lost = false;
+
+        SocketSubsystemLink(SocketSubsystemBridge<T> & bridge, SubsystemTag remote_tag, std::string const & name) :
+            detail::SubsystemLink(bridge.m_local.memory_resource()),
+            m_bridge(bridge),
+            m_remote_tag(remote_tag)
+        {
+            m_tag = SubsystemMap::generate_subsystem_tag();
+            set_name(bridge.m_local, name);
+        }
+
+        void add_child(SubsystemLink & child) override
+        {
+            SubsystemTag sender = m_bridge.ensure_exported(child);
+
+            {
+                std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+                m_children.insert(child.get_tag());
+            }
+
+            m_bridge.send_frame({wire::FrameHeader::LINK_CHILD, 0, SubsystemState::INIT, 0, sender, m_remote_tag});
+        }
+
+        void add_parent(SubsystemLink & parent) override
+        {
+            std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+            m_parents.insert(parent.get_tag());
+        }
+
+        void remove_child(SubsystemTag tag) override
+        {
+            {
+                std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+                m_children.erase(tag);
+            }
+
+            m_bridge.send_frame({wire::FrameHeader::UNLINK_CHILD, 0, SubsystemState::INIT, 0, tag, m_remote_tag});
+        }
+
+        void remove_parent(SubsystemTag tag) override
+        {
+            std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+            m_parents.erase(tag);
+        }
+
+        void put_message(SubsystemIPC msg) override
+        {
+            if (m_lost)
+                return;
+
+            /* messages directed at the proxy itself carry its own tag */
+            SubsystemTag sender = (msg.tag == m_tag) ? 0 : m_bridge.ensure_exported(msg.tag);
+
+            m_bridge.send_frame({wire::FrameHeader::IPC, static_cast<std::uint8_t>(msg.from),
+                                 msg.state, 0, sender, m_remote_tag});
+        }
+
+        /**
+         * @brief Sends an extended bus message to the remote subsystem
+         * @param msg The message, encoded with wire::codec<T>
+         */
+        void post_message(T const & msg)
+        {
+            if (!m_lost)
+                m_bridge.send_payload(m_remote_tag, msg);
+        }
+
+        /**
+         * @brief Copies the current edges
+         */
+        void get_edges(detail::SubsystemEdgeSet & parents, detail::SubsystemEdgeSet & children)
+        {
+            std::lock_guard<decltype(m_edge_lock)> lk{m_edge_lock};
+            parents = m_parents;
+            children = m_children;
+        }
+    };
+
+    /**
+     * @brief Bridges a local SubsystemMap with a peer over a unix domain socket
+     * @details A receiver thread decodes incoming frames and forwards them to the
+     *          exported local subsystems. The bridge must outlive the subsystems
+     *          linked through it.
+     * @tparam T Bus message type carried by EXTENDED frames, usually a SubsystemIPC_Extended
+     */
+    template<typename T = SubsystemIPC>
+        class SocketSubsystemBridge final
+    {
+    private:
+        friend class SocketSubsystemLink<T>;
+
+        /**< Receives extended messages for an exported subsystem */
+        using sink_type = std::function<void(T &&)>;
+
+        /**< An exported local subsystem, looked up in m_local by its tag, it
+         * may be gone already */
+        struct Exported
+        {
+            /**< Captures the subsystem, only called once m_local still maps it */
+            sink_type sink;
+            /**< Set once the ANNOUNCE frame is on the wire */
+            bool announced;
+        };
+
+        /**< The process local map proxies are registered with */
+        SubsystemMap & m_local;
+        /**< Transport */
+        detail::SocketChannel m_channel;
+        /**< Serializes ANNOUNCE sends, never taken by the receiver */
+        std::mutex m_announce_lock;
+        /**< Guards the tables below */
+        std::mutex m_lock;
+        /**< Signalled on every ANNOUNCE */
+        std::condition_variable m_announced;
+        /**< local tag -> exported subsystem */
+        std::unordered_map<SubsystemTag, Exported> m_exported;
+        /**< remote tag -> proxy */
+        std::unordered_map<SubsystemTag, std::unique_ptr<SocketSubsystemLink<T>>> m_proxies;
+        /**< Set by the destructor, stops peer loss from being reported */
+        bool m_closing = false;
+        /**< Receiver thread */
+        std::thread m_receiver;
+
+    public:
+        /**
+         * @brief Constructor
+         * @param fd Connected socket preserving message boundaries, owned by the bridge
+         * @param local The process local map
+         */
+        SocketSubsystemBridge(int fd, SubsystemMap & local) :
+            m_local(local),
+            m_channel(fd)
+        {
+            m_receiver = std::thread{[this] ()
+                {
+                    m_channel.receive([this] (char const * frame, std::size_t size) { on_frame(frame, size); });
+                    peer_lost();
+                }
+            };
+        }
+
+        SocketSubsystemBridge(SocketSubsystemBridge const &) = delete;
+
+        /**
+         * @brief Destructor, unregisters all proxies
+         */
+        ~SocketSubsystemBridge()
+        {
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+                m_closing = true;
+            }
+
+            m_channel.shutdown();
+
+            if (m_receiver.joinable())
+                m_receiver.join();
+
+            for (auto & pair : m_proxies)
+                m_local.remove(pair.second->get_tag());
+        }
+
+        /**
+         * @brief Makes a local subsystem visible to the peer
+         * @details Such a subsystem only receives SubsystemIPC
+         * @param link The local subsystem
+         */
+        void export_subsystem(detail::SubsystemLink & link)
+        {
+            (void)ensure_exported(link);
+        }
+
+        /**
+         * @brief Makes a local subsystem visible to the peer, including extended messages
+         * @param subsystem The local subsystem
+         */
+        template<template <typename...> class Bus, typename Dispatch>
+            void export_subsystem(Subsystem<Bus, T, Dispatch> & subsystem)
+            {
+                (void)ensure_exported(subsystem);
+
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+                m_exported[subsystem.get_tag()].sink = [&subsystem] (T && msg) {
+                    subsystem.post_message(std::move(msg));
+                };
+            }
+
+        /**
+         * @brief Waits for the peer to export a subsystem
+         * @param name The exported name
+         * @param timeout How long to wait for it
+         * @return The proxy, registered with the local map, or nullptr
+         */
+        SocketSubsystemLink<T> * import_subsystem(std::string const & name,
+                                                  std::chrono::milliseconds timeout = std::chrono::milliseconds(1000))
+        {
+            std::unique_lock<decltype(m_lock)> lk{m_lock};
+            SocketSubsystemLink<T> * ret = nullptr;
+
+            m_announced.wait_for(lk, timeout, [&] {
+                for (auto & pair : m_proxies) {
+                    if (pair.second->get_name() == name) {
+                        ret = pair.second.get();
+                        return true;
+                    }
+                }
+                return false;
+            });
+
+            return ret;
+        }
+
+    private:
+        /**
+         * @brief Announces a local subsystem to the peer once
+         * @return The subsystem's tag
+         */
+        SubsystemTag ensure_exported(detail::SubsystemLink & link)
+        {
+            SubsystemTag tag = link.get_tag();
+
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+                auto it = m_exported.find(tag);
+
+                if (it != m_exported.end() && it->second.announced)
+                    return tag;
+            }
+
+            /* a caller that finds the tag announced knows the ANNOUNCE already
+             * precedes its frames, concurrent exporters wait here for it. The
+             * send happens outside m_lock so a full socket never stalls the
+             * receiver. */
+            std::lock_guard<decltype(m_announce_lock)> announcing{m_announce_lock};
+
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+                if (m_exported[tag].announced)
+                    return tag;
+
+                /* drop exports whose subsystem left the map, and their sinks */
+                for (auto it = m_exported.begin(); it != m_exported.end();)
+                    it = m_local.contains(it->first) ? std::next(it) : m_exported.erase(it);
+            }
+
+            char frame[sizes::max_socket_frame_size];
+            std::string const & name = link.get_name();
+            std::size_t size = std::min(name.size(), sizeof(frame) - sizeof(wire::FrameHeader));
+
+            wire::FrameHeader header{wire::FrameHeader::ANNOUNCE, 0, link.get_state(), 0, tag, 0};
+            std::memcpy(frame, &header, sizeof(header));
+            std::memcpy(frame + sizeof(header), name.data(), size);
+            m_channel.send(frame, sizeof(header) + size);
+
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+            m_exported[tag].announced = true;
+
+            return tag;
+        }
+
+        /**
+         * @brief Exports the local subsystem with the given tag
+         */
+        SubsystemTag ensure_exported(SubsystemTag tag)
+        {
+            detail::SubsystemLink * link = m_local.find(tag);
+            if (!link)
+                return 0;
+
+            return ensure_exported(*link);
+        }
+
+        /**
+         * @brief Sends a header only frame
+         */
+        void send_frame(wire::FrameHeader const & header)
+        {
+            m_channel.send(reinterpret_cast<char const *>(&header), sizeof(header));
+        }
+
+        /**
+         * @brief Sends an EXTENDED frame
+         */
+        void send_payload(SubsystemTag target, T const & msg)
+        {
+            char frame[sizes::max_socket_frame_size];
+            std::size_t size = wire::codec<T>::size(msg);
+
+            if (size > sizeof(frame) - sizeof(wire::FrameHeader)) {
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+                throw std::runtime_error("Message exceeds max_socket_frame_size");
+#else
+                return;
+#endif
+            }
+
+            wire::FrameHeader header{wire::FrameHeader::EXTENDED, 0, SubsystemState::INIT, 0, 0, target};
+            std::memcpy(frame, &header, sizeof(header));
+            wire::codec<T>::encode(msg, frame + sizeof(header));
+            m_channel.send(frame, sizeof(header) + size);
+        }
+
+        /**
+         * @brief Receiver side dispatch of a single frame
+         */
+        void on_frame(char const * frame, std::size_t size)
+        {
+            wire::FrameHeader header;
+
+            if (size < sizeof(header))
+                return;
+
+            std::memcpy(&header, frame, sizeof(header));
+
+            if (header.kind == wire::FrameHeader::ANNOUNCE)
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+                auto & proxy = m_proxies[header.sender];
+
+                if (!proxy) {
+                    proxy.reset(new SocketSubsystemLink<T>{*this, header.sender,
+                                std::string(frame + sizeof(header), size - sizeof(header))});
+                    proxy->m_state = header.state;
+                    m_local.put(proxy->get_tag(), std::ref<detail::SubsystemLink>(*proxy));
+                }
+
+                m_announced.notify_all();
+                return;
+            }
+
+            detail::SubsystemLink * local = nullptr;
+            SocketSubsystemLink<T> * sender = nullptr;
+            sink_type sink;
+
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+                /* refuse frames for tags that were never exported */
+                auto target = m_exported.find(header.target);
+                if (target == m_exported.end())
+                    return;
+
+                /* and forget exports whose subsystem is gone */
+                local = m_local.find(header.target);
+                if (!local) {
+                    m_exported.erase(target);
+                    return;
+                }
+
+                sink = target->second.sink;
+
+                auto proxy = m_proxies.find(header.sender);
+                if (proxy != m_proxies.end())
+                    sender = proxy->second.get();
+
+                if (sender && header.kind == wire::FrameHeader::IPC)
+                    sender->m_state = header.state;
+            }
+
+            switch(header.kind)
+            {
+            case wire::FrameHeader::IPC:
+                local->put_message({static_cast<decltype(SubsystemIPC::from)>(header.from),
+                                    sender ? sender->get_tag() : local->get_tag(), header.state});
+                break;
+            case wire::FrameHeader::EXTENDED:
+                if (sink) {
+                    T msg;
+                    if (wire::codec<T>::decode(frame + sizeof(header), size - sizeof(header), msg))
+                        sink(std::move(msg));
+                }
+                break;
+            case wire::FrameHeader::LINK_CHILD:
+                if (sender) {
+                    sender->add_parent(*local);
+                    local->add_child(*sender);
+                }
+                break;
+            case wire::FrameHeader::UNLINK_CHILD:
+                if (sender) {
+                    local->remove_child(sender->get_tag());
+                    sender->remove_parent(local->get_tag());
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        /**
+         * @brief Reports every proxy's subsystem as ERROR to its local neighbours
+         */
+        void peer_lost()
+        {
+            std::vector<SocketSubsystemLink<T> *> lost;
+
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+                if (m_closing)
+                    return;
+
+                for (auto & pair : m_proxies)
+                {
+                    SocketSubsystemLink<T> & proxy = *pair.second;
+                    proxy.m_lost = true;
+
+                    if (proxy.get_state() != SubsystemState::DESTROY) {
+                        proxy.m_state = SubsystemState::ERROR;
+                        lost.push_back(&proxy);
+                    }
+                }
+            }
+
+            for (auto proxy : lost)
+            {
+                detail::SubsystemEdgeSet parents, children;
+                proxy->get_edges(parents, children);
+
+                for (auto tag : children)
+                    if (detail::SubsystemLink * child = m_local.find(tag))
+                        child->put_message({SubsystemIPC::PARENT, proxy->get_tag(), SubsystemState::ERROR});
+
+                for (auto tag : parents)
+                    if (detail::SubsystemLink * parent = m_local.find(tag))
+                        parent->put_message({SubsystemIPC::CHILD, proxy->get_tag(), SubsystemState::ERROR});
+            }
+        }
+    };
+
+} /* end namespace management */
+
+#endif // guard
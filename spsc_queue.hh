@@ -0,0 +1,407 @@
+#ifndef _SHARED_SPSC_QUEUE_H_
+#define _SHARED_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "futex_notifier.hh"
+#include "wait_strategy.hh"
+
+namespace sizes
+{
+    /**< Default SpscQueue ring slots */
+    constexpr const std::size_t spsc_ring_capacity = 1024;
+}
+
+namespace management
+{
+    namespace detail
+    {
+        /**
+         * @brief Bounded wait-free ring, one producer and one consumer
+         * @details Each side keeps a cached copy of the other's index so
+         *          they rarely touch the other's cache line.
+         * @tparam E Slot type, copyable
+         * @tparam Capacity Number of slots, a power of two
+         */
+        template<typename E, std::size_t Capacity>
+            class SpscRing final
+            {
+            private:
+                static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                              "SpscRing capacity must be a power of two");
+
+                /* Padded instead of alignas(64), see ShardedCounter. Fields 128 bytes
+                 * apart never share a cache line. */
+                struct consumer_side {
+                    /**< Next slot to read, written by the consumer */
+                    std::atomic<std::size_t> head{0};
+                    /**< Last tail the consumer saw */
+                    std::size_t cached_tail = 0;
+                    char pad[128 - sizeof(std::atomic<std::size_t>) - sizeof(std::size_t)];
+                };
+
+                struct producer_side {
+                    /**< Next slot to write, written by the producer */
+                    std::atomic<std::size_t> tail{0};
+                    /**< Last head the producer saw */
+                    std::size_t cached_head = 0;
+                    char pad[128 - sizeof(std::atomic<std::size_t>) - sizeof(std::size_t)];
+                };
+
+                consumer_side m_consumer;
+                producer_side m_producer;
+                E m_slots[Capacity];
+
+            public:
+                /**
+                 * @brief Producer side
+                 * @return F, if the ring is full
+                 */
+                bool push(E const & e)
+                {
+                    std::size_t tail = m_producer.tail.load(std::memory_order_relaxed);
+
+                    if (tail - m_producer.cached_head == Capacity) {
+                        m_producer.cached_head = m_consumer.head.load(std::memory_order_acquire);
+
+                        if (tail - m_producer.cached_head == Capacity)
+                            return false;
+                    }
+
+                    m_slots[tail & (Capacity - 1)] = e;
+                    m_producer.tail.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+
+                /**
+                 * @brief Consumer side, the oldest slot without removing it
+                 * @return nullptr, if the ring is empty
+                 */
+                E const * front()
+                {
+                    std::size_t head = m_consumer.head.load(std::memory_order_relaxed);
+
+                    if (head == m_consumer.cached_tail) {
+                        m_consumer.cached_tail = m_producer.tail.load(std::memory_order_acquire);
+
+                        if (head == m_consumer.cached_tail)
+                            return nullptr;
+                    }
+
+                    return &m_slots[head & (Capacity - 1)];
+                }
+
+                /**
+                 * @brief Consumer side
+                 * @return F, if the ring is empty
+                 */
+                bool pop(E & e)
+                {
+                    E const * slot = front();
+
+                    if (!slot)
+                        return false;
+
+                    e = *slot;
+                    m_consumer.head.store(m_consumer.head.load(std::memory_order_relaxed) + 1,
+                                          std::memory_order_release);
+                    return true;
+                }
+
+                /**
+                 * @return Entries in the ring, from any thread, may be stale
+                 */
+                std::size_t size() const
+                {
+                    return m_producer.tail.load(std::memory_order_relaxed) -
+                           m_consumer.head.load(std::memory_order_relaxed);
+                }
+            };
+    } /* end namespace detail */
+
+    /**
+     * @brief Bus for a subsystem that has a single producer
+     * @detail The first thread that pushes owns a wait-free ring: a push is a
+     *      slot write and a release store, the consumer and the producer each
+     *      keep a cached copy of the other's index so they rarely touch the
+     *      other's cache line.
+     *
+     *      Anything the ring cannot take goes through a locked overflow list:
+     *      pushes from a second thread, and from the owner once the ring was
+     *      full. Either makes the queue shared for good, every later push
+     *      takes the lock, so each producer's messages stay in order. The
+     *      consumer empties the ring before the overflow list.
+     *
+     *      A subsystem's worker sends to itself (start() from on_parent). Those
+     *      pushes come from the consumer's own thread, they take the overflow
+     *      list without claiming the ring or making the queue shared.
+     *
+     *      Drop-in for ThreadsafeQueue.
+     *
+     * @tparam T The type of data to hold
+     * @tparam Capacity Ring slots, a power of two
+     */
+    template<typename T, typename Capacity = std::integral_constant<std::size_t, sizes::spsc_ring_capacity>>
+        class SpscQueue final
+        {
+        public:
+            /**< Underlaying type */
+            using type = T;
+            /**< Queue type */
+            using data_type = std::unique_ptr<T>;
+            /**< Termination type */
+            using terminator = std::nullptr_t;
+            /**< Enqueue timestamp type */
+            using time_point = std::chrono::steady_clock::time_point;
+
+        private:
+            /**< Ring or overflow entry, the item and when it was pushed */
+            struct entry {
+                T * data;
+                time_point enqueued;
+            };
+
+            /**< The owner's ring */
+            detail::SpscRing<entry, Capacity::value> ring;
+
+            /**< Thread allowed to use the ring, none until the first push */
+            std::atomic<std::thread::id> owner;
+            /**< Thread that popped last, its own pushes skip the ring */
+            std::atomic<std::thread::id> consumer;
+            /**< Set once the ring is retired, see class comment */
+            std::atomic_bool shared{false};
+
+            /**< Overflow list */
+            std::mutex mutex;
+            std::deque<entry> overflow;
+            /**< Number of overflow entries, readable without the lock */
+            std::atomic<int> overflow_depth{0};
+
+            /**< Wakes the consumer, only when it sleeps */
+            FutexNotifier notifier;
+            /**< How the consumer waits, see set_wait_strategy */
+            WaitStrategy strategy;
+            /**< Where the consumer's waits ended */
+            WaitStats stats;
+
+        public:
+            /**
+             * @brief Default constructor
+             */
+            SpscQueue() : owner(std::thread::id{}), consumer(std::thread::id{}) { }
+
+            SpscQueue(SpscQueue const &) = delete;
+
+            ~SpscQueue()
+            {
+                entry e{};
+                while (ring.pop(e))
+                    delete e.data;
+                for (auto & o : overflow)
+                    delete o.data;
+            }
+
+            /**
+             * @brief Wait for poping
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop()
+            {
+                time_point enqueued;
+                return wait_and_pop(enqueued);
+            }
+
+            /**
+             * @brief Wait for poping
+             * @param enqueued Set to the time the value was pushed
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop(time_point & enqueued)
+            {
+                if (!detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                    stats.record(WaitPhase::PARK);
+                    notifier.await([this] { return size() != 0; });
+                }
+
+                data_type value;
+                (void)pop_front(value, enqueued);
+                return value;
+            }
+
+            /**
+             * @brief Wait for poping, at most timeout
+             * @param timeout How long to wait for an item
+             * @param value Set to the value at the top of the queue
+             * @param enqueued Set to the time the value was pushed
+             * @return T, if value was set; F, on timeout
+             */
+            template<typename Rep, typename Period>
+                bool wait_and_pop_for(std::chrono::duration<Rep, Period> timeout,
+                                      data_type & value, time_point & enqueued)
+                {
+                    /* a zero timeout is a poll, not a wait */
+                    if (timeout.count() > 0 &&
+                        detail::spin_wait(strategy, [this] { return size() != 0; }, stats))
+                        return pop_front(value, enqueued);
+
+                    if (timeout.count() > 0)
+                        stats.record(WaitPhase::PARK);
+
+                    if (!notifier.await_until([this] { return size() != 0; },
+                                              std::chrono::steady_clock::now() + timeout))
+                        return false;
+
+                    return pop_front(value, enqueued);
+                }
+
+            /**
+             * @brief Pop the queue without waiting
+             * @return nullptr or data_type instance
+             */
+            data_type try_pop()
+            {
+                data_type value;
+                time_point enqueued;
+                (void)pop_front(value, enqueued);
+                return value;
+            }
+
+            /**
+             * @brief Pushes a new item into the queue
+             * @details Warning: The data is now owned by the queue
+             * @param new_value The new queue item
+             */
+            void push(T new_value)
+            {
+                /* Copy/move construct T */
+                link(new T(std::move(new_value)));
+            }
+
+            /**
+             * @brief pushes terminator type to tell any queue listeners to stop
+             */
+            void terminate() { link(nullptr); }
+
+            /**
+             * @return The size of the queue
+             * @details Lock free, the value may be stale by the time it is used
+             */
+            int size() const
+            {
+                return static_cast<int>(ring.size()) + overflow_depth.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @return T, once the ring was retired and every push takes the lock
+             */
+            bool is_shared() const { return shared.load(std::memory_order_relaxed); }
+
+            /**
+             * @brief Sets how the consumer waits for items
+             * @details Call before the consumer starts waiting.
+             */
+            void set_wait_strategy(WaitStrategy const & value) { strategy = value; }
+
+            /**
+             * @return Where the consumer's waits ended
+             */
+            WaitStats const & wait_stats() const { return stats; }
+
+            /**
+             * @return The consumer wakeup, for its syscall counters
+             */
+            FutexNotifier const & wakeup() const { return notifier; }
+
+        private:
+            /**
+             * @brief Pushes an item, nullptr being the terminator
+             */
+            void link(T * data)
+            {
+                entry e{data, std::chrono::steady_clock::now()};
+
+                if (!ring_push(e)) {
+                    std::lock_guard<std::mutex> lk{mutex};
+                    overflow.push_back(e);
+                    overflow_depth.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                /* no syscall unless the consumer is asleep */
+                notifier.notify();
+            }
+
+            /**
+             * @brief Owner side of the ring
+             * @return F, if the caller has to take the overflow list
+             */
+            bool ring_push(entry const & e)
+            {
+                std::thread::id self = std::this_thread::get_id();
+
+                /* the consumer posting to itself is not a second producer */
+                if (consumer.load(std::memory_order_relaxed) == self)
+                    return false;
+
+                std::thread::id current = owner.load(std::memory_order_relaxed);
+
+                if (current == std::thread::id{} &&
+                    owner.compare_exchange_strong(current, self, std::memory_order_relaxed))
+                    current = self;
+
+                if (current != self || shared.load(std::memory_order_relaxed)) {
+                    shared.store(true, std::memory_order_relaxed);
+                    return false;
+                }
+
+                if (!ring.push(e)) {
+                    shared.store(true, std::memory_order_relaxed);
+                    return false;
+                }
+
+                return true;
+            }
+
+            /**
+             * @brief Removes the oldest entry, ring first
+             * @return F, if the queue is empty
+             */
+            bool pop_front(data_type & value, time_point & enqueued)
+            {
+                std::thread::id self = std::this_thread::get_id();
+                entry e{};
+
+                /* a respawned worker is a new consumer thread */
+                if (consumer.load(std::memory_order_relaxed) != self)
+                    consumer.store(self, std::memory_order_relaxed);
+
+                if (!ring.pop(e)) {
+                    std::lock_guard<std::mutex> lk{mutex};
+
+                    /* the owner may have filled the ring, then moved on to the
+                     * overflow list; its ring entries come first */
+                    if (!ring.pop(e)) {
+                        if (overflow.empty())
+                            return false;
+
+                        e = overflow.front();
+                        overflow.pop_front();
+                        overflow_depth.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+
+                value.reset(e.data);
+                enqueued = e.enqueued;
+                return true;
+            }
+        };
+
+} // end namespace management
+
+#endif // guard
@@ -1,10 +1,16 @@
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <mutex>
+#include <ostream>
 
-#ifndef NDEBUG
-#include <iostream>
-#endif
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "subsystem.hh"
 
@@ -15,28 +21,50 @@
 
 namespace management
 {
-    SubsystemMap::SubsystemMap(std::uint32_t max_subsystems) noexcept :
-        m_max_subsystems(max_subsystems)
+    SubsystemMap::SubsystemMap(std::uint32_t max_subsystems, MemoryResource * resource) noexcept :
+        m_max_subsystems(max_subsystems),
+        m_resource(resource),
+        m_map(m_max_subsystems, std::hash<SubsystemTag>(), std::equal_to<SubsystemTag>(), resource),
+        m_names(resource),
+        m_name_ids(0, name_hash(), name_equal(), resource),
+        m_tag_names(0, std::hash<SubsystemTag>(), std::equal_to<SubsystemTag>(), resource),
+        m_retired_tags(resource)
     {
-        m_map = SubsystemMapType{};
-        m_map.reserve(m_max_subsystems);
     }
 
-    SubsystemTag SubsystemMap::generate_subsystem_tag()
+    namespace
     {
-        static std::mutex tag_lock;
-        static SubsystemTag current = SubsystemTag{};
+        /**< Last tag handed out, without the 0x55000000 marker */
+        std::atomic<SubsystemTag> g_current_tag{0};
+    }
 
-        std::lock_guard<decltype(tag_lock)> lk{tag_lock};
+    SubsystemTag SubsystemMap::generate_subsystem_tag()
+    {
+        return (0x55000000 | (g_current_tag.fetch_add(1, std::memory_order_relaxed) + 1));
+    }
 
-        return (0x55000000 | ++current);
+    SubsystemTag SubsystemMap::reserve_subsystem_tags(std::uint32_t count)
+    {
+        return (0x55000000 | (g_current_tag.fetch_add(count, std::memory_order_relaxed) + 1));
     }
 
     void SubsystemMap::remove(SubsystemMap::key_type key)
     {
         std::lock_guard<decltype(m_lock)> lk{m_lock};
-        /* explicitly ignore return */
-        (void)m_map.erase(key);
+
+        if (!m_map.erase(key) || !m_tag_names.count(key))
+            return;
+
+        /* keep naming the tag for trace dumps, but only the recent ones */
+        m_retired_tags.push_back(key);
+
+        if (m_retired_tags.size() > sizes::retired_tag_names) {
+            SubsystemTag oldest = m_retired_tags.front();
+            m_retired_tags.pop_front();
+
+            if (m_map.find(oldest) == m_map.end())
+                (void)m_tag_names.erase(oldest);
+        }
     }
 
     SubsystemMap::value_type SubsystemMap::get(SubsystemMap::key_type key)
@@ -46,29 +74,489 @@ namespace management
         return ret;
     }
 
+    bool SubsystemMap::contains(SubsystemMap::key_type key) const
+    {
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        return m_map.find(key) != m_map.end();
+    }
+
+    detail::SubsystemLink const * SubsystemMap::find(SubsystemMap::key_type key) const
+    {
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        auto it = m_map.find(key);
+        return it == m_map.end() ? nullptr : &it->second.get();
+    }
+
+    detail::SubsystemLink * SubsystemMap::find(SubsystemMap::key_type key)
+    {
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        auto it = m_map.find(key);
+        return it == m_map.end() ? nullptr : &it->second.get();
+    }
+
     void SubsystemMap::put(SubsystemMap::key_type key, SubsystemMap::value_type value)
     {
         std::lock_guard<decltype(m_lock)> lk{m_lock};
         /* ignore return */
         (void)m_map.emplace(key, value);
+
+        if (value.get().get_name_id())
+            m_tag_names[key] = value.get().get_name_id();
+    }
+
+    void SubsystemMap::put(std::vector<std::pair<key_type, value_type>> const & entries)
+    {
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        m_map.reserve(m_map.size() + entries.size());
+
+        for (auto & entry : entries) {
+            (void)m_map.emplace(entry.first, entry.second);
+
+            if (entry.second.get().get_name_id())
+                m_tag_names[entry.first] = entry.second.get().get_name_id();
+        }
+    }
+
+    SubsystemNameId SubsystemMap::intern_name(std::string const & name)
+    {
+        if (name.empty())
+            return 0;
+
+        std::lock_guard<decltype(m_names_lock)> lk{m_names_lock};
+
+        auto it = m_name_ids.find(&name);
+        if (it != m_name_ids.end())
+            return it->second;
+
+        m_names.push_back(name);
+        SubsystemNameId id = static_cast<SubsystemNameId>(m_names.size());
+        m_name_ids.emplace(&m_names.back(), id);
+        return id;
+    }
+
+    std::string const & SubsystemMap::name_of(SubsystemNameId id) const
+    {
+        std::lock_guard<decltype(m_names_lock)> lk{m_names_lock};
+        return (id == 0 || id > m_names.size()) ? detail::SubsystemLink::no_name() : m_names[id - 1];
+    }
+
+    SubsystemNameId SubsystemMap::name_id_of(SubsystemMap::key_type key) const
+    {
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        auto it = m_tag_names.find(key);
+        return it == m_tag_names.end() ? 0 : it->second;
+    }
+
+    void detail::SubsystemLink::set_name(SubsystemMap & map, std::string const & name)
+    {
+        m_name_id = map.intern_name(name);
+        m_name = &map.name_of(m_name_id);
+    }
+
+    std::vector<SubsystemMetricsSnapshot> SubsystemMap::snapshot_metrics() const
+    {
+        std::vector<SubsystemMetricsSnapshot> ret;
+
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        ret.reserve(m_map.size());
+
+        for (auto & pair : m_map)
+        {
+            detail::SubsystemLink const & link = pair.second.get();
+            detail::SubsystemMetrics const * metrics = link.get_metrics();
+
+            ret.emplace_back();
+            SubsystemMetricsSnapshot & snap = ret.back();
+            snap.tag = link.get_tag();
+            snap.name_id = link.get_name_id();
+            snap.name = link.get_name();
+            snap.state = link.get_state();
+            snap.queue_depth = link.get_queue_depth();
+
+            if (WaitStats const * bus_wait = link.get_bus_wait_stats())
+                for (std::size_t i = 0; i < snap.bus_wait_phases.size(); ++i)
+                    snap.bus_wait_phases[i] = bus_wait->load(static_cast<WaitPhase>(i));
+
+            if (!metrics)
+                continue;
+
+            snap.messages_in = metrics->messages_in.load();
+            snap.messages_out = metrics->messages_out.load();
+            metrics->queue_latency.snapshot(snap.queue_latency);
+            metrics->commit_wait.snapshot(snap.commit_wait);
+
+            for (std::size_t i = 0; i < snap.commit_wait_phases.size(); ++i)
+                snap.commit_wait_phases[i] = metrics->commit_wait_phases.load(static_cast<WaitPhase>(i));
+
+            for (std::size_t i = 0; i < snap.handler_time.size(); ++i)
+                metrics->handler_time[i].snapshot(snap.handler_time[i]);
+
+            for (std::size_t i = 0; i < snap.errors.size(); ++i)
+                snap.errors[i] = metrics->errors.load(static_cast<SubsystemError>(i));
+
+            for (std::size_t i = 0; i < snap.deadline_misses.size(); ++i)
+                snap.deadline_misses[i] = metrics->deadline_misses.load(static_cast<SubsystemState>(i));
+        }
+
+        return ret;
+    }
+
+    SubsystemBatch::SubsystemBatch(SubsystemMap & map, std::uint32_t expected) :
+        m_map(map),
+        m_next(0),
+        m_end(0),
+        m_block_size(expected ? expected : 1)
+    {
+        m_pending.reserve(expected);
+    }
+
+    SubsystemBatch::~SubsystemBatch()
+    {
+        /* never publish from here: subsystems declared after the batch are
+         * already destroyed, and an unwind must not commit half a graph */
+        if (!m_pending.empty() || !m_live_edges.empty())
+            std::fprintf(stderr, "SubsystemBatch: %zu subsystems and %zu edges were never committed, discarded\n",
+                         m_pending.size(), m_live_edges.size());
+    }
+
+    SubsystemTag SubsystemBatch::next_tag()
+    {
+        if (m_next == m_end) {
+            m_next = SubsystemMap::reserve_subsystem_tags(m_block_size);
+            m_end = m_next + m_block_size;
+            m_blocks.emplace_back(m_next, m_end);
+        }
+
+        return m_next++;
+    }
+
+    bool SubsystemBatch::is_pending(SubsystemTag tag) const
+    {
+        for (auto & block : m_blocks)
+            if (tag >= block.first && tag < block.second)
+                return true;
+        return false;
+    }
+
+    void SubsystemBatch::enlist(detail::SubsystemLink & link)
+    {
+        m_pending.emplace_back(link.get_tag(), std::ref(link));
+    }
+
+    void SubsystemBatch::link(detail::SubsystemLink & parent, detail::SubsystemLink & child)
+    {
+        child.m_parents.insert(parent.get_tag());
+
+        if (is_pending(parent.get_tag()))
+            parent.m_children.insert(child.get_tag());
+        else
+            m_live_edges.emplace_back(std::ref(parent), std::ref(child));
+    }
+
+    void SubsystemBatch::commit()
+    {
+        if (m_pending.empty() && m_live_edges.empty())
+            return;
+
+        for (auto & entry : m_pending)
+            entry.second.get().refresh_snapshot();
+
+        m_map.put(m_pending);
+
+        /* live parents may message their new children right away, which is
+         * why this waits for the publish */
+        for (auto & edge : m_live_edges)
+            edge.first.get().add_child(edge.second.get());
+
+        m_pending.clear();
+        m_live_edges.clear();
+
+        /* what is left of the current block belongs to the next commit */
+        m_blocks.clear();
+        if (m_next != m_end)
+            m_blocks.emplace_back(m_next, m_end);
+    }
+
+    namespace detail
+    {
+        int configure_thread(std::string const & name, ThreadedSubsystemOptions const & options)
+        {
+            int error = 0;
+
+            if (options.set_name) {
+                /* the kernel keeps 15 characters */
+                std::string shortened = name.substr(0, 15);
+                if (int ret = ::pthread_setname_np(::pthread_self(), shortened.c_str()))
+                    error = ret;
+            }
+
+            std::vector<unsigned> cpus = options.cpus;
+
+            if (cpus.empty() && options.numa_node >= 0)
+                cpus = numa::node_cpus(options.numa_node);
+
+            if (!cpus.empty()) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+
+                for (unsigned cpu : cpus)
+                    if (cpu < CPU_SETSIZE)
+                        CPU_SET(cpu, &set);
+
+                if (int ret = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set))
+                    error = ret;
+            }
+
+            if (options.sched_policy >= 0) {
+                struct sched_param param;
+                param.sched_priority = options.sched_priority;
+
+                if (int ret = ::pthread_setschedparam(::pthread_self(), options.sched_policy, &param))
+                    error = ret;
+            }
+
+            /* nice is per thread on Linux, addressed by tid */
+            if (options.nice != 0) {
+                id_t tid = static_cast<id_t>(::syscall(SYS_gettid));
+                if (::setpriority(PRIO_PROCESS, tid, options.nice) != 0)
+                    error = errno;
+            }
+
+            return error;
+        }
+    } /* end namespace detail */
+
+    SubsystemThreadGroup::SubsystemThreadGroup(std::string const & name, ThreadedSubsystemOptions const & options)
+    {
+        m_thread = std::thread{[this, name, options] () { run(name, options); }};
+    }
+
+    SubsystemThreadGroup::~SubsystemThreadGroup()
+    {
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+            m_stop = true;
+        }
+
+        m_signal.notify_all();
+        m_thread.join();
+    }
+
+    void SubsystemThreadGroup::schedule(detail::Schedulable & member)
+    {
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+            m_ready.push_back(&member);
+        }
+
+        m_signal.notify_all();
+    }
+
+    void SubsystemThreadGroup::remove(detail::Schedulable & member)
+    {
+        std::unique_lock<decltype(m_lock)> lk{m_lock};
+
+        m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), &member), m_ready.end());
+        m_signal.wait(lk, [this, &member] { return m_running != &member; });
+        /* a slice that ran out of budget queued the member again */
+        m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), &member), m_ready.end());
+    }
+
+    void SubsystemThreadGroup::run(std::string const & name, ThreadedSubsystemOptions const & options)
+    {
+        (void)detail::configure_thread(name, options);
+
+        std::unique_lock<decltype(m_lock)> lk{m_lock};
+
+        for (;;)
+        {
+            m_signal.wait(lk, [this] { return m_stop || !m_ready.empty(); });
+
+            if (m_ready.empty())
+                return;
+
+            m_running = m_ready.front();
+            m_ready.pop_front();
+
+            lk.unlock();
+            bool again = m_running->run_slice();
+            lk.lock();
+
+            /* out of budget, behind everyone already waiting */
+            if (again)
+                m_ready.push_back(m_running);
+
+            m_running = nullptr;
+            /* wake remove() */
+            m_signal.notify_all();
+        }
+    }
+
+    std::size_t SubsystemMap::snapshot(SubsystemSnapshot * out, std::size_t capacity) const
+    {
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        std::size_t i = 0;
+
+        for (auto & pair : m_map)
+        {
+            if (i < capacity)
+                pair.second.get().read_snapshot(out[i]);
+            ++i;
+        }
+
+        return i;
+    }
+
+    std::size_t SubsystemMap::find_stalls(std::uint64_t min_busy_ns, SubsystemStall * out, std::size_t capacity) const
+    {
+        std::uint64_t now = detail::now_ns();
+        std::lock_guard<decltype(m_lock)> lk{m_lock};
+        std::size_t i = 0;
+
+        for (auto & pair : m_map)
+        {
+            detail::SubsystemLink const & link = pair.second.get();
+            detail::SubsystemMetrics const * metrics = link.get_metrics();
+            SubsystemStall stall;
+
+            if (!metrics || !metrics->heartbeat.read(stall) || stall.since_ns > now ||
+                now - stall.since_ns < min_busy_ns)
+                continue;
+
+            stall.tag = link.get_tag();
+            stall.name_id = link.get_name_id();
+            stall.busy_ns = now - stall.since_ns;
+
+            if (i < capacity)
+                out[i] = stall;
+            ++i;
+        }
+
+        return i;
+    }
+
+    namespace
+    {
+        /**
+         * @brief snprintf at offset, keeps counting once buffer is full
+         */
+        template<typename... Args>
+            void append(char * buffer, std::size_t size, std::size_t & offset, char const * fmt, Args... args)
+            {
+                char * dst = offset < size ? buffer + offset : nullptr;
+                std::size_t room = offset < size ? size - offset : 0;
+                int n = std::snprintf(dst, room, fmt, args...);
+                if (n > 0)
+                    offset += static_cast<std::size_t>(n);
+            }
+
+        void append_edges(char * buffer, std::size_t size, std::size_t & offset,
+                          std::uint32_t const * tags, std::uint16_t count)
+        {
+            std::size_t kept = count < sizes::snapshot_max_edges ? count : sizes::snapshot_max_edges;
+
+            for (std::size_t i = 0; i < kept; ++i)
+                append(buffer, size, offset, i ? ",%08x" : "%08x", tags[i]);
+
+            if (count > kept)
+                append(buffer, size, offset, ",+%u", static_cast<unsigned>(count - kept));
+        }
+
+        void put_u16(char * & p, std::uint16_t v)
+        {
+            *p++ = static_cast<char>(v & 0xff);
+            *p++ = static_cast<char>(v >> 8);
+        }
+
+        void put_u32(char * & p, std::uint32_t v)
+        {
+            put_u16(p, static_cast<std::uint16_t>(v & 0xffff));
+            put_u16(p, static_cast<std::uint16_t>(v >> 16));
+        }
+    }
+
+    std::size_t format_snapshot_text(SubsystemSnapshot const * entries, std::size_t count,
+                                     char * buffer, std::size_t size)
+    {
+        std::size_t offset = 0;
+
+        if (size)
+            buffer[0] = '\0';
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            SubsystemSnapshot const & e = entries[i];
+
+            append(buffer, size, offset, "%08x %-*s %-7s queue=%u parents=[",
+                   e.tag, static_cast<int>(sizes::snapshot_name_length - 1), e.name,
+                   state_name(e.state), e.queue_depth);
+            append_edges(buffer, size, offset, e.parents, e.parent_count);
+            append(buffer, size, offset, "] children=[");
+            append_edges(buffer, size, offset, e.children, e.child_count);
+            append(buffer, size, offset, "]\n");
+        }
+
+        return offset;
+    }
+
+    std::size_t format_snapshot_binary(SubsystemSnapshot const * entries, std::size_t count,
+                                       char * buffer, std::size_t size)
+    {
+        std::size_t needed = snapshot_binary_header_size + count * snapshot_binary_record_size;
+
+        if (size < needed)
+            return 0;
+
+        char * p = buffer;
+
+        std::memcpy(p, "SSNP", 4);
+        p += 4;
+        put_u16(p, 1);
+        put_u16(p, static_cast<std::uint16_t>(snapshot_binary_record_size));
+        put_u32(p, static_cast<std::uint32_t>(count));
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            SubsystemSnapshot const & e = entries[i];
+
+            put_u32(p, e.tag);
+            *p++ = static_cast<char>(e.state);
+            *p++ = 0;
+            put_u16(p, e.parent_count);
+            put_u16(p, e.child_count);
+            put_u16(p, 0);
+            put_u32(p, e.queue_depth);
+
+            for (std::size_t j = 0; j < sizes::snapshot_max_edges; ++j)
+                put_u32(p, e.parents[j]);
+
+            for (std::size_t j = 0; j < sizes::snapshot_max_edges; ++j)
+                put_u32(p, e.children[j]);
+
+            std::memcpy(p, e.name, sizes::snapshot_name_length);
+            p += sizes::snapshot_name_length;
+        }
+
+        return needed;
     }
 
-#ifndef NDEBUG
     std::ostream & operator<< (std::ostream & str, SubsystemMap const & m)
     {
         std::lock_guard<decltype(SubsystemMap::m_lock)> lk{m.m_lock};
 
         for (auto & pair : m.m_map)
         {
+            SubsystemSnapshot entry;
+            pair.second.get().read_snapshot(entry);
+
             str << "SubsystemMap Entry -------\n"
-                << " KEY   : " << std::to_string(pair.first) << std::endl
-                << " STATE : " << StateNameStrings[static_cast<int>(pair.second.get().get_state())] << std::endl
-                << "  NAME : " << pair.second.get().get_name().c_str() << std::endl;
+                << " KEY   : " << entry.tag << '\n'
+                << " STATE : " << state_name(entry.state) << '\n'
+                << "  NAME : " << entry.name << '\n';
         }
 
         return str;
     }
-#endif
 
 } // end namespace management
 
@@ -2,25 +2,24 @@
 #define _SUBSYSTEM_HH_3735928559_
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <initializer_list>
 #include <mutex>
 #include <set>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
-/* Comment this out to not use/throw exceptions */
-#define SUBSYSTEM_USE_EXCEPTIONS
-
-/* Allows subsystems to transmit more than just SubsystemIPC messages
- * See SubsystemIPC_Extended
- */
-#define SUBSYSTEM_HAS_BOOST
+#include "subsystem_config.hh"
 
 #ifdef SUBSYSTEM_USE_EXCEPTIONS
 #include <stdexcept>
@@ -30,10 +29,15 @@
 #include <boost/variant.hpp>
 #endif
 
-#ifndef NDEBUG
 #include <iosfwd>
-#endif
 
+#include "subsystem_memory.hh"
+#include "subsystem_metrics.hh"
+#include "subsystem_snapshot.hh"
+#include "multilane_queue.hh"
+#include "numa_queue.hh"
+#include "spsc_queue.hh"
+#include "subsystem_trace.hh"
 #include "threadsafe_queue.hh"
 
 /**
@@ -41,7 +45,6 @@
  * @author Anthony Clark <clark.anthony.g@gmail.com>
  *
  * TODO
- * - Fix deadlock caused by not using sleeps... this is a big one folks
  * - Remove SubsystemLink
  * - Constructor (it's just gross currently)
  * - Remove dependency on threadsafe_queue
@@ -53,6 +56,8 @@
 namespace sizes
 {
     constexpr const std::size_t default_max_subsystem_count = 16;
+    /**< Removed tags a SubsystemMap keeps naming, oldest forgotten first */
+    constexpr const std::size_t retired_tag_names = 1024;
 }
 
 namespace management
@@ -65,6 +70,12 @@ namespace management
     /** */
     using SubsystemTag = std::uint32_t;
 
+    /**< Index into a SubsystemMap's name table, 0 is the empty name */
+    using SubsystemNameId = std::uint32_t;
+
+    /* Forward */
+    class SubsystemMap;
+
     /* Convenience alias */
     using SubsystemParentsList = std::initializer_list<std::reference_wrapper<detail::SubsystemLink>>;
 
@@ -75,15 +86,100 @@ namespace management
         INIT = 0, RUNNING , STOPPED , ERROR , DESTROY
     };
 
+    /**< Per-originator message sequence number, wraps */
+    using SubsystemSeq = std::uint16_t;
+
     /**
      * @brief Simple structure containing primitives to carry state
      *   changes.
+     * @details Packed into 8 bytes, widest field first, so it travels in a
+     *          single register and leaves room for the bus' own bookkeeping
+     *          in the same cache line.
      */
     struct SubsystemIPC
     {
-        enum { PARENT, CHILD, SELF } from; /**< originator */
+        enum Origin : std::uint8_t { PARENT, CHILD, SELF };
+
         SubsystemTag tag; /**< The tag of the originator */
         SubsystemState state; /**< The new state of the originator */
+        Origin from; /**< originator */
+        SubsystemSeq seq; /**< Per-originator sequence number, ties a send to its handling */
+
+        SubsystemIPC() noexcept :
+            tag(0), state(SubsystemState::INIT), from(SELF), seq(0)
+        { }
+
+        SubsystemIPC(Origin f, SubsystemTag t, SubsystemState s, SubsystemSeq q = 0) noexcept :
+            tag(t), state(s), from(f), seq(q)
+        { }
+    };
+
+    static_assert(sizeof(SubsystemIPC) == 8, "SubsystemIPC must stay packed");
+
+    static_assert(static_cast<std::size_t>(SubsystemState::DESTROY) + 1 == sizes::subsystem_state_count,
+                  "sizes::subsystem_state_count is out of date");
+
+    /**
+     * @brief What commit_state does when its parents miss a deadline
+     */
+    enum class DeadlinePolicy : std::uint8_t {
+        /**< Commit the new state anyway, without the parents */
+        PROCEED = 0,
+        /**< Keep the old state, the transition's hook does not run. Send the
+         * state again to retry. */
+        ABANDON,
+        /**< Go to ERROR instead, through on_error */
+        FAIL
+    };
+
+    /**
+     * @brief How long commit_state waits for its parents before a transition
+     */
+    struct TransitionDeadline
+    {
+        /**< Zero waits for as long as it takes */
+        std::chrono::milliseconds timeout;
+        DeadlinePolicy policy;
+
+        TransitionDeadline(std::chrono::milliseconds t = std::chrono::milliseconds{0},
+                           DeadlinePolicy p = DeadlinePolicy::PROCEED) :
+            timeout(t), policy(p)
+        { }
+    };
+
+    /**
+     * @brief A TransitionDeadline per target state, none set by default
+     */
+    class TransitionDeadlines
+    {
+    private:
+        std::array<TransitionDeadline, sizes::subsystem_state_count> m_deadlines;
+
+    public:
+        /**
+         * @brief Sets the deadline of transitions to state to
+         */
+        TransitionDeadlines & set(SubsystemState to, std::chrono::milliseconds timeout,
+                                  DeadlinePolicy policy = DeadlinePolicy::PROCEED)
+        {
+            m_deadlines[static_cast<std::size_t>(to)] = TransitionDeadline{timeout, policy};
+            return *this;
+        }
+
+        /**
+         * @brief Sets the same deadline for every transition
+         */
+        TransitionDeadlines & set_all(std::chrono::milliseconds timeout,
+                                      DeadlinePolicy policy = DeadlinePolicy::PROCEED)
+        {
+            m_deadlines.fill(TransitionDeadline{timeout, policy});
+            return *this;
+        }
+
+        TransitionDeadline const & get(SubsystemState to) const
+        {
+            return m_deadlines[static_cast<std::size_t>(to)];
+        }
     };
 
 #ifdef SUBSYSTEM_HAS_BOOST
@@ -99,6 +195,9 @@ namespace management
 
     namespace detail
     {
+        /**< Parent or child tags of a subsystem */
+        using SubsystemEdgeSet = std::set<SubsystemTag, std::less<SubsystemTag>, ResourceAllocator<SubsystemTag>>;
+
         /**
          * @brief Binding between subsystems.
          * @todo This should get reworked or removed. At least 'friend' it with
@@ -108,14 +207,24 @@ namespace management
         {
             /**< Subsystem UUID */
             SubsystemTag m_tag = 0;
-            /**< Subsystem Name */
-            std::string m_name = "";
+            /**< Subsystem Name, interned by a SubsystemMap, see set_name */
+            std::string const * m_name = &no_name();
+            /**< Id of m_name in that map's name table */
+            SubsystemNameId m_name_id = 0;
             /**< Current subsystem state */
             SubsystemState m_state = SubsystemState::INIT;
             /**< Current parent tags */
-            std::set<SubsystemTag> m_parents;
+            SubsystemEdgeSet m_parents;
             /**< Current child tags */
-            std::set<SubsystemTag> m_children;
+            SubsystemEdgeSet m_children;
+
+            /**
+             * @param resource Where the edge sets are allocated
+             */
+            explicit SubsystemLink(MemoryResource * resource = new_delete_resource()) :
+                m_parents(std::less<SubsystemTag>(), resource),
+                m_children(std::less<SubsystemTag>(), resource)
+            { }
 
             virtual ~SubsystemLink() = default;
             virtual void add_child(SubsystemLink & child) = 0;
@@ -124,11 +233,254 @@ namespace management
             virtual void remove_parent(SubsystemTag tag) = 0;
             virtual void put_message(SubsystemIPC msg) = 0;
 
+            /**
+             * @return Instrumentation of this subsystem, nullptr if it has none
+             */
+            virtual SubsystemMetrics const * get_metrics() const { return nullptr; }
+
+            /**
+             * @return Wait phase counters of this subsystem's bus, nullptr if
+             *         the bus does not keep them
+             */
+            virtual WaitStats const * get_bus_wait_stats() const { return nullptr; }
+
+            /**
+             * @return Number of messages waiting on this subsystem's bus
+             */
+            virtual std::size_t get_queue_depth() const { return 0; }
+
+            /**
+             * @brief Republishes what read_snapshot reports, after edges were
+             *        changed behind this subsystem's back (see SubsystemBatch)
+             */
+            virtual void refresh_snapshot() { }
+
+            /**
+             * @brief Releases a commit_state that waits for its parents, as a
+             *        parent's DESTROY would. Used by the Watchdog.
+             */
+            virtual void interrupt() { }
+
+            /**
+             * @brief Copies this subsystem's topology without allocating
+             * @details The default only knows the tag, state and name.
+             */
+            virtual void read_snapshot(SubsystemSnapshot & out) const
+            {
+                out = SubsystemSnapshot{};
+                out.tag = m_tag;
+                out.state = m_state;
+                out.queue_depth = static_cast<std::uint32_t>(get_queue_depth());
+
+                out.name_id = m_name_id;
+
+                std::size_t n = std::min(m_name->size(), sizes::snapshot_name_length - 1);
+                m_name->copy(out.name, n);
+                out.name[n] = '\0';
+            }
+
+            /**
+             * @brief Interns name in map's name table and takes it as this subsystem's name
+             * @details Only call before this subsystem is shared with other threads.
+             */
+            void set_name(SubsystemMap & map, std::string const & name);
+
+            /**
+             * @return The empty name, for links that were never named
+             */
+            static std::string const & no_name()
+            {
+                static std::string const empty;
+                return empty;
+            }
+
             decltype(m_tag) get_tag() const { return m_tag; }
-            decltype(m_name) get_name() const { return m_name; }
+            std::string const & get_name() const { return *m_name; }
+            decltype(m_name_id) get_name_id() const { return m_name_id; }
             decltype(m_state) get_state() const { return m_state; }
         };
 
+        /**
+         * @return The SubsystemIPC carried by a bus message
+         */
+        inline SubsystemIPC const * message_ipc(SubsystemIPC const & msg)
+        {
+            return &msg;
+        }
+
+        /**
+         * @return nullptr, any other bus message carries no SubsystemIPC
+         */
+        template<typename T>
+            SubsystemIPC const * message_ipc(T const &)
+            {
+                return nullptr;
+            }
+
+#ifdef SUBSYSTEM_HAS_BOOST
+        /**
+         * @return The SubsystemIPC alternative of an extended message, if it holds one
+         */
+        template<typename... Ts>
+            SubsystemIPC const * message_ipc(boost::variant<Ts...> const & msg)
+            {
+                return boost::get<SubsystemIPC>(&msg);
+            }
+#endif
+
+        /**
+         * @return Kind of a bus message
+         */
+        template<typename T>
+            MessageKind message_kind(T const & msg)
+            {
+                SubsystemIPC const * ipc = message_ipc(msg);
+
+                if (!ipc)
+                    return MessageKind::EXTENDED;
+
+                switch(ipc->from)
+                {
+                case SubsystemIPC::PARENT: return MessageKind::PARENT;
+                case SubsystemIPC::CHILD: return MessageKind::CHILD;
+                case SubsystemIPC::SELF: return MessageKind::SELF;
+                default: return MessageKind::EXTENDED;
+                }
+            }
+
+        /**
+         * @brief Pops a bus item along with its enqueue time, if the Bus records it
+         */
+        template<typename B>
+            auto bus_wait_and_pop(B & bus, std::uint64_t & enqueued_ns, int)
+                -> decltype(bus.wait_and_pop(std::declval<typename B::time_point &>()))
+            {
+                typename B::time_point enqueued;
+                auto item = bus.wait_and_pop(enqueued);
+                enqueued_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                enqueued.time_since_epoch()).count());
+                return item;
+            }
+
+        /**
+         * @brief Fallback for buses without enqueue times, the latency reads as zero
+         */
+        template<typename B>
+            auto bus_wait_and_pop(B & bus, std::uint64_t & enqueued_ns, long)
+                -> decltype(bus.wait_and_pop())
+            {
+                auto item = bus.wait_and_pop();
+                enqueued_ns = now_ns();
+                return item;
+            }
+
+        /**
+         * @brief Pops a bus item, waiting at most timeout
+         * @return T, if item was set; F, on timeout
+         */
+        template<typename B, typename I>
+            auto bus_wait_and_pop_for(B & bus, std::chrono::nanoseconds timeout, I & item,
+                                      std::uint64_t & enqueued_ns, int)
+                -> decltype(bus.wait_and_pop_for(timeout, item, std::declval<typename B::time_point &>()))
+            {
+                typename B::time_point enqueued;
+
+                if (!bus.wait_and_pop_for(timeout, item, enqueued))
+                    return false;
+
+                enqueued_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                enqueued.time_since_epoch()).count());
+                return true;
+            }
+
+        /**
+         * @brief Fallback for buses without a timed pop, never times out
+         */
+        template<typename B, typename I>
+            bool bus_wait_and_pop_for(B & bus, std::chrono::nanoseconds, I & item,
+                                      std::uint64_t & enqueued_ns, long)
+            {
+                item = bus_wait_and_pop(bus, enqueued_ns, 0);
+                return true;
+            }
+
+        /**
+         * @brief Moves a bus to a NUMA node, if it supports that
+         */
+        template<typename B>
+            auto bus_set_home_node(B & bus, int node, int) -> decltype(bus.set_home_node(node))
+            {
+                return bus.set_home_node(node);
+            }
+
+        /**
+         * @brief Fallback for buses without placement
+         */
+        template<typename B>
+            void bus_set_home_node(B &, int, long) { }
+
+        /**
+         * @brief Moves a bus's allocations to resource, if it supports that
+         */
+        template<typename B>
+            auto bus_set_memory_resource(B & bus, MemoryResource * resource, int)
+                -> decltype(bus.set_memory_resource(resource))
+            {
+                return bus.set_memory_resource(resource);
+            }
+
+        /**
+         * @brief Fallback for buses that manage their own memory
+         */
+        template<typename B>
+            void bus_set_memory_resource(B &, MemoryResource *, long) { }
+
+        /**
+         * @brief Switches a bus to global delivery order, if it supports that
+         */
+        template<typename B>
+            auto bus_set_global_order(B & bus, bool value, int) -> decltype(bus.set_global_order(value))
+            {
+                return bus.set_global_order(value);
+            }
+
+        /**
+         * @brief Fallback for buses that only have one order
+         */
+        template<typename B>
+            void bus_set_global_order(B &, bool, long) { }
+
+        /**
+         * @brief Sets the consumer wait strategy of a bus, if it has one
+         */
+        template<typename B>
+            auto bus_set_wait_strategy(B & bus, WaitStrategy const & strategy, int)
+                -> decltype(bus.set_wait_strategy(strategy))
+            {
+                return bus.set_wait_strategy(strategy);
+            }
+
+        /**
+         * @brief Fallback for buses that always park
+         */
+        template<typename B>
+            void bus_set_wait_strategy(B &, WaitStrategy const &, long) { }
+
+        /**
+         * @return The wait phase counters of a bus
+         */
+        template<typename B>
+            auto bus_wait_stats(B const & bus, int) -> decltype(&bus.wait_stats())
+            {
+                return &bus.wait_stats();
+            }
+
+        /**
+         * @brief Fallback for buses without counters
+         */
+        template<typename B>
+            WaitStats const * bus_wait_stats(B const &, long) { return nullptr; }
+
     } /* end namespace detail */
 
     namespace helpers
@@ -168,8 +520,25 @@ namespace management
                 }
         };
 #endif
+
+        /**
+         * @brief Marks a CRTP dispatch target whose on_* hooks are called by
+         *        name instead of through the vtable, see StaticSubsystem
+         * @details The target has to be the most derived class, an override
+         *          further down is never called.
+         */
+        struct static_hooks { };
     } /* end namespace helpers */
 
+    namespace detail
+    {
+        /**
+         * @brief T, if D is a static_hooks dispatch target
+         */
+        template<typename D>
+            struct has_static_hooks : std::is_base_of<helpers::static_hooks, D> { };
+    } /* end namespace detail */
+
     /**
      * @brief Basic proxy access to the shared state of all subsystems.
      * @details Having a 'global' map of subsystems complicates access, but reduces
@@ -184,7 +553,9 @@ namespace management
          */
         using SubsystemMapType = std::unordered_map<
                     SubsystemTag,
-                    std::reference_wrapper<detail::SubsystemLink>, std::hash<SubsystemTag>
+                    std::reference_wrapper<detail::SubsystemLink>, std::hash<SubsystemTag>,
+                    std::equal_to<SubsystemTag>,
+                    ResourceAllocator<std::pair<SubsystemTag const, std::reference_wrapper<detail::SubsystemLink>>>
                 >;
     public:
         /* alias */
@@ -194,22 +565,62 @@ namespace management
     private:
         /**< Max number of subsystems */
         std::uint32_t m_max_subsystems;
+        /**< Where the map and its subsystems allocate */
+        MemoryResource * m_resource;
         /**< Managed state map */
         SubsystemMapType m_map;
         /** RW lock */
         mutable std::mutex m_lock;
 
+        /**< Hashes interned names through the pointer */
+        struct name_hash {
+            std::size_t operator()(std::string const * s) const { return std::hash<std::string>{}(*s); }
+        };
+        struct name_equal {
+            bool operator()(std::string const * a, std::string const * b) const { return *a == *b; }
+        };
+
+        /**< Interned names by id, a deque never moves its elements */
+        std::deque<std::string, ResourceAllocator<std::string>> m_names;
+        /**< Id of each interned name */
+        std::unordered_map<std::string const *, SubsystemNameId, name_hash, name_equal,
+                           ResourceAllocator<std::pair<std::string const * const, SubsystemNameId>>> m_name_ids;
+        /**< Name id of every mapped tag, guarded by m_lock. Kept after remove
+         * for the last sizes::retired_tag_names tags, so trace dumps still
+         * name subsystems that are gone */
+        std::unordered_map<SubsystemTag, SubsystemNameId, std::hash<SubsystemTag>, std::equal_to<SubsystemTag>,
+                           ResourceAllocator<std::pair<SubsystemTag const, SubsystemNameId>>> m_tag_names;
+        /**< Removed tags still in m_tag_names, oldest first, guarded by m_lock */
+        std::deque<SubsystemTag, ResourceAllocator<SubsystemTag>> m_retired_tags;
+        /**< Guards m_names and m_name_ids, taken after m_lock if both are */
+        mutable std::mutex m_names_lock;
+
     public:
         /**
          * @return A unique tag for each subsystem
          */
         static SubsystemTag generate_subsystem_tag();
 
+        /**
+         * @brief Reserves count consecutive tags with a single atomic add
+         * @return The first tag of the block
+         */
+        static SubsystemTag reserve_subsystem_tags(std::uint32_t count);
+
     public:
         /**
          * @brief Binding constructor
+         * @param max_subsystems Expected number of subsystems
+         * @param resource Where the map and the subsystems built on it allocate,
+         *        has to outlive both. See subsystem_memory.hh
+         */
+        explicit SubsystemMap(std::uint32_t max_subsystems = sizes::default_max_subsystem_count,
+                              MemoryResource * resource = new_delete_resource()) noexcept;
+
+        /**
+         * @return Where the map and its subsystems allocate
          */
-        explicit SubsystemMap(std::uint32_t max_subsystems = sizes::default_max_subsystem_count) noexcept;
+        MemoryResource * memory_resource() const { return m_resource; }
 
         /**
          * @brief Destructor
@@ -229,6 +640,22 @@ namespace management
          */
         value_type get(key_type key);
 
+        /**
+         * @brief Tests if an element is currently mapped
+         * @param key The lookup
+         * @return T, if key is present; F, otherwise
+         */
+        bool contains(key_type key) const;
+
+        /**
+         * @brief Looks up a mapped subsystem without copying it
+         * @details The pointer is only valid while that subsystem lives.
+         * @param key The lookup
+         * @return The subsystem, or nullptr if key is not mapped
+         */
+        detail::SubsystemLink const * find(key_type key) const;
+        detail::SubsystemLink * find(key_type key);
+
         /**
          * @brief Proxy for insertion into the map via .insert
          * @param key The tag to update
@@ -236,17 +663,174 @@ namespace management
          */
         void put(key_type key, value_type value);
 
-#ifndef NDEBUG
+        /**
+         * @brief Inserts many entries under a single lock
+         * @param entries The tags and subsystems to insert
+         */
+        void put(std::vector<std::pair<key_type, value_type>> const & entries);
+
+        /**
+         * @brief Copies the metrics of every mapped subsystem
+         * @details Only the map itself is locked, subsystems keep running while
+         *          their counters are read.
+         * @return One entry per subsystem
+         */
+        std::vector<SubsystemMetricsSnapshot> snapshot_metrics() const;
+
+        /**
+         * @brief Copies the topology of every mapped subsystem
+         * @details Allocation free. The map lock is held for the copy only, each
+         *          subsystem is read through its seqlock and never blocked.
+         * @param out Caller provided entries
+         * @param capacity Number of entries in out
+         * @return Number of mapped subsystems, only min(capacity, return) were written
+         */
+        std::size_t snapshot(SubsystemSnapshot * out, std::size_t capacity) const;
+
+        /**
+         * @brief Lists subsystems whose worker has been busy for long
+         * @details Allocation free, reads each heartbeat without blocking it.
+         * @param min_busy_ns Report workers busy at least this long
+         * @param out Caller provided entries
+         * @param capacity Number of entries in out
+         * @return Number of such subsystems, only min(capacity, return) were written
+         */
+        std::size_t find_stalls(std::uint64_t min_busy_ns, SubsystemStall * out, std::size_t capacity) const;
+
+        /**
+         * @brief Calls f with a mapped subsystem, which cannot go away meanwhile
+         * @details f runs under the map lock, it must not call back into the map.
+         * @param key The lookup
+         * @param f Called with detail::SubsystemLink &
+         * @return F, if key is not mapped
+         */
+        template<typename F>
+            bool visit(key_type key, F && f)
+            {
+                std::lock_guard<decltype(m_lock)> lk{m_lock};
+                auto it = m_map.find(key);
+
+                if (it == m_map.end())
+                    return false;
+
+                f(it->second.get());
+                return true;
+            }
+
+        /**
+         * @brief Adds a name to the name table, once
+         * @details Interned names live as long as the map. Subsystems sharing
+         *          a name share its entry, so the table grows with the number
+         *          of distinct names, not with subsystems created.
+         * @param name The name
+         * @return Its id
+         */
+        SubsystemNameId intern_name(std::string const & name);
+
+        /**
+         * @param id From intern_name
+         * @return The interned name, the empty name for an unknown id
+         */
+        std::string const & name_of(SubsystemNameId id) const;
+
+        /**
+         * @brief Names a tag, also after its subsystem was removed
+         * @details Only the last sizes::retired_tag_names removed tags are
+         *          remembered.
+         * @param key The tag
+         * @return Its name id, 0 if the tag was never put or is forgotten
+         */
+        SubsystemNameId name_id_of(key_type key) const;
+
         friend std::ostream & operator<< (std::ostream & s, SubsystemMap const & m);
-#endif
     };
 
-#ifndef NDEBUG
+    /**
+     * @brief Bulk construction of subsystem graphs
+     * @details Subsystems constructed with a batch draw their tags from a
+     *          reserved block, wire edges between each other without taking
+     *          any lock and stay invisible until commit(), which registers
+     *          all of them with one map publish. Edges to subsystems that are
+     *          already live are made at commit, after the publish.
+     *          Don't send messages to a pending subsystem. Nothing is
+     *          published without an explicit commit().
+     */
+    class SubsystemBatch final
+    {
+    private:
+        SubsystemMap & m_map;
+        /**< Remaining tags of the current block, [m_next, m_end) */
+        SubsystemTag m_next;
+        SubsystemTag m_end;
+        /**< Size of every reserved block */
+        std::uint32_t m_block_size;
+        /**< Tag blocks handed out since the last commit, [first, second) */
+        std::vector<std::pair<SubsystemTag, SubsystemTag>> m_blocks;
+        /**< Constructed but not yet published */
+        std::vector<std::pair<SubsystemMap::key_type, SubsystemMap::value_type>> m_pending;
+        /**< Parent, child pairs where the parent is already live */
+        std::vector<std::pair<SubsystemMap::value_type, SubsystemMap::value_type>> m_live_edges;
+
+        bool is_pending(SubsystemTag tag) const;
+
+    public:
+        /**
+         * @param map The map the subsystems will be published to
+         * @param expected Expected number of subsystems, sizes the first tag block
+         */
+        explicit SubsystemBatch(SubsystemMap & map, std::uint32_t expected = 64);
+
+        SubsystemBatch(SubsystemBatch const &) = delete;
+
+        /**
+         * @brief Discards whatever is still pending, reporting it on stderr
+         * @details Does not commit. Subsystems declared after the batch are
+         *          gone by now, and an unwinding error path must not publish
+         *          a half built graph.
+         */
+        ~SubsystemBatch();
+
+        /**
+         * @return The map subsystems of this batch are published to
+         */
+        SubsystemMap & map() { return m_map; }
+
+        /**
+         * @return The next tag of the reserved block
+         */
+        SubsystemTag next_tag();
+
+        /**
+         * @brief Records a constructed subsystem for the next commit
+         */
+        void enlist(detail::SubsystemLink & link);
+
+        /**
+         * @brief Links child under parent
+         * @details child must be pending. If parent is pending too both sides
+         *          are updated in place, otherwise the parent side waits for commit.
+         */
+        void link(detail::SubsystemLink & parent, detail::SubsystemLink & child);
+
+        /**
+         * @brief Publishes every pending subsystem, then links them to live parents
+         */
+        void commit();
+    };
+
     constexpr const char * StateNameStrings[] = {
         "INIT\0", "RUNNING\0", "STOPPED\0",
         "ERROR\0", "DESTROY\0",
     };
-#endif
+
+    /**
+     * @return Printable name of state
+     */
+    inline const char * state_name(SubsystemState state)
+    {
+        return static_cast<std::size_t>(state) < sizeof(StateNameStrings) / sizeof(StateNameStrings[0])
+            ? StateNameStrings[static_cast<std::size_t>(state)] : "?";
+    }
 
     /**
      * @brief Subsystem
@@ -269,8 +853,100 @@ namespace management
         Bus<T> m_bus;
         /**< The reference to the managing systemstate */
         SubsystemMap & m_subsystem_map_ref;
-        /**< State change signal */
+        /**< State change signal, paired with m_wake_mutex */
         std::condition_variable m_proceed_signal;
+        /**< Guards nothing but the sleep on m_proceed_signal, never held
+         * while taking another lock */
+        std::mutex m_wake_mutex;
+        /**< Bumped by everything that may make wait_for_parents() true */
+        std::atomic<std::uint32_t> m_wake_epoch;
+        /**< Set while commit_state sleeps on m_proceed_signal */
+        std::atomic_bool m_commit_parked;
+        /**< Instrumentation */
+        detail::SubsystemMetrics m_metrics;
+        /**< Sequence number stamped on every message this subsystem originates */
+        std::atomic<std::uint32_t> m_seq;
+        /**< Topology published for SubsystemMap::snapshot */
+        detail::SnapshotCell m_snapshot;
+        /**< Set when the message loop is not running and the next put_message
+         * has to start it, see start_worker */
+        std::atomic_bool m_worker_pending;
+        /**< Whether m_worker_pending is used at all, fixed at construction */
+        const bool m_lazy_worker;
+        /**< How commit_state waits for its parents */
+        WaitStrategy m_wait_strategy;
+        /**< How long commit_state waits for its parents, per target state */
+        TransitionDeadlines m_deadlines;
+
+        /**
+         * @brief Sets how the bus consumer and commit_state wait
+         * @details Call before the message loop runs.
+         */
+        void set_wait_strategy(WaitStrategy const & strategy)
+        {
+            m_wait_strategy = strategy;
+            detail::bus_set_wait_strategy(m_bus, strategy, 0);
+        }
+
+        /**
+         * @brief Sets how long commit_state waits for its parents
+         * @details Call before the message loop runs.
+         */
+        void set_deadlines(TransitionDeadlines const & deadlines)
+        {
+            m_deadlines = deadlines;
+        }
+
+        /**
+         * @brief Starts the message loop of a lazily started subsystem
+         * @details Called by the producer that cleared m_worker_pending.
+         */
+        virtual void start_worker() { }
+
+        /**
+         * @brief Hands the job of starting the message loop to the next put_message
+         * @return T, if a message is already waiting and the caller keeps the job
+         */
+        bool release_worker()
+        {
+            m_worker_pending.store(true, std::memory_order_relaxed);
+
+            /* Pairs with the fence in wake_worker(). Either we see the message a
+             * producer just pushed, or that producer sees the flag. */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            return m_bus.size() != 0 && m_worker_pending.exchange(false, std::memory_order_acq_rel);
+        }
+
+        /**
+         * @brief Starts the message loop after a push, if nobody runs it
+         */
+        void wake_worker()
+        {
+            if (!m_lazy_worker)
+                return;
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (m_worker_pending.load(std::memory_order_relaxed) &&
+                m_worker_pending.exchange(false, std::memory_order_acq_rel))
+                start_worker();
+        }
+
+        /**
+         * @brief Republishes tag, state and edges
+         * @details Call with m_state_change_mutex held.
+         */
+        void publish_snapshot() {
+            m_snapshot.publish(m_tag, m_state, m_parents, m_children);
+        }
+
+        /**
+         * @return A fresh sequence number
+         */
+        SubsystemSeq next_seq() {
+            return static_cast<SubsystemSeq>(m_seq.fetch_add(1, std::memory_order_relaxed) + 1);
+        }
 
     private:
         /**
@@ -283,6 +959,7 @@ namespace management
              * ie - m_parents->add_child(this) */
             std::lock_guard<lock_t> lk{m_state_change_mutex};
             m_children.insert(child.get_tag());
+            publish_snapshot();
         }
 
         /**
@@ -293,6 +970,7 @@ namespace management
         {
             std::lock_guard<lock_t> lk(m_state_change_mutex);
             m_parents.insert(parent.get_tag());
+            publish_snapshot();
         }
 
         /**
@@ -303,6 +981,7 @@ namespace management
         {
             std::lock_guard<lock_t> lk{m_state_change_mutex};
             m_children.erase(tag);
+            publish_snapshot();
         }
 
         /**
@@ -313,6 +992,7 @@ namespace management
         {
             std::lock_guard<lock_t> lk{m_state_change_mutex};
             m_parents.erase(tag);
+            publish_snapshot();
         }
 
         /**
@@ -338,10 +1018,14 @@ namespace management
                     ret = true;
                 }
                 else {
+                    /* a parent gone from the map counts as destroyed, its DESTROY
+                     * message raises the cancellation flag */
                     ret = std::all_of(m_parents.begin(), m_parents.end(),
                                       [this] (SubsystemTag const & p) {
-                                          auto subsys = m_subsystem_map_ref.get(p);
-                                          auto state = subsys.get().get_state();
+                                          detail::SubsystemLink const * parent = m_subsystem_map_ref.find(p);
+                                          if (!parent)
+                                              return false;
+                                          auto state = parent->get_state();
                                           return (state != SubsystemState::INIT && state != SubsystemState::DESTROY);
                                       });
                 }
@@ -357,16 +1041,24 @@ namespace management
          */
         void put_message(SubsystemIPC msg) override
         {
+            /* a neighbour may still fan out to us while we shut down */
             if (m_state == SubsystemState::DESTROY) {
-#ifdef SUBSYSVTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Attempting to call put_message after m_state == DESTROY");
-#else
+                m_metrics.errors.record(SubsystemError::AFTER_DESTROY);
                 return;
-#endif
             }
 
+            /* A destroyed parent never becomes ready again. Release a commit_state()
+             * that is currently waiting on it, the DESTROY itself is handled next. */
+            if (msg.from == SubsystemIPC::PARENT && msg.state == SubsystemState::DESTROY)
+                set_cancel_flag(true);
+
+            trace::record(trace::EventType::PUT_MESSAGE, trace::Phase::FLOW_START, m_tag,
+                          msg.state, trace::flow_id(msg.tag, msg.seq, m_tag));
+
+            m_metrics.messages_in.add();
             m_bus.push(msg);
-            m_proceed_signal.notify_one();
+            wake_commit();
+            wake_worker();
         }
 
         /**
@@ -379,10 +1071,12 @@ namespace management
             {
                 for (auto & p : m_parents)
                 {
-                    auto subsys = m_subsystem_map_ref.get(p);
+                    detail::SubsystemLink * subsys = m_subsystem_map_ref.find(p);
 
-                    if (subsys.get().get_state() == SubsystemState::RUNNING)
-                        runnable(subsys);
+                    if (!subsys)
+                        m_metrics.errors.record(SubsystemError::UNKNOWN_TAG);
+                    else if (subsys->get_state() == SubsystemState::RUNNING)
+                        runnable(*subsys);
                 }
             }
 
@@ -396,18 +1090,21 @@ namespace management
             {
                 for (auto & c : m_children)
                 {
-                    auto subsys = m_subsystem_map_ref.get(c);
+                    detail::SubsystemLink * subsys = m_subsystem_map_ref.find(c);
 
-                    if (subsys.get().get_state() != SubsystemState::DESTROY)
-                        runnable(subsys);
+                    if (!subsys)
+                        m_metrics.errors.record(SubsystemError::UNKNOWN_TAG);
+                    else if (subsys->get_state() != SubsystemState::DESTROY)
+                        runnable(*subsys);
                 }
             }
 
         /**
          * @brief Handles a single subsystem event from a child
          * @param event A by-value event.
+         * @return NONE, or why the event was dropped
          */
-        void handle_child_event(SubsystemIPC event)
+        SubsystemError handle_child_event(SubsystemIPC event)
         {
             switch(event.state)
             {
@@ -420,22 +1117,21 @@ namespace management
             case SubsystemState::ERROR:
                 break;
             default:
-#ifdef SUBSYSTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Invalid Child event");
-#else
-                return;
-#endif
+                return SubsystemError::INVALID_STATE;
             }
 
             /* hand off to the virtual handler */
-            on_child(event);
+            trace::Scope scope{trace::EventType::ON_CHILD, m_tag, event.state};
+            child_hook(event, detail::has_static_hooks<Dispatch>{});
+            return SubsystemError::NONE;
         }
 
         /**
          * @brief Handles a single subsystem event from a parent
          * @param event A by-value event.
+         * @return NONE, or why the event was dropped
          */
-        void handle_parent_event(SubsystemIPC event)
+        SubsystemError handle_parent_event(SubsystemIPC event)
         {
             /* handle cancellation flag */
             switch(event.state)
@@ -451,47 +1147,117 @@ namespace management
                     break;
                 }
             default:
-#ifdef SUBSYSTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Invalid Parent event");
-#else
-                return;
-#endif
+                return SubsystemError::INVALID_STATE;
             }
 
             /* hand off to the virtual handler */
-            on_parent(event);
+            trace::Scope scope{trace::EventType::ON_PARENT, m_tag, event.state};
+            parent_hook(event, detail::has_static_hooks<Dispatch>{});
+            return SubsystemError::NONE;
         }
 
         /**
          * @brief Handles a single subsystem event from self
          * @param event A by-value event.
+         * @return NONE, or why the event was dropped
          */
-        void handle_self_event(SubsystemIPC event)
+        SubsystemError handle_self_event(SubsystemIPC event)
         {
+            SubsystemState state = event.state;
+
             /* handle cancellation flag */
-            switch(event.state)
+            switch(state)
             {
-            case SubsystemState::RUNNING: on_start(); break;
-            case SubsystemState::ERROR: on_error(); break;
-            case SubsystemState::STOPPED: on_stop(); break;
+            case SubsystemState::RUNNING:
+            case SubsystemState::ERROR:
+            case SubsystemState::STOPPED:
+                break;
             case SubsystemState::DESTROY:
+                set_cancel_flag(true);
+                break;
+            default:
+                return SubsystemError::INVALID_STATE;
+            }
+
+            /* parents first, an abandoned transition must not have run its hook */
+            if (!await_parents(state))
+                return SubsystemError::NONE;
+
+            switch(state)
+            {
+            case SubsystemState::RUNNING:
                 {
-                    set_cancel_flag(true);
-                    on_destroy();
+                    trace::Scope scope{trace::EventType::ON_START, m_tag, state};
+                    self_hook(state, detail::has_static_hooks<Dispatch>{});
+                    break;
+                }
+            case SubsystemState::ERROR:
+                {
+                    trace::Scope scope{trace::EventType::ON_ERROR, m_tag, state};
+                    self_hook(state, detail::has_static_hooks<Dispatch>{});
+                    break;
+                }
+            case SubsystemState::STOPPED:
+                {
+                    trace::Scope scope{trace::EventType::ON_STOP, m_tag, state};
+                    self_hook(state, detail::has_static_hooks<Dispatch>{});
+                    break;
+                }
+            case SubsystemState::DESTROY:
+                {
+                    {
+                        trace::Scope scope{trace::EventType::ON_DESTROY, m_tag, state};
+                        self_hook(state, detail::has_static_hooks<Dispatch>{});
+                    }
                     stop_bus();
                     break;
                 }
             default:
-#ifdef SUBSYSTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Invalid SELF event");
-#else
-                return;
-#endif
+                break;
+            }
+
+            commit_state(state);
+            return SubsystemError::NONE;
+        }
+
+        /**
+         * @brief Runs on_start, on_error, on_stop or on_destroy, through the vtable
+         */
+        void self_hook(SubsystemState state, std::false_type)
+        {
+            switch(state)
+            {
+            case SubsystemState::RUNNING: on_start(); break;
+            case SubsystemState::ERROR: on_error(); break;
+            case SubsystemState::STOPPED: on_stop(); break;
+            case SubsystemState::DESTROY: on_destroy(); break;
+            default: break;
             }
+        }
+
+        /**
+         * @brief Same, with the hooks of Dispatch named directly, see StaticSubsystem
+         */
+        void self_hook(SubsystemState state, std::true_type)
+        {
+            Dispatch * self = static_cast<Dispatch *>(this);
 
-            commit_state(event.state);
+            switch(state)
+            {
+            case SubsystemState::RUNNING: self->Dispatch::on_start(); break;
+            case SubsystemState::ERROR: self->Dispatch::on_error(); break;
+            case SubsystemState::STOPPED: self->Dispatch::on_stop(); break;
+            case SubsystemState::DESTROY: self->Dispatch::on_destroy(); break;
+            default: break;
+            }
         }
 
+        void parent_hook(SubsystemIPC event, std::false_type) { on_parent(event); }
+        void parent_hook(SubsystemIPC event, std::true_type) { static_cast<Dispatch *>(this)->Dispatch::on_parent(event); }
+
+        void child_hook(SubsystemIPC event, std::false_type) { on_child(event); }
+        void child_hook(SubsystemIPC event, std::true_type) { static_cast<Dispatch *>(this)->Dispatch::on_child(event); }
+
         /**
          * @brief Sets the cancellation flag.
          * @details This bypasses any wait state the subsystem is in
@@ -502,39 +1268,151 @@ namespace management
         }
 
         /**
-         * @brief Commits the state to the subsystem table
-         * TODO COMMENT/Doc
+         * @brief Wakes a commit_state that waits for its parents
+         * @details Call after whatever may have made them ready. The epoch
+         *          closes the window between commit_state's test and its
+         *          sleep; the wake mutex is only taken while it sleeps.
+         */
+        void wake_commit()
+        {
+            m_wake_epoch.fetch_add(1, std::memory_order_seq_cst);
+
+            if (m_commit_parked.load(std::memory_order_seq_cst)) {
+                { std::lock_guard<std::mutex> wk{m_wake_mutex}; }
+                m_proceed_signal.notify_one();
+            }
+        }
+
+        /**
+         * @brief Waits until the parents allow a transition to state
+         * @details Waits at most for the deadline set for state. A missed
+         *          deadline is counted and handled by its DeadlinePolicy;
+         *          FAIL turns state into ERROR.
+         * @param state The target state, updated by the policy
+         * @return T, if the transition goes ahead; F, if it is abandoned
+         */
+        bool await_parents(SubsystemState & state)
+        {
+            if ((m_state == state) ||
+                (m_state == SubsystemState::DESTROY))
+            {
+                return true;
+            }
+
+            std::unique_lock<lock_t> lk{m_state_change_mutex};
+
+            TransitionDeadline const deadline = m_deadlines.get(state);
+            bool missed = false;
+
+            std::uint64_t wait_start = detail::now_ns();
+            {
+                trace::Scope scope{trace::EventType::COMMIT_WAIT, m_tag, state};
+                m_metrics.heartbeat.wait(wait_start);
+
+                /* wait_for_parents() consumes the cancellation flag, test it once per wakeup */
+                std::uint32_t seen = m_wake_epoch.load(std::memory_order_acquire);
+
+                if (!wait_for_parents()) {
+                    auto changed = [this, &seen] { return m_wake_epoch.load(std::memory_order_acquire) != seen; };
+                    auto due = std::chrono::steady_clock::now() + deadline.timeout;
+
+                    /* spin and sleep without the state lock, it is only needed to test the parents */
+                    lk.unlock();
+                    bool woke = detail::spin_wait(m_wait_strategy, changed, m_metrics.commit_wait_phases);
+
+                    if (!woke)
+                        m_metrics.commit_wait_phases.record(WaitPhase::PARK);
+
+                    for (;;)
+                    {
+                        if (!woke) {
+                            std::unique_lock<std::mutex> wk{m_wake_mutex};
+                            m_commit_parked.store(true, std::memory_order_seq_cst);
+
+                            if (deadline.timeout.count() > 0)
+                                woke = m_proceed_signal.wait_until(wk, due, changed);
+                            else {
+                                m_proceed_signal.wait(wk, changed);
+                                woke = true;
+                            }
+
+                            m_commit_parked.store(false, std::memory_order_relaxed);
+                        }
+
+                        lk.lock();
+                        seen = m_wake_epoch.load(std::memory_order_acquire);
+
+                        if (wait_for_parents())
+                            break;
+
+                        /* nothing changed until the deadline */
+                        if (!woke) {
+                            missed = true;
+                            break;
+                        }
+
+                        lk.unlock();
+                        woke = false;
+                    }
+                }
+
+                m_metrics.heartbeat.resume();
+            }
+            m_metrics.commit_wait.record(detail::now_ns() - wait_start);
+
+            if (!missed)
+                return true;
+
+            m_metrics.deadline_misses.record(state);
+
+            switch (deadline.policy)
+            {
+            case DeadlinePolicy::ABANDON:
+                return false;
+            case DeadlinePolicy::FAIL:
+                state = SubsystemState::ERROR;
+                return true;
+            case DeadlinePolicy::PROCEED:
+            default:
+                return true;
+            }
+        }
+
+        /**
+         * @brief Commits the state to the subsystem table and tells the
+         *        neighbours, see await_parents for the wait before
          */
         void commit_state(SubsystemState state)
         {
+            std::lock_guard<lock_t> lk{m_state_change_mutex};
+
             if ((m_state == state) ||
                 (m_state == SubsystemState::DESTROY))
             {
                 return;
             }
 
-            /* wait for a start signal */
-            std::unique_lock<lock_t> lk{m_state_change_mutex};
-
-            do {
-                m_proceed_signal.wait(lk, [this] { return wait_for_parents(); });
-                /* spurious wakeup prevention */
-            } while (!wait_for_parents());
-
             /* do the actual state change */
             m_state = state;
+            publish_snapshot();
 
-            SubsystemIPC msg { SubsystemIPC::CHILD, m_tag, m_state };
+            /* one seq for the whole fan-out, the receiver tag keeps flow ids apart */
+            SubsystemIPC msg { SubsystemIPC::CHILD, m_tag, m_state, next_seq() };
+            std::uint64_t sent = 0;
 
-            for_all_active_parents([msg] (SubsystemLink & p) {
+            for_all_active_parents([msg, &sent] (SubsystemLink & p) {
                                       p.put_message(msg);
+                                      ++sent;
                                    });
 
             msg.from = SubsystemIPC::PARENT;
 
-            for_all_active_children([msg] (SubsystemLink & c) {
+            for_all_active_children([msg, &sent] (SubsystemLink & c) {
                                       c.put_message(msg);
+                                      ++sent;
                                     });
+
+            m_metrics.messages_out.add(sent);
         }
 
         /**
@@ -614,11 +1492,7 @@ namespace management
             case SubsystemState::RUNNING: start(); break;
             case SubsystemState::INIT: break;
             default:
-#ifdef SUBSYSTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Invalid state field in SubsystemIPC");
-#else
-                /* ignore? */
-#endif
+                /* handle_parent_event drops these before they get here */
                 break;
             }
         }
@@ -636,54 +1510,115 @@ namespace management
 
         /**
          * @brief Handles a SubsystemIPC message
+         * @details Never throws, a malformed event is dropped and counted in
+         *          SubsystemMetrics::errors.
          * @param event The IPC message to handle
          * @return T if success, F otherwise. The F case is the exceptional path.
          */
-        bool operator()(SubsystemIPC & event)
+        bool operator()(SubsystemIPC & event) noexcept
         {
-            switch(event.from)
-            {
-            case SubsystemIPC::PARENT: handle_parent_event(event); break;
-            case SubsystemIPC::CHILD: handle_child_event(event); break;
-            case SubsystemIPC::SELF: handle_self_event(event); break;
-            default:
-#ifdef SUBSYSVTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Invalid from field in SubsystemIPC");
-#else
-                /* ignore? */
-                return false;
+            SubsystemError error;
+
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+            /* the hooks are user code, a throw must not reach the noexcept boundary */
+            try {
 #endif
+                switch(event.from)
+                {
+                case SubsystemIPC::PARENT: error = handle_parent_event(event); break;
+                case SubsystemIPC::CHILD: error = handle_child_event(event); break;
+                case SubsystemIPC::SELF: error = handle_self_event(event); break;
+                default:
+                    m_metrics.errors.record(SubsystemError::INVALID_ORIGIN);
+                    return false;
+                }
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+            }
+            catch (...) {
+                error = SubsystemError::HOOK_THREW;
             }
+#endif
+
+            if (error != SubsystemError::NONE)
+                m_metrics.errors.record(error);
 
-            m_proceed_signal.notify_one();
             return true;
         }
 
+        /**< What the bus hands out, an owning pointer or the terminator */
+        using bus_item_type = decltype(detail::bus_wait_and_pop(std::declval<Bus<T> &>(),
+                                       std::declval<std::uint64_t &>(), 0));
+
         /**
          * @brief Handles a single bus message
          * @return T, if the message was valid; F, if the terminator was caught
          */
         bool handle_bus_message()
         {
-            if (m_state == SubsystemState::DESTROY) {
-#ifdef SUBSYSVTEM_USE_EXCEPTIONS
-                throw std::runtime_error("Attempting to handle a message after m_state == DESTROY");
-#else
+            /* the normal way out of the message loop, not an error */
+            if (m_state == SubsystemState::DESTROY)
                 return false;
-#endif
-            }
 
-            auto item = m_bus.wait_and_pop();
+            std::uint64_t enqueued;
+            auto item = detail::bus_wait_and_pop(m_bus, enqueued, 0);
+            return handle_bus_item(item, enqueued);
+        }
+
+        /**
+         * @brief Handles a single bus message, waiting at most timeout for it
+         * @param timeout How long to wait for a message
+         * @param idle Set to T if no message arrived in time
+         * @return T, if the message was valid or none arrived; F, if the terminator was caught
+         */
+        bool handle_bus_message_for(std::chrono::nanoseconds timeout, bool & idle)
+        {
+            /* the normal way out of the message loop, not an error */
+            if (m_state == SubsystemState::DESTROY)
+                return false;
+
+            std::uint64_t enqueued;
+            bus_item_type item;
+
+            idle = !detail::bus_wait_and_pop_for(m_bus, timeout, item, enqueued, 0);
+            return idle || handle_bus_item(item, enqueued);
+        }
+
+    private:
+        /**
+         * @brief Dispatches one popped bus item
+         * @param item The item
+         * @param enqueued When the item was pushed, in detail::now_ns() time
+         * @return T, if the message was valid; F, if the terminator was caught
+         */
+        bool handle_bus_item(bus_item_type & item, std::uint64_t enqueued)
+        {
+            std::uint64_t start = detail::now_ns();
 
             /* detect termination */
             if (item == typename decltype(m_bus)::terminator()) {
-                /* notify the last waiting state or external waiters */
-                m_proceed_signal.notify_one();
                 return false;
             }
 
+            m_metrics.queue_latency.record(start > enqueued ? start - enqueued : 0);
+
             auto message = *item.get();
-            return handle_bus_message2(message);
+            auto kind = detail::message_kind(message);
+
+            trace::Scope scope{trace::EventType::HANDLE_MESSAGE, m_tag};
+
+            if (trace::enabled()) {
+                SubsystemIPC const * ipc = detail::message_ipc(message);
+                if (ipc)
+                    trace::record(trace::EventType::HANDLE_MESSAGE, trace::Phase::FLOW_END, m_tag,
+                                  ipc->state, trace::flow_id(ipc->tag, ipc->seq, m_tag));
+            }
+
+            m_metrics.heartbeat.enter(kind, start);
+            bool ret = handle_bus_message2(message);
+            m_metrics.heartbeat.leave();
+
+            m_metrics.handler_time[static_cast<std::size_t>(kind)].record(detail::now_ns() - start);
+            return ret;
         }
 
     public:
@@ -692,15 +1627,31 @@ namespace management
          * @param name The name of the subsystem
          * @param map The SubsystemMap coordinating this subsystem
          * @param parents A list of parent subsystems
+         * @param lazy_worker Whether the message loop is started by put_message,
+         *        see release_worker. Used by ThreadedSubsystem.
          */
         Subsystem(std::string const & name,
                   SubsystemMap & map,
-                  SubsystemParentsList parents={}) :
+                  SubsystemParentsList parents={},
+                  bool lazy_worker=false) :
+            detail::SubsystemLink(map.memory_resource()),
             m_cancel_flag(false),
-            m_subsystem_map_ref(map)
+            m_subsystem_map_ref(map),
+            m_wake_epoch(0),
+            m_commit_parked(false),
+            m_seq(0),
+            m_worker_pending(false),
+            m_lazy_worker(lazy_worker)
         {
             m_tag = SubsystemMap::generate_subsystem_tag();
-            m_name = name;
+            detail::bus_set_memory_resource(m_bus, map.memory_resource(), 0);
+            set_name(m_subsystem_map_ref, name);
+            m_snapshot.set_name(*m_name, m_name_id);
+            m_snapshot.publish(m_tag, m_state, m_parents, m_children);
+
+            /* Register before linking, a running parent may look us up as soon
+             * as it knows our tag */
+            m_subsystem_map_ref.put(m_tag, std::ref<SubsystemLink>(*this));
 
             /* Create a map of parents */
             for (auto & parent_item : parents) {
@@ -709,19 +1660,92 @@ namespace management
                 /* add this to the parent */
                 parent_item.get().add_child(*this);
             }
+        }
 
-            m_subsystem_map_ref.put(m_tag, std::ref<SubsystemLink>(*this));
+        /**
+         * @brief Batch constructor
+         * @details The subsystem stays invisible until batch.commit().
+         * @param name The name of the subsystem
+         * @param batch The batch this subsystem is built in
+         * @param parents A list of parent subsystems
+         * @param lazy_worker See the other constructor
+         */
+        Subsystem(std::string const & name,
+                  SubsystemBatch & batch,
+                  SubsystemParentsList parents={},
+                  bool lazy_worker=false) :
+            detail::SubsystemLink(batch.map().memory_resource()),
+            m_cancel_flag(false),
+            m_subsystem_map_ref(batch.map()),
+            m_wake_epoch(0),
+            m_commit_parked(false),
+            m_seq(0),
+            m_worker_pending(false),
+            m_lazy_worker(lazy_worker)
+        {
+            m_tag = batch.next_tag();
+            detail::bus_set_memory_resource(m_bus, m_subsystem_map_ref.memory_resource(), 0);
+            set_name(m_subsystem_map_ref, name);
+            m_snapshot.set_name(*m_name, m_name_id);
+
+            /* nobody can see us yet, no locks needed */
+            for (auto & parent_item : parents)
+                batch.link(parent_item.get(), *this);
+
+            batch.enlist(*this);
         }
 
         Subsystem(Subsystem const &) = delete;
 
+        /**
+         * @return Instrumentation of this subsystem
+         */
+        detail::SubsystemMetrics const * get_metrics() const override { return &m_metrics; }
+
+        /**
+         * @return Wait phase counters of the bus, nullptr if it has none
+         */
+        WaitStats const * get_bus_wait_stats() const override { return detail::bus_wait_stats(m_bus, 0); }
+
+        /**
+         * @return Number of messages waiting on the bus
+         */
+        std::size_t get_queue_depth() const override { return static_cast<std::size_t>(m_bus.size()); }
+
+        /**
+         * @brief Releases a commit_state waiting for its parents
+         */
+        void interrupt() override
+        {
+            set_cancel_flag(true);
+            wake_commit();
+        }
+
+        /**
+         * @brief Republishes the topology after a SubsystemBatch commit
+         */
+        void refresh_snapshot() override
+        {
+            std::lock_guard<lock_t> lk{m_state_change_mutex};
+            publish_snapshot();
+        }
+
+        /**
+         * @brief Copies the published topology and the live queue depth
+         */
+        void read_snapshot(SubsystemSnapshot & out) const override
+        {
+            m_snapshot.read(out);
+            out.queue_depth = static_cast<std::uint32_t>(get_queue_depth());
+        }
+
         /**
          * @brief Destructor
          */
         virtual ~Subsystem()
         {
             set_cancel_flag(true);
-            m_proceed_signal.notify_all();
+            wake_commit();
             m_subsystem_map_ref.remove(m_tag);
         }
 
@@ -729,28 +1753,44 @@ namespace management
          * @brief Start trigger
          */
         void start() {
-            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::RUNNING});
+            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::RUNNING, next_seq()});
         }
 
         /**
          * @brief Stop trigger
          */
         void stop() {
-            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::STOPPED});
+            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::STOPPED, next_seq()});
         }
 
         /**
          * @brief Error trigger
          */
         void error() {
-            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::ERROR});
+            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::ERROR, next_seq()});
         }
 
         /**
          * @brief Delete/Destroy trigger
          */
         void destroy() {
-            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::DESTROY});
+            put_message({SubsystemIPC::SELF, m_tag, SubsystemState::DESTROY, next_seq()});
+        }
+
+        /**
+         * @brief Puts an arbitrary message on this subsystem's message bus
+         * @details This is how extended IPC types (see SubsystemIPC_Extended)
+         *          reach a subsystem from the outside.
+         * @param msg The message to send
+         */
+        void post_message(T msg)
+        {
+            if (m_state == SubsystemState::DESTROY)
+                return;
+
+            m_metrics.messages_in.add();
+            m_bus.push(std::move(msg));
+            wake_worker();
         }
     };
 
@@ -765,17 +1805,315 @@ namespace management
             return operator()(message);
         }
 
+    /**
+     * @brief Specialization for subsystems on a NumaQueue
+     */
+    template<>
+        inline bool Subsystem<NumaQueue, SubsystemIPC, void>::handle_bus_message2(SubsystemIPC & message) {
+            return operator()(message);
+        }
+
+    /**
+     * @brief Specialization for subsystems on a MultiLaneQueue
+     */
+    template<>
+        inline bool Subsystem<MultiLaneQueue, SubsystemIPC, void>::handle_bus_message2(SubsystemIPC & message) {
+            return operator()(message);
+        }
+
+    /**
+     * @brief Specialization for subsystems on a SpscQueue
+     */
+    template<>
+        inline bool Subsystem<SpscQueue, SubsystemIPC, void>::handle_bus_message2(SubsystemIPC & message) {
+            return operator()(message);
+        }
+
+    /* Forward */
+    class SubsystemThreadGroup;
+
+    /**
+     * @brief How a ThreadedSubsystem manages its thread
+     */
+    struct ThreadedSubsystemOptions
+    {
+        /**< Spawn the thread on the first message instead of in the constructor */
+        bool lazy_start;
+        /**< Let the thread exit after this long with an empty bus, it is
+         * respawned by the next message. Zero keeps it until destroy. */
+        std::chrono::milliseconds idle_timeout;
+        /**< CPUs the thread may run on, empty leaves the affinity alone */
+        std::vector<unsigned> cpus;
+        /**< Home NUMA node, negative for none. Without cpus the thread is
+         * pinned to the node's CPUs, a bus with set_home_node places its
+         * entries there. */
+        int numa_node = -1;
+        /**< How the worker waits for messages and parents, parks by default */
+        WaitStrategy wait;
+        /**< How long a state change waits for the parents, forever by default */
+        TransitionDeadlines deadlines;
+        /**< Ask a bus with several producer lanes (MultiLaneQueue) to deliver
+         * in global push order rather than per producer order */
+        bool global_order = false;
+        /**< Fairness budget: step aside after this many back-to-back messages,
+         * 0 for no limit. A thread of its own yields, a group member goes to
+         * the back of the group's queue. */
+        std::uint32_t yield_after = 0;
+        /**< Same, after this much back-to-back work, 0 for no limit */
+        std::chrono::microseconds yield_interval{0};
+        /**< SCHED_* policy, negative leaves it alone */
+        int sched_policy = -1;
+        /**< Priority for sched_policy */
+        int sched_priority = 0;
+        /**< Nice value applied to the thread, 0 leaves it alone */
+        int nice = 0;
+        /**< Name the thread after the subsystem (first 15 characters) */
+        bool set_name = true;
+        /**< Run on this group's shared thread instead of an own one. The
+         * scheduling fields above are then taken from the group. */
+        SubsystemThreadGroup * group = nullptr;
+
+        ThreadedSubsystemOptions(bool lazy = false,
+                                 std::chrono::milliseconds idle = std::chrono::milliseconds{0}) :
+            lazy_start(lazy),
+            idle_timeout(idle)
+        { }
+    };
+
+    namespace detail
+    {
+        /**
+         * @brief Applies name, affinity and scheduling to the calling thread
+         * @return 0, or the errno of the last setting that failed
+         */
+        int configure_thread(std::string const & name, ThreadedSubsystemOptions const & options);
+
+        /**
+         * @brief Something a SubsystemThreadGroup runs
+         */
+        struct Schedulable
+        {
+            virtual ~Schedulable() = default;
+
+            /**
+             * @brief Handles messages until the bus is empty or terminated
+             * @return T, if it stopped early and wants to run again
+             */
+            virtual bool run_slice() = 0;
+        };
+    } /* end namespace detail */
+
+    /**
+     * @brief One thread shared by many ThreadedSubsystems
+     * @details Members are queued when a message arrives for them and drain
+     *          their bus in turn. Handlers of all members run one at a time,
+     *          so a member must not block on another member of the same group
+     *          (for example a commit_state waiting on a parent in the group
+     *          that has not reached RUNNING yet). Destroy members first.
+     */
+    class SubsystemThreadGroup final
+    {
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_signal;
+        /**< Members with messages */
+        std::deque<detail::Schedulable *> m_ready;
+        /**< Member currently running, if any */
+        detail::Schedulable * m_running = nullptr;
+        bool m_stop = false;
+        std::thread m_thread;
+
+        void run(std::string const & name, ThreadedSubsystemOptions const & options);
+
+    public:
+        /**
+         * @param name Thread name
+         * @param options Affinity and scheduling of the shared thread
+         */
+        explicit SubsystemThreadGroup(std::string const & name,
+                                      ThreadedSubsystemOptions const & options = ThreadedSubsystemOptions{});
+
+        SubsystemThreadGroup(SubsystemThreadGroup const &) = delete;
+
+        ~SubsystemThreadGroup();
+
+        /**
+         * @brief Queues a member that has messages waiting
+         */
+        void schedule(detail::Schedulable & member);
+
+        /**
+         * @brief Removes a member, waiting for it to finish running
+         */
+        void remove(detail::Schedulable & member);
+    };
+
     /**
      * @brief Subsystem with a managed thread to handle bus messages
      * @details This is useful if you want the subsystem to execute start/stop/error/destroy
      *          in its own thread. Usually this is desired.
      */
     template<template <typename...> class Bus=ThreadsafeQueue, typename T = SubsystemIPC, typename Dispatch = void>
-        class ThreadedSubsystem : public Subsystem<Bus, T, Dispatch>
+        class ThreadedSubsystem : public Subsystem<Bus, T, Dispatch>, private detail::Schedulable
     {
     private:
         /**< Managed thread */
         std::thread m_thread;
+        /**< Guards m_thread against a respawn racing the destructor */
+        std::mutex m_thread_lock;
+        /**< See ThreadedSubsystemOptions */
+        const ThreadedSubsystemOptions m_options;
+        /**< Result of the last configure_thread */
+        std::atomic<int> m_thread_error;
+
+        /**
+         * @brief The message loop
+         */
+        void run()
+        {
+            m_thread_error = detail::configure_thread(this->get_name(), m_options);
+
+            std::uint32_t handled = 0;
+            std::uint64_t slice_start = 0;
+
+            /* run until the bus is empty, then block on it */
+            if (m_options.idle_timeout.count() == 0) {
+                while(this->handle_bus_message()) {
+                    if (slice_spent(handled, slice_start))
+                        std::this_thread::yield();
+                }
+                return;
+            }
+
+            for (;;)
+            {
+                bool idle = false;
+
+                if (!this->handle_bus_message_for(m_options.idle_timeout, idle))
+                    return;
+
+                /* exit unless a message slipped in while giving up the thread */
+                if (idle && !this->release_worker())
+                    return;
+
+                if (!idle && slice_spent(handled, slice_start))
+                    std::this_thread::yield();
+            }
+        }
+
+        /**
+         * @brief Group mode, drains the bus on the group's thread
+         * @return T, if the budget ran out with messages left
+         */
+        bool run_slice() override
+        {
+            std::uint32_t handled = 0;
+            std::uint64_t slice_start = 0;
+
+            for (;;)
+            {
+                bool idle = false;
+
+                if (!this->handle_bus_message_for(std::chrono::nanoseconds{0}, idle))
+                    return false;
+
+                if (idle && !this->release_worker())
+                    return false;
+
+                if (!idle && slice_spent(handled, slice_start))
+                    return true;
+            }
+        }
+
+        /**
+         * @brief Fairness budget, called after each handled message
+         * @details A slice ends after yield_after messages or yield_interval
+         *          of back-to-back work. An empty bus starts a new slice, the
+         *          worker is about to block anyway.
+         * @return T, if the slice is used up and the worker should step aside
+         */
+        bool slice_spent(std::uint32_t & handled, std::uint64_t & slice_start) const
+        {
+            if (this->get_queue_depth() == 0) {
+                handled = 0;
+                slice_start = 0;
+                return false;
+            }
+
+            bool spent = m_options.yield_after && ++handled >= m_options.yield_after;
+
+            if (!spent && m_options.yield_interval.count()) {
+                std::uint64_t now = detail::now_ns();
+                std::uint64_t interval = static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.yield_interval).count());
+
+                if (!slice_start)
+                    slice_start = now;
+
+                spent = now - slice_start >= interval;
+            }
+
+            if (spent) {
+                handled = 0;
+                slice_start = 0;
+            }
+
+            return spent;
+        }
+
+        /**
+         * @brief Joins a previous, finished thread and starts a new one
+         */
+        void spawn()
+        {
+            std::lock_guard<decltype(m_thread_lock)> lk{m_thread_lock};
+
+            if (m_thread.joinable())
+                m_thread.join();
+
+            m_thread = std::thread{[this] () { run(); }};
+        }
+
+        /**
+         * @brief Shared tail of the constructors
+         */
+        void launch()
+        {
+            if (m_options.numa_node >= 0)
+                detail::bus_set_home_node(this->m_bus, m_options.numa_node, 0);
+
+            this->set_wait_strategy(m_options.wait);
+            this->set_deadlines(m_options.deadlines);
+
+            if (m_options.global_order)
+                detail::bus_set_global_order(this->m_bus, true, 0);
+
+            if (m_options.group) {
+                if (this->release_worker())
+                    m_options.group->schedule(*this);
+            }
+            else if (!m_options.lazy_start)
+                spawn();
+            else if (this->release_worker())
+                spawn();
+        }
+
+        static bool is_lazy(ThreadedSubsystemOptions const & options)
+        {
+            return options.lazy_start || options.idle_timeout.count() || options.group;
+        }
+
+    protected:
+        /**
+         * @brief Spawns or schedules the worker for the message that found it missing
+         */
+        void start_worker() override
+        {
+            if (m_options.group)
+                m_options.group->schedule(*this);
+            else
+                spawn();
+        }
 
     public:
         /**
@@ -783,24 +2121,94 @@ namespace management
          * @param name The name of the subsystem
          * @param map The SubsystemMap used to coordinate subsystems
          * @param parents A list of parent subsystems
+         * @param options Thread management, by default the thread lives from here to destroy
          */
-        ThreadedSubsystem(std::string const & name, SubsystemMap & map, SubsystemParentsList parents={}) :
-            Subsystem<Bus, T, Dispatch>(name, map, parents)
+        ThreadedSubsystem(std::string const & name, SubsystemMap & map, SubsystemParentsList parents={},
+                          ThreadedSubsystemOptions options = ThreadedSubsystemOptions{}) :
+            Subsystem<Bus, T, Dispatch>(name, map, parents, is_lazy(options)),
+            m_options(std::move(options)),
+            m_thread_error(0)
         {
-            m_thread = std::thread{[this] ()
-                {
-                    while(this->handle_bus_message()) {
-                        std::this_thread::yield();
-                    }
-                }
-            };
+            launch();
+        }
+
+        /**
+         * @brief Batch constructor
+         * @details By default the thread is spawned when the first message
+         *          arrives, so idle parts of a large graph cost no threads.
+         * @param name The name of the subsystem
+         * @param batch The batch this subsystem is built in
+         * @param parents A list of parent subsystems
+         * @param options Thread management
+         */
+        ThreadedSubsystem(std::string const & name, SubsystemBatch & batch, SubsystemParentsList parents={},
+                          ThreadedSubsystemOptions options = ThreadedSubsystemOptions{true}) :
+            Subsystem<Bus, T, Dispatch>(name, batch, parents, is_lazy(options)),
+            m_options(std::move(options)),
+            m_thread_error(0)
+        {
+            launch();
         }
 
         virtual ~ThreadedSubsystem()
         {
+            if (m_options.group)
+                m_options.group->remove(*this);
+
+            std::lock_guard<decltype(m_thread_lock)> lk{m_thread_lock};
+
             if (m_thread.joinable())
                 m_thread.join();
         }
+
+        /**
+         * @return 0, or the errno of a thread option that could not be applied
+         *         (for example EPERM for a realtime policy)
+         */
+        int thread_error() const { return m_thread_error; }
+    };
+
+    /**
+     * @brief ThreadedSubsystem whose hooks are resolved at compile time
+     * @details Derived declares on_start, on_stop, on_error, on_destroy,
+     *          on_parent and on_child as public members, any it leaves out
+     *          keep the default behaviour. The message loop calls them by
+     *          name, so small handlers inline into it instead of going
+     *          through the vtable per message.
+     *
+     *          Derived has to be the most derived class. It lives in the same
+     *          SubsystemMap and links to and from any other subsystem.
+     *
+     * @tparam Derived The subsystem being defined, CRTP
+     * @tparam Bus Message bus
+     */
+    template<typename Derived, template <typename...> class Bus=ThreadsafeQueue>
+        class StaticSubsystem : public ThreadedSubsystem<Bus, SubsystemIPC, Derived>, public helpers::static_hooks
+    {
+    private:
+        using Base = ThreadedSubsystem<Bus, SubsystemIPC, Derived>;
+
+    public:
+        /**
+         * @brief Constructor, see ThreadedSubsystem
+         */
+        StaticSubsystem(std::string const & name, SubsystemMap & map, SubsystemParentsList parents={},
+                        ThreadedSubsystemOptions options = ThreadedSubsystemOptions{}) :
+            Base(name, map, parents, std::move(options))
+        { }
+
+        /**
+         * @brief Batch constructor, see ThreadedSubsystem
+         */
+        StaticSubsystem(std::string const & name, SubsystemBatch & batch, SubsystemParentsList parents={},
+                        ThreadedSubsystemOptions options = ThreadedSubsystemOptions{true}) :
+            Base(name, batch, parents, std::move(options))
+        { }
+
+        /**
+         * @brief CRTP entry of the message loop
+         */
+        bool intercept_message(SubsystemIPC & message) { return Base::operator()(message); }
     };
 
 } /* end namespace management */
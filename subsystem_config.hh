@@ -0,0 +1,31 @@
+#ifndef _SUBSYSTEM_CONFIG_HH_3735928559_
+#define _SUBSYSTEM_CONFIG_HH_3735928559_
+
+/**
+ * @file subsystem_config.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Build switches. Each can be set from the compiler command line instead of
+ * editing this file.
+ *
+ *  - SUBSYSTEM_NO_EXCEPTIONS: setup failures (shm_open, an oversized socket
+ *    frame, ...) are reported through return values only. Implied by
+ *    -fno-exceptions. Message handling never throws either way, see
+ *    SubsystemError.
+ *  - SUBSYSTEM_NO_BOOST: subsystems carry SubsystemIPC only, no
+ *    SubsystemIPC_Extended.
+ */
+
+#if !defined(SUBSYSTEM_USE_EXCEPTIONS) && !defined(SUBSYSTEM_NO_EXCEPTIONS) && \
+    (defined(__cpp_exceptions) || defined(__EXCEPTIONS))
+#define SUBSYSTEM_USE_EXCEPTIONS
+#endif
+
+/* Allows subsystems to transmit more than just SubsystemIPC messages
+ * See SubsystemIPC_Extended
+ */
+#if !defined(SUBSYSTEM_HAS_BOOST) && !defined(SUBSYSTEM_NO_BOOST)
+#define SUBSYSTEM_HAS_BOOST
+#endif
+
+#endif // guard
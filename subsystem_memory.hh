@@ -0,0 +1,422 @@
+#ifndef _SUBSYSTEM_MEMORY_HH_3735928559_
+#define _SUBSYSTEM_MEMORY_HH_3735928559_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "subsystem_config.hh"
+
+/**
+ * @file subsystem_memory.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Memory resources for subsystem graphs, a C++11 take on std::pmr. A
+ * SubsystemMap built with a resource hands it to every Subsystem it maps:
+ * the map's tables, the edge sets and the bus nodes and items then come out
+ * of that resource instead of global malloc.
+ *
+ *     PoolResource pool;
+ *     SubsystemMap map{sizes::default_max_subsystem_count, &pool};
+ *
+ * The resource has to outlive the map and every subsystem built on it.
+ * Buses allocate on the producer and free on the consumer thread, so the
+ * resources here are synchronized.
+ */
+
+namespace sizes
+{
+    /**< Bytes MonotonicResource takes from its upstream at once */
+    constexpr const std::size_t arena_chunk_size = 64 * 1024;
+    /**< Smallest and largest block PoolResource keeps free lists for */
+    constexpr const std::size_t pool_min_block = 16;
+    constexpr const std::size_t pool_max_block = 1024;
+}
+
+namespace management
+{
+    /**
+     * @brief Source of memory, see std::pmr::memory_resource
+     * @details Alignments up to alignof(std::max_align_t) are supported.
+     */
+    class MemoryResource
+    {
+    public:
+        virtual ~MemoryResource() = default;
+
+        void * allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+        {
+            return do_allocate(bytes, alignment);
+        }
+
+        void deallocate(void * p, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+        {
+            do_deallocate(p, bytes, alignment);
+        }
+
+        /**
+         * @return T, if memory from this resource can be freed by other
+         */
+        bool is_equal(MemoryResource const & other) const noexcept { return do_is_equal(other); }
+
+    protected:
+        virtual void * do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+        virtual void do_deallocate(void * p, std::size_t bytes, std::size_t alignment) = 0;
+        virtual bool do_is_equal(MemoryResource const & other) const noexcept { return this == &other; }
+    };
+
+    inline bool operator==(MemoryResource const & a, MemoryResource const & b) noexcept
+    {
+        return &a == &b || a.is_equal(b);
+    }
+
+    inline bool operator!=(MemoryResource const & a, MemoryResource const & b) noexcept
+    {
+        return !(a == b);
+    }
+
+    namespace detail
+    {
+        /**
+         * @brief Global operator new and delete
+         */
+        class NewDeleteResource final : public MemoryResource
+        {
+        protected:
+            void * do_allocate(std::size_t bytes, std::size_t) override { return ::operator new(bytes); }
+            void do_deallocate(void * p, std::size_t, std::size_t) override { ::operator delete(p); }
+        };
+
+        /**
+         * @return p rounded up to alignment, a power of two
+         */
+        inline char * align_up(char * p, std::size_t alignment)
+        {
+            std::uintptr_t v = reinterpret_cast<std::uintptr_t>(p);
+            return p + ((alignment - (v & (alignment - 1))) & (alignment - 1));
+        }
+    } /* end namespace detail */
+
+    /**
+     * @return The resource every map, subsystem and bus uses unless told otherwise
+     */
+    inline MemoryResource * new_delete_resource() noexcept
+    {
+        static detail::NewDeleteResource resource;
+        return &resource;
+    }
+
+    /**
+     * @brief Bump allocator, nothing is freed before release()
+     * @details Takes chunks of at least chunk_size from upstream, or starts in
+     *          a caller buffer. Meant for what lives as long as the graph: map
+     *          tables, edge sets and names. A bus that runs for long churns
+     *          through its nodes, give it a PoolResource on top of this one.
+     */
+    class MonotonicResource final : public MemoryResource
+    {
+    private:
+        /**< Header of every chunk taken from upstream */
+        struct chunk {
+            chunk * next;
+            std::size_t size;
+        };
+
+        MemoryResource * m_upstream;
+        std::size_t m_chunk_size;
+        /**< Chunks taken from upstream, newest first */
+        chunk * m_chunks = nullptr;
+        /**< Free space of the current chunk */
+        char * m_cursor = nullptr;
+        char * m_end = nullptr;
+        /**< Bytes taken from upstream, headers included */
+        std::size_t m_upstream_bytes = 0;
+        std::mutex m_lock;
+
+    public:
+        /**
+         * @param chunk_size Smallest chunk taken from upstream
+         * @param upstream Where the chunks come from
+         */
+        explicit MonotonicResource(std::size_t chunk_size = sizes::arena_chunk_size,
+                                   MemoryResource * upstream = new_delete_resource()) :
+            m_upstream(upstream),
+            m_chunk_size(chunk_size)
+        { }
+
+        /**
+         * @brief Starts in buffer, upstream is only used once it is full
+         * @param buffer Caller owned, has to outlive this resource
+         * @param size Bytes in buffer
+         */
+        MonotonicResource(void * buffer, std::size_t size,
+                          MemoryResource * upstream = new_delete_resource()) :
+            m_upstream(upstream),
+            m_chunk_size(sizes::arena_chunk_size),
+            m_cursor(static_cast<char *>(buffer)),
+            m_end(static_cast<char *>(buffer) + size)
+        { }
+
+        MonotonicResource(MonotonicResource const &) = delete;
+
+        ~MonotonicResource() { release(); }
+
+        /**
+         * @brief Returns every chunk to upstream
+         * @details Whatever was allocated from this resource is gone.
+         */
+        void release()
+        {
+            std::lock_guard<std::mutex> lk{m_lock};
+
+            while (m_chunks) {
+                chunk * next = m_chunks->next;
+                m_upstream->deallocate(m_chunks, m_chunks->size);
+                m_chunks = next;
+            }
+
+            m_cursor = m_end = nullptr;
+            m_upstream_bytes = 0;
+        }
+
+        /**
+         * @return Bytes taken from upstream so far
+         */
+        std::size_t upstream_bytes()
+        {
+            std::lock_guard<std::mutex> lk{m_lock};
+            return m_upstream_bytes;
+        }
+
+        MemoryResource * upstream() const { return m_upstream; }
+
+    protected:
+        void * do_allocate(std::size_t bytes, std::size_t alignment) override
+        {
+            std::lock_guard<std::mutex> lk{m_lock};
+
+            char * p = m_cursor ? detail::align_up(m_cursor, alignment) : nullptr;
+
+            if (!p || p + bytes > m_end) {
+                std::size_t size = sizeof(chunk) + alignment + bytes;
+                size = size < m_chunk_size ? m_chunk_size : size;
+
+                chunk * c = static_cast<chunk *>(m_upstream->allocate(size));
+                c->next = m_chunks;
+                c->size = size;
+                m_chunks = c;
+                m_upstream_bytes += size;
+
+                m_end = reinterpret_cast<char *>(c) + size;
+                p = detail::align_up(reinterpret_cast<char *>(c + 1), alignment);
+            }
+
+            m_cursor = p + bytes;
+            return p;
+        }
+
+        void do_deallocate(void *, std::size_t, std::size_t) override { }
+    };
+
+    /**
+     * @brief Free lists of power of two blocks, carved from a MonotonicResource
+     * @details Blocks from pool_min_block to pool_max_block bytes are kept on
+     *          a free list per size once freed, and never go back to upstream
+     *          before the pool is destroyed: a steady message flow stops
+     *          allocating after its first burst. Larger blocks, or stricter
+     *          alignments, go straight to upstream.
+     */
+    class PoolResource final : public MemoryResource
+    {
+    private:
+        /**< Number of block sizes, pool_min_block doubled up to pool_max_block */
+        static constexpr std::size_t classes = 7;
+
+        static_assert((sizes::pool_min_block << (classes - 1)) == sizes::pool_max_block,
+                      "pool block sizes do not add up");
+
+        struct free_block {
+            free_block * next;
+        };
+
+        /**< Where the blocks are carved from */
+        MonotonicResource m_blocks;
+        /**< Free blocks by size class */
+        free_block * m_free[classes];
+        std::mutex m_lock;
+
+        /**
+         * @return The size class of bytes, classes if it is too large
+         */
+        static std::size_t size_class(std::size_t bytes, std::size_t alignment)
+        {
+            if (bytes > sizes::pool_max_block || alignment > sizes::pool_min_block)
+                return classes;
+
+            std::size_t c = 0;
+            while ((sizes::pool_min_block << c) < bytes)
+                ++c;
+            return c;
+        }
+
+    public:
+        /**
+         * @param upstream Where chunks and large blocks come from
+         * @param chunk_size Smallest chunk taken from upstream
+         */
+        explicit PoolResource(MemoryResource * upstream = new_delete_resource(),
+                              std::size_t chunk_size = sizes::arena_chunk_size) :
+            m_blocks(chunk_size, upstream)
+        {
+            for (auto & head : m_free)
+                head = nullptr;
+        }
+
+        PoolResource(PoolResource const &) = delete;
+
+        /**
+         * @return Bytes taken from upstream for pooled blocks so far
+         */
+        std::size_t upstream_bytes() { return m_blocks.upstream_bytes(); }
+
+    protected:
+        void * do_allocate(std::size_t bytes, std::size_t alignment) override
+        {
+            std::size_t c = size_class(bytes, alignment);
+
+            if (c == classes)
+                return m_blocks.upstream()->allocate(bytes, alignment);
+
+            {
+                std::lock_guard<std::mutex> lk{m_lock};
+
+                if (free_block * b = m_free[c]) {
+                    m_free[c] = b->next;
+                    return b;
+                }
+            }
+
+            return m_blocks.allocate(sizes::pool_min_block << c, sizes::pool_min_block);
+        }
+
+        void do_deallocate(void * p, std::size_t bytes, std::size_t alignment) override
+        {
+            std::size_t c = size_class(bytes, alignment);
+
+            if (c == classes) {
+                m_blocks.upstream()->deallocate(p, bytes, alignment);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lk{m_lock};
+            free_block * b = static_cast<free_block *>(p);
+            b->next = m_free[c];
+            m_free[c] = b;
+        }
+    };
+
+    /**
+     * @brief Allocator over a MemoryResource, see std::pmr::polymorphic_allocator
+     * @details Unlike polymorphic_allocator it propagates on move assignment
+     *          and swap, an empty container can be moved onto a resource after
+     *          it was built. A copy gets new_delete_resource(), as with pmr.
+     */
+    template<typename T>
+        class ResourceAllocator
+        {
+        private:
+            MemoryResource * m_resource;
+
+            template<typename U> friend class ResourceAllocator;
+
+        public:
+            using value_type = T;
+            using propagate_on_container_copy_assignment = std::false_type;
+            using propagate_on_container_move_assignment = std::true_type;
+            using propagate_on_container_swap = std::true_type;
+
+            ResourceAllocator() noexcept : m_resource(new_delete_resource()) { }
+
+            ResourceAllocator(MemoryResource * resource) noexcept : m_resource(resource) { }
+
+            template<typename U>
+                ResourceAllocator(ResourceAllocator<U> const & other) noexcept : m_resource(other.m_resource) { }
+
+            T * allocate(std::size_t n)
+            {
+                return static_cast<T *>(m_resource->allocate(n * sizeof(T), alignof(T)));
+            }
+
+            void deallocate(T * p, std::size_t n)
+            {
+                m_resource->deallocate(p, n * sizeof(T), alignof(T));
+            }
+
+            ResourceAllocator select_on_container_copy_construction() const { return ResourceAllocator(); }
+
+            MemoryResource * resource() const noexcept { return m_resource; }
+        };
+
+    template<typename T, typename U>
+        bool operator==(ResourceAllocator<T> const & a, ResourceAllocator<U> const & b) noexcept
+        {
+            return *a.resource() == *b.resource();
+        }
+
+    template<typename T, typename U>
+        bool operator!=(ResourceAllocator<T> const & a, ResourceAllocator<U> const & b) noexcept
+        {
+            return !(a == b);
+        }
+
+    namespace detail
+    {
+        /**
+         * @brief unique_ptr deleter for objects made by make_resource_unique
+         */
+        template<typename T>
+            struct ResourceDelete
+            {
+                MemoryResource * resource;
+
+                ResourceDelete() : resource(nullptr) { }
+                explicit ResourceDelete(MemoryResource * r) : resource(r) { }
+
+                void operator()(T * p) const
+                {
+                    p->~T();
+                    resource->deallocate(p, sizeof(T), alignof(T));
+                }
+            };
+
+        /**
+         * @brief Constructs a T in memory from resource
+         */
+        template<typename T, typename... Args>
+            std::unique_ptr<T, ResourceDelete<T>> make_resource_unique(MemoryResource & resource, Args &&... args)
+            {
+                void * p = resource.allocate(sizeof(T), alignof(T));
+
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+                try {
+                    ::new (p) T(std::forward<Args>(args)...);
+                }
+                catch (...) {
+                    resource.deallocate(p, sizeof(T), alignof(T));
+                    throw;
+                }
+#else
+                ::new (p) T(std::forward<Args>(args)...);
+#endif
+
+                return std::unique_ptr<T, ResourceDelete<T>>(static_cast<T *>(p), ResourceDelete<T>(&resource));
+            }
+    } /* end namespace detail */
+
+} /* end namespace management */
+
+#endif // guard
@@ -0,0 +1,449 @@
+#ifndef _SUBSYSTEM_METRICS_HH_3735928559_
+#define _SUBSYSTEM_METRICS_HH_3735928559_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "wait_strategy.hh"
+
+/**
+ * @file subsystem_metrics.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Low overhead per-subsystem instrumentation. Counters that many producers
+ * touch are sharded per thread, histograms are written by the subsystem's
+ * own worker only. Readers never take a lock, they copy relaxed values and
+ * accept that a snapshot of a running system is not a single instant.
+ */
+
+namespace sizes
+{
+    constexpr const std::size_t metrics_counter_shards = 8;
+    /**< Number of SubsystemState values, INIT to DESTROY */
+    constexpr const std::size_t subsystem_state_count = 5;
+}
+
+namespace management
+{
+    /* Forward */
+    enum class SubsystemState : std::uint8_t;
+
+    /**
+     * @brief Kind of bus message, used to split handler latency
+     */
+    enum class MessageKind : std::uint8_t {
+        PARENT = 0, CHILD, SELF, EXTENDED, COUNT
+    };
+
+    /**
+     * @brief Why a message was rejected, counted per subsystem
+     */
+    enum class SubsystemError : std::uint8_t {
+        NONE = 0,
+        INVALID_ORIGIN, /**< SubsystemIPC::from is not PARENT, CHILD or SELF */
+        INVALID_STATE, /**< SubsystemIPC::state is not a SubsystemState */
+        AFTER_DESTROY, /**< Sent to, or handled by, a destroyed subsystem */
+        UNKNOWN_TAG, /**< A neighbour was no longer in the map, its message was not sent */
+        HOOK_THREW, /**< An on_* hook or message handler threw, the rest of the message was skipped */
+        COUNT
+    };
+
+    /**
+     * @brief What a busy subsystem worker is stuck in
+     */
+    enum class StallKind : std::uint8_t {
+        HANDLER = 0, /**< Running a message handler */
+        COMMIT_WAIT /**< In commit_state, waiting for its parents */
+    };
+
+    /**
+     * @brief A subsystem that has been busy for long, see Watchdog
+     */
+    struct SubsystemStall
+    {
+        std::uint32_t tag = 0;
+        std::uint32_t name_id = 0;
+        /**< Kind of the message being handled */
+        MessageKind kind{};
+        StallKind stall{};
+        /**< When the handler or the wait started, detail::now_ns() time */
+        std::uint64_t since_ns = 0;
+        /**< How long it has been busy */
+        std::uint64_t busy_ns = 0;
+        /**< Messages the worker finished so far */
+        std::uint64_t beats = 0;
+    };
+
+    namespace detail
+    {
+        /**
+         * @return Monotonic nanoseconds
+         */
+        inline std::uint64_t now_ns()
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        /**
+         * @return A small per-thread index used to pick counter shards
+         */
+        inline std::size_t thread_shard()
+        {
+            static std::atomic<std::size_t> next{0};
+            static thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed);
+            return shard;
+        }
+
+        /**
+         * @brief One counter per SubsystemError
+         * @details Errors are rare, a plain atomic each is enough.
+         */
+        class ErrorCounts final
+        {
+        private:
+            std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(SubsystemError::COUNT)> m_count;
+
+        public:
+            ErrorCounts()
+            {
+                for (auto & c : m_count)
+                    c.store(0, std::memory_order_relaxed);
+            }
+
+            void record(SubsystemError error)
+            {
+                m_count[static_cast<std::size_t>(error)].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            std::uint64_t load(SubsystemError error) const
+            {
+                return m_count[static_cast<std::size_t>(error)].load(std::memory_order_relaxed);
+            }
+        };
+
+        /**
+         * @brief Events counted per target SubsystemState
+         */
+        class StateCounts final
+        {
+        private:
+            std::array<std::atomic<std::uint64_t>, sizes::subsystem_state_count> m_count;
+
+        public:
+            StateCounts()
+            {
+                for (auto & c : m_count)
+                    c.store(0, std::memory_order_relaxed);
+            }
+
+            void record(SubsystemState state)
+            {
+                m_count[static_cast<std::size_t>(state)].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            std::uint64_t load(SubsystemState state) const
+            {
+                return m_count[static_cast<std::size_t>(state)].load(std::memory_order_relaxed);
+            }
+        };
+
+        /**
+         * @brief What the worker is doing right now
+         * @details Single writer, the worker: a few relaxed stores per message.
+         *          Readers may see the fields of two consecutive messages
+         *          mixed, a Watchdog only needs them roughly right.
+         */
+        class Heartbeat final
+        {
+        private:
+            /**< Start of the current handler or wait, 0 while idle */
+            std::atomic<std::uint64_t> m_since;
+            /**< Messages finished */
+            std::atomic<std::uint64_t> m_beats;
+            std::atomic<std::uint8_t> m_kind;
+            std::atomic<std::uint8_t> m_stall;
+
+        public:
+            Heartbeat()
+            {
+                m_since.store(0, std::memory_order_relaxed);
+                m_beats.store(0, std::memory_order_relaxed);
+                m_kind.store(0, std::memory_order_relaxed);
+                m_stall.store(0, std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief A handler for a message of kind starts at now
+             */
+            void enter(MessageKind kind, std::uint64_t now)
+            {
+                m_kind.store(static_cast<std::uint8_t>(kind), std::memory_order_relaxed);
+                m_stall.store(static_cast<std::uint8_t>(StallKind::HANDLER), std::memory_order_relaxed);
+                m_since.store(now, std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief The handler waits on its parents from now
+             */
+            void wait(std::uint64_t now)
+            {
+                m_stall.store(static_cast<std::uint8_t>(StallKind::COMMIT_WAIT), std::memory_order_relaxed);
+                m_since.store(now, std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief The wait is over, the handler goes on
+             */
+            void resume()
+            {
+                m_stall.store(static_cast<std::uint8_t>(StallKind::HANDLER), std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief The handler returned
+             */
+            void leave()
+            {
+                m_since.store(0, std::memory_order_relaxed);
+                m_beats.store(m_beats.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Fills kind, stall, since_ns and beats of out
+             * @return F, if the worker is idle
+             */
+            bool read(SubsystemStall & out) const
+            {
+                out.since_ns = m_since.load(std::memory_order_relaxed);
+                out.beats = m_beats.load(std::memory_order_relaxed);
+                out.kind = static_cast<MessageKind>(m_kind.load(std::memory_order_relaxed));
+                out.stall = static_cast<StallKind>(m_stall.load(std::memory_order_relaxed));
+                return out.since_ns != 0;
+            }
+        };
+
+        /**
+         * @brief Counter with one cache line per thread shard
+         * @details Producers on different threads do not bounce a shared line.
+         */
+        class ShardedCounter final
+        {
+        private:
+            /* Padded instead of alignas(64): an over-aligned member would make every
+             * Subsystem over-aligned, and plain new cannot honour that before C++17.
+             * Values 128 bytes apart never share a cache line. */
+            struct Shard {
+                std::atomic<std::uint64_t> value{0};
+                char padding[128 - sizeof(std::atomic<std::uint64_t>)];
+            };
+
+            std::array<Shard, sizes::metrics_counter_shards> m_shards;
+
+        public:
+            void add(std::uint64_t n = 1)
+            {
+                m_shards[thread_shard() % sizes::metrics_counter_shards].value.fetch_add(n, std::memory_order_relaxed);
+            }
+
+            std::uint64_t load() const
+            {
+                std::uint64_t sum = 0;
+                for (auto & s : m_shards)
+                    sum += s.value.load(std::memory_order_relaxed);
+                return sum;
+            }
+        };
+    } /* end namespace detail */
+
+    /**
+     * @brief Copy of a LogLinearHistogram
+     */
+    struct HistogramSnapshot
+    {
+        /**< 4 linear sub-buckets per power of two */
+        static constexpr unsigned sub_bucket_bits = 2;
+        static constexpr unsigned sub_buckets = 1u << sub_bucket_bits;
+        static constexpr unsigned bucket_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+        std::array<std::uint32_t, bucket_count> buckets{};
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+
+        /**
+         * @return Bucket holding value
+         */
+        static unsigned bucket_of(std::uint64_t value)
+        {
+            if (value < sub_buckets)
+                return static_cast<unsigned>(value);
+
+            unsigned msb = 63u - static_cast<unsigned>(__builtin_clzll(value));
+            unsigned shift = msb - sub_bucket_bits;
+            return (shift + 1) * sub_buckets + static_cast<unsigned>((value >> shift) & (sub_buckets - 1));
+        }
+
+        /**
+         * @return Largest value that lands in bucket
+         */
+        static std::uint64_t bucket_upper_bound(unsigned bucket)
+        {
+            if (bucket < sub_buckets)
+                return bucket;
+
+            unsigned shift = bucket / sub_buckets - 1;
+            std::uint64_t base = (std::uint64_t{1} << (shift + sub_bucket_bits))
+                               + (std::uint64_t{bucket % sub_buckets} << shift);
+            return base + ((std::uint64_t{1} << shift) - 1);
+        }
+
+        /**
+         * @param p Percentile in [0, 100]
+         * @return Upper bound of the bucket holding the p-th percentile, 0 if empty
+         */
+        std::uint64_t percentile(double p) const
+        {
+            std::uint64_t total = 0;
+            for (auto b : buckets)
+                total += b;
+
+            if (!total)
+                return 0;
+
+            std::uint64_t rank = static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(total - 1)) + 1;
+            std::uint64_t seen = 0;
+
+            for (unsigned i = 0; i < bucket_count; ++i) {
+                seen += buckets[i];
+                if (seen >= rank)
+                    return bucket_upper_bound(i) < max ? bucket_upper_bound(i) : max;
+            }
+
+            return max;
+        }
+
+        /**
+         * @return Arithmetic mean
+         */
+        std::uint64_t mean() const { return count ? sum / count : 0; }
+    };
+
+    /**
+     * @brief Log-linear histogram of nanosecond durations
+     * @details Relative error is bounded by the sub-bucket count (25%) over the
+     *          full 64 bit range. Single writer: the owning subsystem's worker.
+     */
+    class LogLinearHistogram final
+    {
+    private:
+        std::array<std::atomic<std::uint32_t>, HistogramSnapshot::bucket_count> m_buckets;
+        std::atomic<std::uint64_t> m_count;
+        std::atomic<std::uint64_t> m_sum;
+        std::atomic<std::uint64_t> m_max;
+
+        /* single writer, a plain load/store pair avoids the locked RMW */
+        template<typename A, typename V>
+            static void bump(A & a, V v) {
+                a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+            }
+
+    public:
+        LogLinearHistogram()
+        {
+            for (auto & b : m_buckets)
+                b.store(0, std::memory_order_relaxed);
+
+            m_count.store(0, std::memory_order_relaxed);
+            m_sum.store(0, std::memory_order_relaxed);
+            m_max.store(0, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Records one sample
+         * @param ns Duration in nanoseconds
+         */
+        void record(std::uint64_t ns)
+        {
+            bump(m_buckets[HistogramSnapshot::bucket_of(ns)], 1u);
+            bump(m_count, 1u);
+            bump(m_sum, ns);
+
+            if (ns > m_max.load(std::memory_order_relaxed))
+                m_max.store(ns, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Copies the current contents
+         */
+        void snapshot(HistogramSnapshot & out) const
+        {
+            for (unsigned i = 0; i < HistogramSnapshot::bucket_count; ++i)
+                out.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+
+            out.count = m_count.load(std::memory_order_relaxed);
+            out.sum = m_sum.load(std::memory_order_relaxed);
+            out.max = m_max.load(std::memory_order_relaxed);
+        }
+    };
+
+    namespace detail
+    {
+        /**
+         * @brief Instrumentation owned by each Subsystem
+         */
+        struct SubsystemMetrics
+        {
+            /**< Messages put on this subsystem's bus, by any producer */
+            ShardedCounter messages_in;
+            /**< Messages this subsystem sent to its parents and children */
+            ShardedCounter messages_out;
+            /**< Enqueue to dequeue latency */
+            LogLinearHistogram queue_latency;
+            /**< Time commit_state spent waiting on its parents */
+            LogLinearHistogram commit_wait;
+            /**< Phase in which each commit_state wait ended */
+            WaitStats commit_wait_phases;
+            /**< Handler execution time per message kind */
+            std::array<LogLinearHistogram, static_cast<std::size_t>(MessageKind::COUNT)> handler_time;
+            /**< Rejected messages */
+            ErrorCounts errors;
+            /**< commit_state waits that ran past their deadline, by target state */
+            StateCounts deadline_misses;
+            /**< Current activity, for the Watchdog */
+            Heartbeat heartbeat;
+        };
+    } /* end namespace detail */
+
+    /**
+     * @brief Point in time copy of one subsystem's metrics
+     */
+    struct SubsystemMetricsSnapshot
+    {
+        std::uint32_t tag = 0;
+        /**< Id of name in the map's name table */
+        std::uint32_t name_id = 0;
+        std::string name;
+        SubsystemState state{};
+        std::size_t queue_depth = 0;
+        std::uint64_t messages_in = 0;
+        std::uint64_t messages_out = 0;
+        HistogramSnapshot queue_latency;
+        HistogramSnapshot commit_wait;
+        /**< Waits that ended in each WaitPhase, by the bus consumer and by commit_state */
+        std::array<std::uint64_t, static_cast<std::size_t>(WaitPhase::COUNT)> bus_wait_phases{};
+        std::array<std::uint64_t, static_cast<std::size_t>(WaitPhase::COUNT)> commit_wait_phases{};
+        std::array<HistogramSnapshot, static_cast<std::size_t>(MessageKind::COUNT)> handler_time;
+        /**< Rejected messages per SubsystemError, NONE stays 0 */
+        std::array<std::uint64_t, static_cast<std::size_t>(SubsystemError::COUNT)> errors{};
+        /**< Missed transition deadlines per target SubsystemState */
+        std::array<std::uint64_t, sizes::subsystem_state_count> deadline_misses{};
+    };
+
+} /* end namespace management */
+
+#endif // guard
@@ -0,0 +1,184 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "subsystem_config.hh"
+#include "subsystem_numa.hh"
+
+/**
+ * @file subsystem_numa.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ */
+
+namespace management
+{
+    namespace numa
+    {
+        namespace
+        {
+            /**< From linux/mempolicy.h, kept here to avoid needing the headers */
+            constexpr const int mpol_preferred = 1;
+
+            /**
+             * @brief Parses a sysfs list such as "0-3,8,10-11"
+             */
+            std::vector<unsigned> parse_list(char const * path)
+            {
+                std::vector<unsigned> ret;
+                std::FILE * f = std::fopen(path, "r");
+
+                if (!f)
+                    return ret;
+
+                unsigned lo, hi;
+                char sep;
+
+                while (std::fscanf(f, "%u", &lo) == 1)
+                {
+                    hi = lo;
+
+                    if (std::fscanf(f, "%c", &sep) == 1 && sep == '-') {
+                        if (std::fscanf(f, "%u", &hi) != 1)
+                            break;
+                        if (std::fscanf(f, "%c", &sep) != 1)
+                            sep = '\n';
+                    }
+
+                    for (unsigned i = lo; i <= hi; ++i)
+                        ret.push_back(i);
+
+                    if (sep != ',')
+                        break;
+                }
+
+                std::fclose(f);
+                return ret;
+            }
+
+            std::size_t round_block(std::size_t size)
+            {
+                std::size_t align = alignof(std::max_align_t);
+                size = size < sizeof(void *) ? sizeof(void *) : size;
+                return (size + align - 1) / align * align;
+            }
+        }
+
+        int node_count()
+        {
+            static const int count = [] {
+                std::vector<unsigned> online = parse_list("/sys/devices/system/node/online");
+                return online.empty() ? 1 : static_cast<int>(online.back()) + 1;
+            }();
+
+            return count;
+        }
+
+        std::vector<unsigned> node_cpus(int node)
+        {
+            if (node < 0)
+                return {};
+
+            std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+            return parse_list(path.c_str());
+        }
+
+        int current_node()
+        {
+            unsigned cpu = 0;
+            unsigned node = 0;
+
+            if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+                return 0;
+
+            return static_cast<int>(node);
+        }
+
+        void * alloc_on_node(std::size_t bytes, int node)
+        {
+            void * p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (p == MAP_FAILED)
+                return nullptr;
+
+            /* best effort, before the first touch places the pages */
+            if (node >= 0 && node < static_cast<int>(sizeof(unsigned long) * 8) && node_count() > 1) {
+                unsigned long mask = 1ul << node;
+                (void)::syscall(SYS_mbind, p, bytes, mpol_preferred, &mask, sizeof(mask) * 8 + 1, 0);
+            }
+
+            return p;
+        }
+
+        void free_on_node(void * p, std::size_t bytes)
+        {
+            if (p)
+                (void)::munmap(p, bytes);
+        }
+
+        NodePool::NodePool(std::size_t block_size, int node) :
+            m_block_size(round_block(block_size)),
+            m_node(node)
+        { }
+
+        NodePool::~NodePool()
+        {
+            for (void * slab : m_slabs)
+                free_on_node(slab, sizes::numa_slab_size);
+        }
+
+        void NodePool::grow()
+        {
+            void * slab = alloc_on_node(sizes::numa_slab_size, get_node());
+
+            if (!slab) {
+#ifdef SUBSYSTEM_USE_EXCEPTIONS
+                throw std::bad_alloc();
+#else
+                std::abort();
+#endif
+            }
+
+            m_slabs.push_back(slab);
+
+            char * base = static_cast<char *>(slab);
+            std::size_t count = sizes::numa_slab_size / m_block_size;
+
+            for (std::size_t i = 0; i < count; ++i) {
+                FreeBlock * block = reinterpret_cast<FreeBlock *>(base + i * m_block_size);
+                block->next = m_free;
+                m_free = block;
+            }
+        }
+
+        void * NodePool::allocate()
+        {
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+            if (!m_free)
+                grow();
+
+            FreeBlock * block = m_free;
+            m_free = block->next;
+            return block;
+        }
+
+        void NodePool::deallocate(void * p)
+        {
+            if (!p)
+                return;
+
+            std::lock_guard<decltype(m_lock)> lk{m_lock};
+
+            FreeBlock * block = static_cast<FreeBlock *>(p);
+            block->next = m_free;
+            m_free = block;
+        }
+
+    } /* end namespace numa */
+
+} // end namespace management
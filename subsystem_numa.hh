@@ -0,0 +1,106 @@
+#ifndef _SUBSYSTEM_NUMA_HH_3735928559_
+#define _SUBSYSTEM_NUMA_HH_3735928559_
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * @file subsystem_numa.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Minimal NUMA support without libnuma. Topology comes from sysfs, memory is
+ * placed with the mbind syscall. On kernels or machines without NUMA every
+ * call degrades to a single node 0 and plain anonymous memory.
+ */
+
+namespace sizes
+{
+    /**< Bytes requested from the kernel per NodePool slab */
+    constexpr const std::size_t numa_slab_size = 64 * 1024;
+}
+
+namespace management
+{
+    namespace numa
+    {
+        /**
+         * @return Number of online nodes, at least 1
+         */
+        int node_count();
+
+        /**
+         * @return CPUs of node, empty if node does not exist
+         */
+        std::vector<unsigned> node_cpus(int node);
+
+        /**
+         * @return Node of the CPU the caller is running on, 0 if unknown
+         */
+        int current_node();
+
+        /**
+         * @brief Maps anonymous memory that prefers node
+         * @param bytes Size, rounded up to pages by the kernel
+         * @param node Preferred node, negative for no preference
+         * @return The memory, or nullptr
+         */
+        void * alloc_on_node(std::size_t bytes, int node);
+
+        /**
+         * @brief Unmaps memory from alloc_on_node
+         */
+        void free_on_node(void * p, std::size_t bytes);
+
+        /**
+         * @brief Fixed size block allocator backed by node local slabs
+         * @details Blocks are never returned to the kernel before the pool dies.
+         *          Any thread may allocate or free.
+         */
+        class NodePool final
+        {
+        private:
+            struct FreeBlock { FreeBlock * next; };
+
+            std::size_t m_block_size;
+            std::atomic<int> m_node;
+            std::mutex m_lock;
+            FreeBlock * m_free = nullptr;
+            std::vector<void *> m_slabs;
+
+            void grow();
+
+        public:
+            /**
+             * @param block_size Size of every block
+             * @param node Home node, negative to decide later
+             */
+            explicit NodePool(std::size_t block_size, int node = -1);
+
+            NodePool(NodePool const &) = delete;
+
+            ~NodePool();
+
+            /**
+             * @brief Sets the node new slabs are placed on
+             */
+            void set_node(int node) { m_node.store(node, std::memory_order_relaxed); }
+
+            int get_node() const { return m_node.load(std::memory_order_relaxed); }
+
+            /**
+             * @return A block of block_size bytes
+             * @throws std::bad_alloc if the kernel is out of memory, aborts
+             *         instead when built without exceptions
+             */
+            void * allocate();
+
+            void deallocate(void * p);
+        };
+
+    } /* end namespace numa */
+
+} /* end namespace management */
+
+#endif // guard
@@ -0,0 +1,218 @@
+#ifndef _SUBSYSTEM_SNAPSHOT_HH_3735928559_
+#define _SUBSYSTEM_SNAPSHOT_HH_3735928559_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @file subsystem_snapshot.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Release-mode introspection. Each subsystem publishes its tag, state and
+ * edges into a seqlock protected cell whenever they change. A snapshot copies
+ * those cells into a caller provided array, so polling it neither allocates
+ * nor takes any subsystem's lock.
+ */
+
+namespace sizes
+{
+    /**< Parent and child tags kept per snapshot entry, extra edges are only counted */
+    constexpr const std::size_t snapshot_max_edges = 8;
+    /**< Bytes of name kept per snapshot entry, including the terminator */
+    constexpr const std::size_t snapshot_name_length = 32;
+}
+
+namespace management
+{
+    /* Forward */
+    enum class SubsystemState : std::uint8_t;
+
+    /**
+     * @brief Point in time copy of one subsystem's topology
+     * @details Plain data, safe to keep in a static buffer between polls.
+     */
+    struct SubsystemSnapshot
+    {
+        std::uint32_t tag;
+        SubsystemState state;
+        /**< Real edge counts, may exceed sizes::snapshot_max_edges */
+        std::uint16_t parent_count;
+        std::uint16_t child_count;
+        std::uint32_t queue_depth;
+        std::uint32_t parents[sizes::snapshot_max_edges];
+        std::uint32_t children[sizes::snapshot_max_edges];
+        /**< Possibly truncated, always terminated */
+        char name[sizes::snapshot_name_length];
+        /**< Id of the full name in the map's name table */
+        std::uint32_t name_id;
+    };
+
+    namespace detail
+    {
+        /**
+         * @brief Seqlock published topology of one subsystem
+         * @details Writers are serialized by the owner's state change lock. Readers
+         *          retry while a write is in progress and never block a writer.
+         */
+        class SnapshotCell final
+        {
+        private:
+            std::atomic<std::uint32_t> m_seq;
+            std::atomic<std::uint32_t> m_tag;
+            std::atomic<std::uint8_t> m_state;
+            std::atomic<std::uint16_t> m_parent_count;
+            std::atomic<std::uint16_t> m_child_count;
+            std::array<std::atomic<std::uint32_t>, sizes::snapshot_max_edges> m_parents;
+            std::array<std::atomic<std::uint32_t>, sizes::snapshot_max_edges> m_children;
+            /* written once, before the owner is reachable through a map */
+            char m_name[sizes::snapshot_name_length];
+            std::uint32_t m_name_id;
+
+            template<typename Set>
+                static std::uint16_t store_edges(std::array<std::atomic<std::uint32_t>,
+                                                 sizes::snapshot_max_edges> & out, Set const & tags)
+                {
+                    std::size_t i = 0;
+                    for (auto tag : tags) {
+                        if (i == sizes::snapshot_max_edges)
+                            break;
+                        out[i++].store(tag, std::memory_order_relaxed);
+                    }
+
+                    return static_cast<std::uint16_t>(std::min<std::size_t>(tags.size(), UINT16_MAX));
+                }
+
+        public:
+            SnapshotCell()
+            {
+                m_seq.store(0, std::memory_order_relaxed);
+                m_tag.store(0, std::memory_order_relaxed);
+                m_state.store(0, std::memory_order_relaxed);
+                m_parent_count.store(0, std::memory_order_relaxed);
+                m_child_count.store(0, std::memory_order_relaxed);
+
+                for (std::size_t i = 0; i < sizes::snapshot_max_edges; ++i) {
+                    m_parents[i].store(0, std::memory_order_relaxed);
+                    m_children[i].store(0, std::memory_order_relaxed);
+                }
+
+                m_name[0] = '\0';
+                m_name_id = 0;
+            }
+
+            SnapshotCell(SnapshotCell const &) = delete;
+
+            /**
+             * @brief Sets the name
+             * @details Only call before the owner is shared with other threads.
+             */
+            void set_name(std::string const & name, std::uint32_t name_id)
+            {
+                m_name_id = name_id;
+
+                std::size_t n = std::min(name.size(), sizes::snapshot_name_length - 1);
+                name.copy(m_name, n);
+                m_name[n] = '\0';
+            }
+
+            /**
+             * @brief Publishes the current topology
+             * @param tag Owner tag
+             * @param state Owner state
+             * @param parents Parent tags
+             * @param children Child tags
+             */
+            template<typename Set>
+                void publish(std::uint32_t tag, SubsystemState state, Set const & parents, Set const & children)
+                {
+                    std::uint32_t seq = m_seq.load(std::memory_order_relaxed);
+                    m_seq.store(seq + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+
+                    m_tag.store(tag, std::memory_order_relaxed);
+                    m_state.store(static_cast<std::uint8_t>(state), std::memory_order_relaxed);
+                    m_parent_count.store(store_edges(m_parents, parents), std::memory_order_relaxed);
+                    m_child_count.store(store_edges(m_children, children), std::memory_order_relaxed);
+
+                    m_seq.store(seq + 2, std::memory_order_release);
+                }
+
+            /**
+             * @brief Copies a consistent view into out, queue_depth is left alone
+             */
+            void read(SubsystemSnapshot & out) const
+            {
+                for (;;)
+                {
+                    std::uint32_t before = m_seq.load(std::memory_order_acquire);
+
+                    if (before & 1)
+                        continue;
+
+                    out.tag = m_tag.load(std::memory_order_relaxed);
+                    out.state = static_cast<SubsystemState>(m_state.load(std::memory_order_relaxed));
+                    out.parent_count = m_parent_count.load(std::memory_order_relaxed);
+                    out.child_count = m_child_count.load(std::memory_order_relaxed);
+
+                    for (std::size_t i = 0; i < sizes::snapshot_max_edges; ++i) {
+                        out.parents[i] = i < out.parent_count ? m_parents[i].load(std::memory_order_relaxed) : 0;
+                        out.children[i] = i < out.child_count ? m_children[i].load(std::memory_order_relaxed) : 0;
+                    }
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+
+                    if (m_seq.load(std::memory_order_relaxed) == before)
+                        break;
+                }
+
+                std::copy(m_name, m_name + sizes::snapshot_name_length, out.name);
+                out.name_id = m_name_id;
+            }
+        };
+    } /* end namespace detail */
+
+    /**
+     * @brief Size of the binary snapshot header
+     */
+    constexpr const std::size_t snapshot_binary_header_size = 12;
+
+    /**
+     * @brief Size of one binary snapshot record
+     */
+    constexpr const std::size_t snapshot_binary_record_size =
+        16 + 8 * sizes::snapshot_max_edges + sizes::snapshot_name_length;
+
+    /**
+     * @brief Formats entries as one line of text per subsystem
+     * @details Output is truncated to fit and always terminated when size > 0.
+     * @param entries Entries from SubsystemMap::snapshot
+     * @param count Number of entries
+     * @param buffer Destination
+     * @param size Size of buffer in bytes
+     * @return Bytes needed, excluding the terminator, like snprintf
+     */
+    std::size_t format_snapshot_text(SubsystemSnapshot const * entries, std::size_t count,
+                                     char * buffer, std::size_t size);
+
+    /**
+     * @brief Encodes entries in a fixed little-endian layout
+     * @details Header: "SSNP", u16 version, u16 record size, u32 count.
+     *          Record: u32 tag, u8 state, u8 reserved, u16 parent count,
+     *          u16 child count, u16 reserved, u32 queue depth, the parent
+     *          and child tag arrays and the name bytes.
+     * @param entries Entries from SubsystemMap::snapshot
+     * @param count Number of entries
+     * @param buffer Destination
+     * @param size Size of buffer in bytes
+     * @return Bytes written, 0 if buffer is too small
+     */
+    std::size_t format_snapshot_binary(SubsystemSnapshot const * entries, std::size_t count,
+                                       char * buffer, std::size_t size);
+
+} /* end namespace management */
+
+#endif // guard
@@ -0,0 +1,353 @@
+#ifndef _SUBSYSTEM_SUPERVISOR_HH_3735928559_
+#define _SUBSYSTEM_SUPERVISOR_HH_3735928559_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "subsystem.hh"
+
+/**
+ * @file subsystem_supervisor.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Erlang style supervision. A Supervisor is the parent of the subsystems it
+ * supervises. When one of them reports ERROR, the Supervisor restarts it
+ * (STOPPED, then RUNNING) instead of letting the fault stand; the default
+ * on_parent carries the restart down the faulted child's own subtree, the
+ * rest of the graph keeps running.
+ *
+ *     SupervisorOptions options;
+ *     options.strategy = RestartStrategy::REST_FOR_ONE;
+ *
+ *     Supervisor<> supervisor{"supervisor", map, {}, options};
+ *     Reader reader{"reader", map, {supervisor}};
+ *     Parser parser{"parser", map, {supervisor}};
+ *     supervisor.start();
+ *
+ * Restarts are delayed by an exponential backoff. More than max_restarts
+ * within period and the Supervisor gives up: it goes to ERROR itself, which
+ * a Supervisor above it sees as a faulted child. Supervisors nest that way.
+ */
+
+namespace management
+{
+    /**
+     * @brief Which children a Supervisor restarts when one of them faults
+     */
+    enum class RestartStrategy : std::uint8_t {
+        /**< Only the faulted child */
+        ONE_FOR_ONE = 0,
+        /**< Every supervised child */
+        ONE_FOR_ALL,
+        /**< The faulted child and every child created after it */
+        REST_FOR_ONE
+    };
+
+    /**
+     * @brief How a Supervisor restarts its children
+     */
+    struct SupervisorOptions
+    {
+        RestartStrategy strategy = RestartStrategy::ONE_FOR_ONE;
+        /**< Restarts allowed within period before giving up */
+        std::uint32_t max_restarts = 3;
+        std::chrono::milliseconds period{5000};
+        /**< Delay of the first restart in a period, doubled for each
+         * further one. Zero restarts right away. */
+        std::chrono::milliseconds backoff{10};
+        /**< Longest delay */
+        std::chrono::milliseconds max_backoff{1000};
+        /**< The Supervisor's own thread */
+        ThreadedSubsystemOptions thread;
+    };
+
+    /**
+     * @brief ThreadedSubsystem that restarts its faulted children
+     * @details Supervised children are its children in the graph, so they
+     *          also follow its start, stop and destroy. Children are ordered
+     *          by tag, which is creation order, for REST_FOR_ONE.
+     *
+     *          Delayed restarts are sent from a timer thread, spawned on the
+     *          first one. Destroy the Supervisor before its children are
+     *          destructed. A class deriving from Supervisor has to call
+     *          Supervisor::on_start and on_destroy from its overrides.
+     *
+     * @tparam Bus Message bus
+     */
+    template<template <typename...> class Bus=ThreadsafeQueue>
+        class Supervisor : public ThreadedSubsystem<Bus>
+    {
+    private:
+        using Base = ThreadedSubsystem<Bus>;
+        using clock = std::chrono::steady_clock;
+
+        /**< Restarts waiting for their backoff to pass */
+        struct pending {
+            clock::time_point due;
+            std::vector<SubsystemTag> tags;
+        };
+
+        const SupervisorOptions m_supervision;
+        /**< Restarts inside the current period, oldest first. Worker thread only */
+        std::deque<clock::time_point> m_history;
+        /**< Restarts sent so far */
+        std::atomic<std::uint64_t> m_restarts;
+        /**< Set once max_restarts was exceeded, until the next start */
+        std::atomic_bool m_gave_up;
+
+        std::mutex m_timer_lock;
+        std::condition_variable m_timer_signal;
+        std::vector<pending> m_pending;
+        std::thread m_timer;
+        bool m_closing = false;
+
+        /**
+         * @return The backoff of the next restart, with count restarts in this period
+         */
+        std::chrono::milliseconds next_backoff(std::size_t count) const
+        {
+            std::chrono::milliseconds delay = m_supervision.backoff;
+
+            for (std::size_t i = 0; i < count && delay < m_supervision.max_backoff; ++i)
+                delay *= 2;
+
+            return std::min(delay, m_supervision.max_backoff);
+        }
+
+        /**
+         * @return The children to restart when faulted faults, by strategy
+         */
+        std::vector<SubsystemTag> affected(SubsystemTag faulted)
+        {
+            std::lock_guard<typename Base::lock_t> lk{this->m_state_change_mutex};
+
+            switch (m_supervision.strategy)
+            {
+            case RestartStrategy::ONE_FOR_ALL:
+                return std::vector<SubsystemTag>(this->m_children.begin(), this->m_children.end());
+            case RestartStrategy::REST_FOR_ONE:
+                return std::vector<SubsystemTag>(this->m_children.lower_bound(faulted), this->m_children.end());
+            case RestartStrategy::ONE_FOR_ONE:
+            default:
+                return std::vector<SubsystemTag>{faulted};
+            }
+        }
+
+        /**
+         * @return T, if a restart of tag is already waiting
+         */
+        bool is_pending(SubsystemTag tag)
+        {
+            std::lock_guard<std::mutex> lk{m_timer_lock};
+
+            for (auto const & p : m_pending)
+                if (std::find(p.tags.begin(), p.tags.end(), tag) != p.tags.end())
+                    return true;
+
+            return false;
+        }
+
+        /**
+         * @brief Stops and starts each child in tags that is still supervised
+         */
+        void restart(std::vector<SubsystemTag> const & tags)
+        {
+            std::lock_guard<typename Base::lock_t> lk{this->m_state_change_mutex};
+
+            if (this->m_state != SubsystemState::RUNNING || m_gave_up)
+                return;
+
+            std::uint64_t sent = 0;
+
+            for (SubsystemTag tag : tags)
+            {
+                if (!this->m_children.count(tag))
+                    continue;
+
+                detail::SubsystemLink * child = this->m_subsystem_map_ref.find(tag);
+
+                if (!child) {
+                    this->m_metrics.errors.record(SubsystemError::UNKNOWN_TAG);
+                    continue;
+                }
+
+                if (child->get_state() == SubsystemState::DESTROY)
+                    continue;
+
+                child->put_message({SubsystemIPC::PARENT, this->m_tag, SubsystemState::STOPPED, this->next_seq()});
+                child->put_message({SubsystemIPC::PARENT, this->m_tag, SubsystemState::RUNNING, this->next_seq()});
+                sent += 2;
+            }
+
+            this->m_metrics.messages_out.add(sent);
+        }
+
+        /**
+         * @brief Queues a restart for the timer thread
+         */
+        void schedule(std::vector<SubsystemTag> tags, std::chrono::milliseconds delay)
+        {
+            std::lock_guard<std::mutex> lk{m_timer_lock};
+
+            if (m_closing)
+                return;
+
+            m_pending.push_back(pending{clock::now() + delay, std::move(tags)});
+
+            if (!m_timer.joinable())
+                m_timer = std::thread{[this] () { run_timer(); }};
+
+            m_timer_signal.notify_one();
+        }
+
+        /**
+         * @brief Timer thread, sends each pending restart once it is due
+         */
+        void run_timer()
+        {
+            std::unique_lock<std::mutex> lk{m_timer_lock};
+
+            while (!m_closing)
+            {
+                if (m_pending.empty()) {
+                    m_timer_signal.wait(lk);
+                    continue;
+                }
+
+                auto next = std::min_element(m_pending.begin(), m_pending.end(),
+                                             [] (pending const & a, pending const & b) { return a.due < b.due; });
+
+                if (clock::now() < next->due) {
+                    m_timer_signal.wait_until(lk, next->due);
+                    continue;
+                }
+
+                std::vector<SubsystemTag> tags = std::move(next->tags);
+                m_pending.erase(next);
+
+                /* restart takes the state lock, never hold both */
+                lk.unlock();
+                restart(tags);
+                lk.lock();
+            }
+        }
+
+        /**
+         * @brief Ends the timer thread, pending restarts are dropped
+         */
+        void close_timer()
+        {
+            {
+                std::lock_guard<std::mutex> lk{m_timer_lock};
+                m_closing = true;
+                m_pending.clear();
+                m_timer_signal.notify_one();
+            }
+
+            if (m_timer.joinable() && m_timer.get_id() != std::this_thread::get_id())
+                m_timer.join();
+        }
+
+    protected:
+        /**
+         * @brief A fresh start forgets earlier restarts
+         */
+        void on_start() override
+        {
+            m_history.clear();
+            m_gave_up = false;
+        }
+
+        void on_destroy() override
+        {
+            close_timer();
+        }
+
+        /**
+         * @brief Restarts a child that reported ERROR
+         */
+        void on_child(SubsystemIPC event) override
+        {
+            /* children mirror our own ERROR, those are not faults */
+            if (event.state != SubsystemState::ERROR ||
+                this->get_state() != SubsystemState::RUNNING || m_gave_up)
+                return;
+
+            if (is_pending(event.tag))
+                return;
+
+            clock::time_point now = clock::now();
+
+            while (!m_history.empty() && now - m_history.front() > m_supervision.period)
+                m_history.pop_front();
+
+            if (m_history.size() >= m_supervision.max_restarts) {
+                /* escalate, a Supervisor above us sees a faulted child */
+                m_gave_up = true;
+                this->error();
+                return;
+            }
+
+            std::chrono::milliseconds delay = next_backoff(m_history.size());
+            m_history.push_back(now);
+            ++m_restarts;
+
+            if (delay.count() == 0)
+                restart(affected(event.tag));
+            else
+                schedule(affected(event.tag), delay);
+        }
+
+    public:
+        /**
+         * @brief Constructor
+         * @param name The name of the subsystem
+         * @param map The SubsystemMap used to coordinate subsystems
+         * @param parents A list of parent subsystems, typically another Supervisor
+         * @param options Restart policy and thread management
+         */
+        Supervisor(std::string const & name, SubsystemMap & map, SubsystemParentsList parents={},
+                   SupervisorOptions options = SupervisorOptions{}) :
+            Base(name, map, parents, options.thread),
+            m_supervision(std::move(options)),
+            m_restarts(0),
+            m_gave_up(false)
+        { }
+
+        /**
+         * @brief Batch constructor, see ThreadedSubsystem
+         */
+        Supervisor(std::string const & name, SubsystemBatch & batch, SubsystemParentsList parents={},
+                   SupervisorOptions options = SupervisorOptions{}) :
+            Base(name, batch, parents, options.thread),
+            m_supervision(std::move(options)),
+            m_restarts(0),
+            m_gave_up(false)
+        { }
+
+        virtual ~Supervisor()
+        {
+            close_timer();
+        }
+
+        /**
+         * @return Restarts this Supervisor has sent or scheduled
+         */
+        std::uint64_t restarts() const { return m_restarts.load(std::memory_order_relaxed); }
+
+        /**
+         * @return T, if the restart limit was exceeded since the last start
+         */
+        bool gave_up() const { return m_gave_up.load(std::memory_order_relaxed); }
+    };
+
+} /* end namespace management */
+
+#endif // guard
@@ -0,0 +1,271 @@
+#ifndef _SUBSYSTEM_TOPOLOGY_HH_3735928559_
+#define _SUBSYSTEM_TOPOLOGY_HH_3735928559_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "subsystem.hh"
+
+/**
+ * @file subsystem_topology.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Subsystem graphs declared at compile time. A Topology names its nodes by
+ * index and lists its edges as template arguments; an edge to a node that
+ * does not exist, a repeated edge or a cycle fails to compile instead of
+ * hanging commit_state at runtime.
+ *
+ *     enum : std::size_t { SOURCE, FILTER, SINK, NODES };
+ *     using Graph = Topology<NODES, Edge<SOURCE, FILTER>, Edge<FILTER, SINK>>;
+ *
+ *     StaticGraph<Graph> graph{map};
+ *     Source source{"source", graph.batch()};
+ *     graph.bind<SOURCE>(source);
+ *     ...
+ *     graph.commit();
+ */
+
+namespace management
+{
+    namespace topology
+    {
+        /**
+         * @brief Directed edge, Parent to Child
+         */
+        template<std::size_t Parent, std::size_t Child>
+            struct Edge
+            {
+                static constexpr std::size_t parent = Parent;
+                static constexpr std::size_t child = Child;
+            };
+
+        namespace detail
+        {
+            /**< Largest topology, nodes are tracked in a 64 bit mask */
+            constexpr const std::size_t max_nodes = 64;
+
+            constexpr std::uint64_t bit(std::size_t node)
+            {
+                return std::uint64_t{1} << node;
+            }
+
+            constexpr std::uint64_t all_nodes(std::size_t nodes)
+            {
+                return nodes == max_nodes ? ~std::uint64_t{0} : bit(nodes) - 1;
+            }
+
+            /**
+             * @return T, if every edge from e on names two existing nodes
+             */
+            constexpr bool in_range(std::size_t const * from, std::size_t const * to,
+                                    std::size_t edges, std::size_t nodes, std::size_t e = 0)
+            {
+                return e == edges || (from[e] < nodes && to[e] < nodes && in_range(from, to, edges, nodes, e + 1));
+            }
+
+            /**
+             * @return T, if no edge after e repeats edge e
+             */
+            constexpr bool unique_from(std::size_t const * from, std::size_t const * to,
+                                       std::size_t edges, std::size_t e, std::size_t f)
+            {
+                return f == edges || ((from[e] != from[f] || to[e] != to[f]) && unique_from(from, to, edges, e, f + 1));
+            }
+
+            /**
+             * @return T, if no edge is declared twice
+             */
+            constexpr bool unique(std::size_t const * from, std::size_t const * to,
+                                  std::size_t edges, std::size_t e = 0)
+            {
+                return e == edges || (unique_from(from, to, edges, e, e + 1) && unique(from, to, edges, e + 1));
+            }
+
+            /**
+             * @return T, if node has a parent among the nodes in mask
+             */
+            constexpr bool has_parent_in(std::size_t const * from, std::size_t const * to, std::size_t edges,
+                                         std::size_t node, std::uint64_t mask, std::size_t e = 0)
+            {
+                return e != edges &&
+                    ((to[e] == node && (mask & bit(from[e])) != 0) || has_parent_in(from, to, edges, node, mask, e + 1));
+            }
+
+            /**
+             * @return The nodes of mask without a parent in mask
+             */
+            constexpr std::uint64_t sources(std::size_t const * from, std::size_t const * to, std::size_t edges,
+                                            std::size_t nodes, std::uint64_t mask, std::size_t node = 0)
+            {
+                return node == nodes ? 0 :
+                    (((mask & bit(node)) != 0 && !has_parent_in(from, to, edges, node, mask)) ? bit(node) : 0) |
+                    sources(from, to, edges, nodes, mask, node + 1);
+            }
+
+            /**
+             * @brief Kahn's algorithm, one layer of sources per step
+             * @return T, if peeling sources empties mask
+             */
+            constexpr bool acyclic(std::size_t const * from, std::size_t const * to, std::size_t edges,
+                                   std::size_t nodes, std::uint64_t mask)
+            {
+                return mask == 0 ||
+                    (sources(from, to, edges, nodes, mask) != 0 &&
+                     acyclic(from, to, edges, nodes, mask & ~sources(from, to, edges, nodes, mask)));
+            }
+
+            /**
+             * @return The step in which node is peeled, its distance from the roots;
+             *         nodes, for a node outside the topology
+             */
+            constexpr std::size_t level(std::size_t const * from, std::size_t const * to, std::size_t edges,
+                                        std::size_t nodes, std::size_t node, std::uint64_t mask, std::size_t step = 0)
+            {
+                return (node >= nodes || step >= nodes) ? nodes :
+                    (sources(from, to, edges, nodes, mask) & bit(node)) != 0 ? step :
+                    level(from, to, edges, nodes, node, mask & ~sources(from, to, edges, nodes, mask), step + 1);
+            }
+
+            /**
+             * @return Number of edges from e on whose end at side equals node
+             */
+            constexpr std::size_t count(std::size_t const * side, std::size_t edges,
+                                        std::size_t node, std::size_t e = 0)
+            {
+                return e == edges ? 0 : (side[e] == node ? 1 : 0) + count(side, edges, node, e + 1);
+            }
+        } /* end namespace detail */
+
+        /**
+         * @brief A subsystem graph, validated when it is instantiated
+         * @tparam Nodes Number of nodes, named 0 to Nodes - 1
+         * @tparam Edges Edge<Parent, Child> types
+         */
+        template<std::size_t Nodes, typename... Edges>
+            struct Topology
+            {
+                static_assert(Nodes > 0 && Nodes <= detail::max_nodes, "a topology has 1 to 64 nodes");
+
+                static constexpr std::size_t node_count = Nodes;
+                static constexpr std::size_t edge_count = sizeof...(Edges);
+
+                /**< Edge tables, one trailing slot so an edgeless topology still has arrays */
+                static constexpr std::size_t edge_parent[sizeof...(Edges) + 1] = { Edges::parent..., 0 };
+                static constexpr std::size_t edge_child[sizeof...(Edges) + 1] = { Edges::child..., 0 };
+
+                static_assert(detail::in_range(edge_parent, edge_child, edge_count, node_count),
+                              "an edge names a node outside the topology");
+                static_assert(detail::unique(edge_parent, edge_child, edge_count),
+                              "an edge is declared twice");
+                static_assert(detail::acyclic(edge_parent, edge_child, edge_count, node_count,
+                                              detail::all_nodes(node_count)),
+                              "the topology has a cycle");
+
+                /**
+                 * @return Number of parents of node
+                 */
+                static constexpr std::size_t parent_count(std::size_t node)
+                {
+                    return detail::count(edge_child, edge_count, node);
+                }
+
+                /**
+                 * @return Number of children of node
+                 */
+                static constexpr std::size_t child_count(std::size_t node)
+                {
+                    return detail::count(edge_parent, edge_count, node);
+                }
+
+                /**
+                 * @return 0 for a root, otherwise one more than its deepest parent
+                 */
+                static constexpr std::size_t level(std::size_t node)
+                {
+                    return detail::level(edge_parent, edge_child, edge_count, node_count, node,
+                                         detail::all_nodes(node_count));
+                }
+            };
+
+        template<std::size_t Nodes, typename... Edges>
+            constexpr std::size_t Topology<Nodes, Edges...>::edge_parent[sizeof...(Edges) + 1];
+
+        template<std::size_t Nodes, typename... Edges>
+            constexpr std::size_t Topology<Nodes, Edges...>::edge_child[sizeof...(Edges) + 1];
+    } /* end namespace topology */
+
+    /**
+     * @brief Builds the subsystems of a Topology with one map publish
+     * @details Construct every node with batch() and no parents, bind it to its
+     *          index, then commit(). The edges come from the Topology, they are
+     *          wired without locks while all nodes are still pending. Nodes
+     *          are kept in a fixed table, node<N>() needs no map lookup.
+     * @tparam Graph A topology::Topology
+     */
+    template<typename Graph>
+        class StaticGraph final
+        {
+        private:
+            SubsystemBatch m_batch;
+            /**< Bound nodes by index */
+            std::array<detail::SubsystemLink *, Graph::node_count> m_nodes;
+
+        public:
+            /**
+             * @param map The map the nodes are published to
+             */
+            explicit StaticGraph(SubsystemMap & map) :
+                m_batch(map, static_cast<std::uint32_t>(Graph::node_count))
+            {
+                m_nodes.fill(nullptr);
+            }
+
+            StaticGraph(StaticGraph const &) = delete;
+
+            /**
+             * @return The batch to construct the nodes with
+             */
+            SubsystemBatch & batch() { return m_batch; }
+
+            /**
+             * @brief Binds a constructed subsystem to node Node
+             */
+            template<std::size_t Node>
+                void bind(detail::SubsystemLink & link)
+                {
+                    static_assert(Node < Graph::node_count, "node outside the topology");
+                    m_nodes[Node] = &link;
+                }
+
+            /**
+             * @return The subsystem bound to node Node, nullptr if none is
+             */
+            template<std::size_t Node>
+                detail::SubsystemLink * node() const
+                {
+                    static_assert(Node < Graph::node_count, "node outside the topology");
+                    return m_nodes[Node];
+                }
+
+            /**
+             * @brief Wires every edge and publishes all nodes
+             * @return F, if a node was never bound; nothing is wired then
+             */
+            bool commit()
+            {
+                for (auto node : m_nodes)
+                    if (!node)
+                        return false;
+
+                for (std::size_t e = 0; e < Graph::edge_count; ++e)
+                    m_batch.link(*m_nodes[Graph::edge_parent[e]], *m_nodes[Graph::edge_child[e]]);
+
+                m_batch.commit();
+                return true;
+            }
+        };
+
+} /* end namespace management */
+
+#endif // guard
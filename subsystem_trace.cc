@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "subsystem.hh"
+#include "subsystem_trace.hh"
+
+/**
+ * @file subsystem_trace.cc
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ */
+
+namespace management
+{
+    namespace trace
+    {
+        namespace detail
+        {
+            std::atomic_bool g_enabled{false};
+
+            namespace
+            {
+                /**< Every ring ever created, at most one per live thread plus
+                 * the free ones. Rings are never freed. */
+                std::mutex g_registry_lock;
+                std::vector<std::shared_ptr<Ring>> g_registry;
+                /**< Rings of exited threads, waiting for a new thread */
+                std::vector<Ring *> g_free;
+
+                /**
+                 * @brief Gives the thread's ring back when the thread exits
+                 */
+                struct RingHolder
+                {
+                    Ring * ring = nullptr;
+
+                    ~RingHolder()
+                    {
+                        if (!ring)
+                            return;
+
+                        std::lock_guard<decltype(g_registry_lock)> lk{g_registry_lock};
+                        g_free.push_back(ring);
+                    }
+                };
+            }
+
+            Ring & thread_ring()
+            {
+                static thread_local RingHolder holder;
+
+                if (!holder.ring)
+                {
+                    std::lock_guard<decltype(g_registry_lock)> lk{g_registry_lock};
+
+                    if (!g_free.empty()) {
+                        holder.ring = g_free.back();
+                        g_free.pop_back();
+                    }
+                    else {
+                        std::shared_ptr<Ring> fresh = std::make_shared<Ring>();
+
+                        /* small sequential ids read better in trace viewers than thread hashes */
+                        fresh->tid = g_registry.size() + 1;
+                        g_registry.push_back(fresh);
+                        holder.ring = fresh.get();
+                    }
+                }
+
+                return *holder.ring;
+            }
+        } /* end namespace detail */
+
+        namespace
+        {
+            char const * event_name(EventType type)
+            {
+                switch(type)
+                {
+                case EventType::PUT_MESSAGE: return "put_message";
+                case EventType::HANDLE_MESSAGE: return "handle_bus_message";
+                case EventType::COMMIT_WAIT: return "commit_state wait";
+                case EventType::ON_START: return "on_start";
+                case EventType::ON_STOP: return "on_stop";
+                case EventType::ON_ERROR: return "on_error";
+                case EventType::ON_DESTROY: return "on_destroy";
+                case EventType::ON_PARENT: return "on_parent";
+                case EventType::ON_CHILD: return "on_child";
+                default: return "unknown";
+                }
+            }
+
+            char phase_code(Phase phase)
+            {
+                switch(phase)
+                {
+                case Phase::BEGIN: return 'B';
+                case Phase::END: return 'E';
+                case Phase::FLOW_START: return 's';
+                case Phase::FLOW_END: return 'f';
+                case Phase::INSTANT:
+                default: return 'i';
+                }
+            }
+
+            /**< One copied event and the ring it came from */
+            struct Copied
+            {
+                Event event;
+                std::uint64_t tid;
+            };
+
+            /**
+             * @brief Copies the surviving events of a ring
+             * @details Entries the writer is overwriting during the copy are dropped.
+             */
+            void copy_ring(detail::Ring const & ring, std::vector<Copied> & out)
+            {
+                std::uint64_t head = ring.head.load(std::memory_order_acquire);
+                std::uint64_t first = head > sizes::trace_ring_capacity ? head - sizes::trace_ring_capacity : 0;
+                Copied c{};
+                c.tid = ring.tid;
+
+                for (std::uint64_t i = first; i < head; ++i)
+                    if (ring.events[i & (sizes::trace_ring_capacity - 1)].read(i, c.event))
+                        out.push_back(c);
+            }
+
+            /**
+             * @brief Writes s as a JSON string literal
+             */
+            void write_string(std::ostream & out, std::string const & s)
+            {
+                out << '"';
+                for (char c : s)
+                {
+                    if (c == '"' || c == '\\')
+                        out << '\\' << c;
+                    else if (static_cast<unsigned char>(c) < 0x20)
+                        out << ' ';
+                    else
+                        out << c;
+                }
+                out << '"';
+            }
+        }
+
+        void enable(bool on)
+        {
+            detail::g_enabled.store(on);
+        }
+
+        void clear()
+        {
+            std::lock_guard<decltype(detail::g_registry_lock)> lk{detail::g_registry_lock};
+
+            for (auto & ring : detail::g_registry)
+                ring->head.store(0);
+        }
+
+        void write_chrome_json(std::ostream & out, SubsystemMap const * names)
+        {
+            std::vector<Copied> events;
+
+            {
+                std::lock_guard<decltype(detail::g_registry_lock)> lk{detail::g_registry_lock};
+
+                for (auto & ring : detail::g_registry)
+                    copy_ring(*ring, events);
+            }
+
+            std::stable_sort(events.begin(), events.end(), [] (Copied const & a, Copied const & b) {
+                return a.event.ts_ns < b.event.ts_ns;
+            });
+
+            /* resolve each tag once, through the name table so subsystems
+             * that are gone by now still get their name */
+            std::unordered_map<std::uint32_t, std::string> tag_names;
+            std::unordered_map<std::uint64_t, std::uint32_t> thread_owner;
+
+            for (auto & c : events)
+            {
+                if (!tag_names.count(c.event.tag))
+                {
+                    SubsystemNameId id = names ? names->name_id_of(c.event.tag) : 0;
+                    tag_names[c.event.tag] = id ? names->name_of(id) : std::to_string(c.event.tag);
+                }
+
+                if (c.event.type == EventType::HANDLE_MESSAGE && !thread_owner.count(c.tid))
+                    thread_owner[c.tid] = c.event.tag;
+            }
+
+            std::uint64_t origin = events.empty() ? 0 : events.front().event.ts_ns;
+            bool first = true;
+
+            out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+            /* name worker threads after the subsystem they serve */
+            for (auto & pair : thread_owner)
+            {
+                out << (first ? "\n" : ",\n");
+                first = false;
+                out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << pair.first
+                    << ",\"args\":{\"name\":";
+                write_string(out, tag_names[pair.second]);
+                out << "}}";
+            }
+
+            for (auto & c : events)
+            {
+                Event const & e = c.event;
+
+                out << (first ? "\n" : ",\n");
+                first = false;
+
+                out << "{\"name\":\"" << event_name(e.type) << "\",\"cat\":\"subsystem\",\"ph\":\""
+                    << phase_code(e.phase) << "\",\"ts\":" << (e.ts_ns - origin) / 1000
+                    << '.' << ((e.ts_ns - origin) % 1000) / 100 << ((e.ts_ns - origin) % 100) / 10
+                    << ((e.ts_ns - origin) % 10)
+                    << ",\"pid\":1,\"tid\":" << c.tid;
+
+                switch(e.phase)
+                {
+                case Phase::FLOW_START:
+                    out << ",\"id\":" << e.flow;
+                    break;
+                case Phase::FLOW_END:
+                    out << ",\"id\":" << e.flow << ",\"bp\":\"e\"";
+                    break;
+                case Phase::INSTANT:
+                    out << ",\"s\":\"t\"";
+                    break;
+                default:
+                    break;
+                }
+
+                if (e.phase != Phase::END)
+                {
+                    out << ",\"args\":{\"subsystem\":";
+                    write_string(out, tag_names[e.tag]);
+                    out << ",\"tag\":" << e.tag << ",\"state\":\"" << state_name(e.state) << "\"}";
+                }
+
+                out << '}';
+            }
+
+            out << "\n]}\n";
+        }
+
+    } /* end namespace trace */
+
+} // end namespace management
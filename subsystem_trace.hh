@@ -0,0 +1,230 @@
+#ifndef _SUBSYSTEM_TRACE_HH_3735928559_
+#define _SUBSYSTEM_TRACE_HH_3735928559_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+#include "subsystem_metrics.hh"
+
+/**
+ * @file subsystem_trace.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Optional event tracing of state propagation. When enabled, every
+ * put_message, bus message handler, commit_state wait and on_* callback
+ * appends a timestamped event to a ring owned by the calling thread. The
+ * rings are dumped as Chrome trace JSON, which chrome://tracing and the
+ * Perfetto UI both load. Flow arrows link each send to the handling of
+ * that message on the receiving subsystem.
+ *
+ * Disabled tracing costs one relaxed load per hook.
+ */
+
+namespace sizes
+{
+    /**< Events kept per thread, must be a power of two */
+    constexpr const std::size_t trace_ring_capacity = 1 << 14;
+}
+
+namespace management
+{
+    class SubsystemMap;
+
+    namespace trace
+    {
+        /**
+         * @brief What happened
+         */
+        enum class EventType : std::uint8_t {
+            PUT_MESSAGE = 0, HANDLE_MESSAGE, COMMIT_WAIT,
+            ON_START, ON_STOP, ON_ERROR, ON_DESTROY, ON_PARENT, ON_CHILD
+        };
+
+        /**
+         * @brief Chrome trace phase of an event
+         */
+        enum class Phase : std::uint8_t {
+            BEGIN = 0, END, INSTANT, FLOW_START, FLOW_END
+        };
+
+        /**
+         * @brief A single trace record
+         */
+        struct Event
+        {
+            std::uint64_t ts_ns; /**< detail::now_ns() */
+            std::uint64_t flow; /**< Flow id for FLOW_START/FLOW_END */
+            std::uint32_t tag; /**< Subsystem the event belongs to */
+            EventType type;
+            Phase phase;
+            SubsystemState state; /**< State carried by the message, if any */
+        };
+
+        namespace detail
+        {
+            /**< Global on/off switch */
+            extern std::atomic_bool g_enabled;
+
+            /**
+             * @brief One event of a Ring, guarded by its own sequence
+             * @details Same scheme as SnapshotCell: odd while the writer is in
+             *          the middle, 2 * (index + 1) once event index is complete.
+             *          A reader keeps what it read only if the sequence is the
+             *          expected one before and after.
+             */
+            struct Slot
+            {
+                std::atomic<std::uint64_t> seq{0};
+                std::atomic<std::uint64_t> ts_ns{0};
+                std::atomic<std::uint64_t> flow{0};
+                /**< tag, type, phase and state, packed */
+                std::atomic<std::uint64_t> packed{0};
+
+                void write(std::uint64_t index, Event const & e)
+                {
+                    seq.store(2 * index + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+
+                    ts_ns.store(e.ts_ns, std::memory_order_relaxed);
+                    flow.store(e.flow, std::memory_order_relaxed);
+                    packed.store(std::uint64_t{e.tag} |
+                                 std::uint64_t{static_cast<std::uint8_t>(e.type)} << 32 |
+                                 std::uint64_t{static_cast<std::uint8_t>(e.phase)} << 40 |
+                                 std::uint64_t{static_cast<std::uint8_t>(e.state)} << 48,
+                                 std::memory_order_relaxed);
+
+                    seq.store(2 * index + 2, std::memory_order_release);
+                }
+
+                /**
+                 * @return T, if out is event index, complete and not overwritten
+                 */
+                bool read(std::uint64_t index, Event & out) const
+                {
+                    if (seq.load(std::memory_order_acquire) != 2 * index + 2)
+                        return false;
+
+                    out.ts_ns = ts_ns.load(std::memory_order_relaxed);
+                    out.flow = flow.load(std::memory_order_relaxed);
+                    std::uint64_t p = packed.load(std::memory_order_relaxed);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (seq.load(std::memory_order_relaxed) != 2 * index + 2)
+                        return false;
+
+                    out.tag = static_cast<std::uint32_t>(p);
+                    out.type = static_cast<EventType>((p >> 32) & 0xff);
+                    out.phase = static_cast<Phase>((p >> 40) & 0xff);
+                    out.state = static_cast<SubsystemState>((p >> 48) & 0xff);
+                    return true;
+                }
+            };
+
+            /**
+             * @brief Single writer event ring of one thread
+             * @details Oldest events are overwritten. Rings outlive their threads
+             *          so a dump still sees the history of exited workers; the
+             *          ring of an exited thread is handed to the next new one,
+             *          which continues it under the same tid.
+             */
+            struct Ring
+            {
+                std::atomic<std::uint64_t> head{0};
+                std::uint64_t tid = 0;
+                std::array<Slot, sizes::trace_ring_capacity> events;
+
+                void append(Event const & e)
+                {
+                    std::uint64_t index = head.load(std::memory_order_relaxed);
+                    events[index & (sizes::trace_ring_capacity - 1)].write(index, e);
+                    head.store(index + 1, std::memory_order_release);
+                }
+            };
+
+            /**
+             * @return The calling thread's ring, a free one or a new one on first use
+             */
+            Ring & thread_ring();
+        } /* end namespace detail */
+
+        /**
+         * @return T, if tracing is on
+         */
+        inline bool enabled()
+        {
+            return detail::g_enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Turns tracing on or off
+         */
+        void enable(bool on = true);
+
+        /**
+         * @brief Forgets all recorded events
+         * @details Only call while tracing is disabled.
+         */
+        void clear();
+
+        /**
+         * @brief Records one event on the calling thread's ring
+         */
+        inline void record(EventType type, Phase phase, std::uint32_t tag,
+                           SubsystemState state = SubsystemState{}, std::uint64_t flow = 0)
+        {
+            if (!enabled())
+                return;
+
+            detail::thread_ring().append(Event{management::detail::now_ns(), flow, tag, type, phase, state});
+        }
+
+        /**
+         * @brief Flow id of a message from sender to receiver
+         * @details Both ends compute it from what the message carries.
+         */
+        inline std::uint64_t flow_id(std::uint32_t sender, std::uint32_t seq, std::uint32_t receiver)
+        {
+            return ((std::uint64_t{sender} << 32) | seq) ^ (std::uint64_t{receiver} * 0x9e3779b97f4a7c15ull);
+        }
+
+        /**
+         * @brief RAII BEGIN/END pair
+         */
+        class Scope final
+        {
+        private:
+            std::uint32_t m_tag;
+            EventType m_type;
+            bool m_active;
+
+        public:
+            Scope(EventType type, std::uint32_t tag, SubsystemState state = SubsystemState{}) :
+                m_tag(tag), m_type(type), m_active(enabled())
+            {
+                if (m_active)
+                    record(m_type, Phase::BEGIN, m_tag, state);
+            }
+
+            ~Scope()
+            {
+                if (m_active)
+                    record(m_type, Phase::END, m_tag);
+            }
+
+            Scope(Scope const &) = delete;
+        };
+
+        /**
+         * @brief Writes every ring as Chrome trace JSON
+         * @param out Destination stream
+         * @param names Optional map used to resolve subsystem names
+         */
+        void write_chrome_json(std::ostream & out, SubsystemMap const * names = nullptr);
+
+    } /* end namespace trace */
+
+} /* end namespace management */
+
+#endif // guard
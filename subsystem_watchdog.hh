@@ -0,0 +1,233 @@
+#ifndef _SUBSYSTEM_WATCHDOG_HH_3735928559_
+#define _SUBSYSTEM_WATCHDOG_HH_3735928559_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "subsystem.hh"
+
+/**
+ * @file subsystem_watchdog.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Finds subsystems whose worker is stuck: in a handler that blocks, or in a
+ * commit_state whose parents never become ready. Every Subsystem keeps a
+ * heartbeat in its metrics, a few relaxed stores per message. The Watchdog
+ * samples them from its own thread, the subsystems never wait for it.
+ *
+ *     WatchdogOptions options;
+ *     options.budget = std::chrono::milliseconds{500};
+ *     options.escalate = true;
+ *     Watchdog watchdog{map, options};
+ */
+
+namespace management
+{
+    /**
+     * @brief What a Watchdog checks and what it does about a stall
+     */
+    struct WatchdogOptions
+    {
+        /**< How long a handler or commit_state wait may take, see set_budget */
+        std::chrono::milliseconds budget{1000};
+        /**< Time between checks. Zero runs no thread, call check() instead */
+        std::chrono::milliseconds interval{100};
+        /**< Also send ERROR to a stalled subsystem, after releasing its
+         * commit_state wait if it is stuck in one. A handler that blocks
+         * only sees the ERROR once it returns. */
+        bool escalate = false;
+        /**< Most subsystems looked at per check */
+        std::size_t capacity = 1024;
+        /**< Called once per stall, from the checking thread. By default the
+         * stall is printed to stderr. */
+        std::function<void(SubsystemStall const &)> on_stall;
+    };
+
+    /**
+     * @brief Reports subsystems that stay busy past their budget
+     * @details Each stall is reported once, however long it lasts. The map
+     *          has to outlive the Watchdog.
+     */
+    class Watchdog final
+    {
+    private:
+        SubsystemMap & m_map;
+        const WatchdogOptions m_options;
+        /**< Scan results, allocated once */
+        std::vector<SubsystemStall> m_scan;
+        /**< Start of the stall last reported per tag, checking thread only */
+        std::unordered_map<SubsystemTag, std::uint64_t> m_reported;
+        /**< Stalls seen by the running check, becomes m_reported */
+        std::unordered_map<SubsystemTag, std::uint64_t> m_still;
+        /**< Budgets other than the default, guarded by m_lock */
+        std::unordered_map<SubsystemTag, std::uint64_t> m_budgets;
+        /**< Smallest budget, default included */
+        std::atomic<std::uint64_t> m_min_budget;
+        std::atomic<std::uint64_t> m_stalls;
+
+        std::mutex m_lock;
+        std::condition_variable m_signal;
+        bool m_stop = false;
+        std::thread m_thread;
+
+        static std::uint64_t to_ns(std::chrono::milliseconds d)
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        }
+
+        static char const * kind_name(MessageKind kind)
+        {
+            switch (kind)
+            {
+            case MessageKind::PARENT: return "parent";
+            case MessageKind::CHILD: return "child";
+            case MessageKind::SELF: return "self";
+            default: return "extended";
+            }
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lk{m_lock};
+
+            while (!m_stop)
+            {
+                lk.unlock();
+                check();
+                lk.lock();
+
+                m_signal.wait_for(lk, m_options.interval, [this] { return m_stop; });
+            }
+        }
+
+        std::uint64_t budget_of(SubsystemTag tag)
+        {
+            std::lock_guard<std::mutex> lk{m_lock};
+            auto it = m_budgets.find(tag);
+            return it == m_budgets.end() ? to_ns(m_options.budget) : it->second;
+        }
+
+        void report(SubsystemStall const & stall)
+        {
+            if (m_options.on_stall) {
+                m_options.on_stall(stall);
+                return;
+            }
+
+            std::fprintf(stderr, "watchdog: %s (%u) %s %s message for %llu ms\n",
+                         m_map.name_of(stall.name_id).c_str(), stall.tag,
+                         stall.stall == StallKind::COMMIT_WAIT ? "waits for its parents in a" : "is stuck in a",
+                         kind_name(stall.kind),
+                         static_cast<unsigned long long>(stall.busy_ns / 1000000));
+        }
+
+        void escalate(SubsystemStall const & stall)
+        {
+            m_map.visit(stall.tag, [&stall] (detail::SubsystemLink & link) {
+                            if (stall.stall == StallKind::COMMIT_WAIT)
+                                link.interrupt();
+
+                            link.put_message({SubsystemIPC::SELF, stall.tag, SubsystemState::ERROR});
+                        });
+        }
+
+    public:
+        /**
+         * @param map The subsystems to watch
+         * @param options Budget, interval and escalation
+         */
+        explicit Watchdog(SubsystemMap & map, WatchdogOptions options = WatchdogOptions{}) :
+            m_map(map),
+            m_options(std::move(options)),
+            m_scan(m_options.capacity),
+            m_min_budget(to_ns(m_options.budget)),
+            m_stalls(0)
+        {
+            if (m_options.interval.count() > 0)
+                m_thread = std::thread{[this] () { run(); }};
+        }
+
+        Watchdog(Watchdog const &) = delete;
+
+        ~Watchdog()
+        {
+            {
+                std::lock_guard<std::mutex> lk{m_lock};
+                m_stop = true;
+            }
+
+            m_signal.notify_one();
+
+            if (m_thread.joinable())
+                m_thread.join();
+        }
+
+        /**
+         * @brief Gives one subsystem a budget of its own
+         */
+        void set_budget(SubsystemTag tag, std::chrono::milliseconds budget)
+        {
+            std::lock_guard<std::mutex> lk{m_lock};
+            m_budgets[tag] = to_ns(budget);
+
+            if (to_ns(budget) < m_min_budget.load(std::memory_order_relaxed))
+                m_min_budget.store(to_ns(budget), std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Looks at every subsystem once
+         * @details Called by the Watchdog's thread, or by hand with a zero interval.
+         *          Do not call it from two threads at once.
+         * @return Stalls reported by this check
+         */
+        std::size_t check()
+        {
+            std::size_t found = m_map.find_stalls(m_min_budget.load(std::memory_order_relaxed),
+                                                  m_scan.data(), m_scan.size());
+            std::size_t reported = 0;
+
+            m_still.clear();
+
+            for (std::size_t i = 0; i < found && i < m_scan.size(); ++i)
+            {
+                SubsystemStall const & stall = m_scan[i];
+
+                if (stall.busy_ns < budget_of(stall.tag))
+                    continue;
+
+                m_still[stall.tag] = stall.since_ns;
+
+                auto it = m_reported.find(stall.tag);
+                if (it != m_reported.end() && it->second == stall.since_ns)
+                    continue;
+
+                report(stall);
+                ++reported;
+
+                if (m_options.escalate)
+                    escalate(stall);
+            }
+
+            /* forget stalls that are over */
+            m_reported.swap(m_still);
+            m_stalls.fetch_add(reported, std::memory_order_relaxed);
+            return reported;
+        }
+
+        /**
+         * @return Stalls reported so far
+         */
+        std::uint64_t stalls() const { return m_stalls.load(std::memory_order_relaxed); }
+    };
+
+} /* end namespace management */
+
+#endif // guard
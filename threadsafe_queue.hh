@@ -1,11 +1,17 @@
 #ifndef _SHARED_THREADSAFE_QUEUE_H_
 #define _SHARED_THREADSAFE_QUEUE_H_
 
-#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <cstddef>
+#include <deque>
+
+#include "futex_notifier.hh"
+#include "subsystem_memory.hh"
+#include "wait_strategy.hh"
 
 namespace management
 {
@@ -16,6 +22,8 @@ namespace management
      *      many results. Since this queue is used for low throughput transports, i.e., IPC.
      *
      *      This implementation will *own* the data given to it - as a true IPC system does.
+     *      Items and queue nodes come from a MemoryResource, new_delete_resource()
+     *      unless one is given.
      *
      *      This is mainly verbatim from Anthony William's 'C++ Concurrency in Action'
      *
@@ -28,23 +36,45 @@ namespace management
             /**< Underlaying type */
             using type = T;
             /**< Queue type */
-            using data_type = std::unique_ptr<T>;
+            using data_type = std::unique_ptr<T, detail::ResourceDelete<T>>;
             /**< Termination type */
             using terminator = std::nullptr_t;
+            /**< Enqueue timestamp type */
+            using time_point = std::chrono::steady_clock::time_point;
 
         private:
+            /**< Queue entry, the item and when it was pushed */
+            struct entry {
+                data_type data;
+                time_point enqueued;
+            };
+
+            using queue_type = std::queue<entry, std::deque<entry, ResourceAllocator<entry>>>;
+
+            /**< Where items and queue nodes are allocated */
+            MemoryResource * resource;
             /**< Underlaying queue */
-            std::queue<data_type> data_queue;
+            queue_type data_queue;
             /**< Mutex (mutable since empty() is const */
             mutable std::mutex mutex;
-            /**< Condition variable */
-            std::condition_variable condition;
+            /**< Wakes the consumer, only when it sleeps */
+            FutexNotifier notifier;
+            /**< Number of queued entries, readable without the lock */
+            std::atomic<int> depth{0};
+            /**< How the consumer waits, see set_wait_strategy */
+            WaitStrategy strategy;
+            /**< Where the consumer's waits ended */
+            WaitStats stats;
 
         public:
             /**
-             * @brief Default constructor
+             * @brief Constructor
+             * @param value Where items and queue nodes are allocated
              */
-            ThreadsafeQueue() = default;
+            explicit ThreadsafeQueue(MemoryResource * value = new_delete_resource()) :
+                resource(value),
+                data_queue(typename queue_type::container_type(ResourceAllocator<entry>(value)))
+            { }
 
             /**
              * @brief Wait for poping
@@ -52,13 +82,61 @@ namespace management
              */
             data_type wait_and_pop()
             {
-                std::unique_lock<std::mutex> lk{mutex};
-                condition.wait(lk, [this] { return !data_queue.empty(); });
-                data_type value = std::move(data_queue.front());
-                data_queue.pop();
-                return value;
+                time_point enqueued;
+                return wait_and_pop(enqueued);
             }
 
+            /**
+             * @brief Wait for poping
+             * @param enqueued Set to the time the value was pushed
+             * @return The value at the top of the queue
+             */
+            data_type wait_and_pop(time_point & enqueued)
+            {
+                if (detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                    std::lock_guard<std::mutex> lk{mutex};
+                    return pop_front(enqueued);
+                }
+
+                stats.record(WaitPhase::PARK);
+                notifier.await([this] { return size() != 0; });
+
+                std::lock_guard<std::mutex> lk{mutex};
+                return pop_front(enqueued);
+            }
+
+            /**
+             * @brief Wait for poping, at most timeout
+             * @param timeout How long to wait for an item
+             * @param value Set to the value at the top of the queue
+             * @param enqueued Set to the time the value was pushed
+             * @return T, if value was set; F, on timeout
+             */
+            template<typename Rep, typename Period>
+                bool wait_and_pop_for(std::chrono::duration<Rep, Period> timeout,
+                                      data_type & value, time_point & enqueued)
+                {
+                    /* a zero timeout is a poll, not a wait */
+                    if (timeout.count() > 0 &&
+                        detail::spin_wait(strategy, [this] { return size() != 0; }, stats)) {
+                        std::lock_guard<std::mutex> lk{mutex};
+                        value = pop_front(enqueued);
+                        return true;
+                    }
+
+                    if (timeout.count() > 0)
+                        stats.record(WaitPhase::PARK);
+
+                    if (!notifier.await_until([this] { return size() != 0; },
+                                              std::chrono::steady_clock::now() + timeout))
+                        return false;
+
+                    std::lock_guard<std::mutex> lk{mutex};
+
+                    value = pop_front(enqueued);
+                    return true;
+                }
+
             /**
              * @brief Pop the queue without waiting
              * @return nullptr or data_type instance
@@ -70,9 +148,8 @@ namespace management
                 if (data_queue.empty())
                     return nullptr;
 
-                data_type value = std::move(data_queue.front());
-                data_queue.pop();
-                return value;
+                time_point enqueued;
+                return pop_front(enqueued);
             }
 
             /**
@@ -82,12 +159,17 @@ namespace management
              */
             void push(T new_value)
             {
-                std::lock_guard<std::mutex> lk{mutex};
-                /* Copy/move construct T */
-                data_type data = data_type(new T(std::move(new_value)));
+                {
+                    std::lock_guard<std::mutex> lk{mutex};
+                    /* Copy/move construct T */
+                    data_type data = detail::make_resource_unique<T>(*resource, std::move(new_value));
 
-                data_queue.push(std::move(data));
-                condition.notify_one();
+                    data_queue.push(entry{std::move(data), std::chrono::steady_clock::now()});
+                    depth.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                /* no syscall unless the consumer is asleep */
+                notifier.notify();
             }
 
             /**
@@ -97,13 +179,39 @@ namespace management
 
             /**
              * @return The size of the queue
+             * @details Lock free, the value may be stale by the time it is used
              */
             int size() const
             {
-                std::lock_guard<std::mutex> lk{mutex};
-                return data_queue.size();
+                return depth.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Moves allocation to another resource
+             * @details Call while the queue is empty, before any producer runs.
+             */
+            void set_memory_resource(MemoryResource * value)
+            {
+                resource = value;
+                data_queue = queue_type(typename queue_type::container_type(ResourceAllocator<entry>(value)));
             }
 
+            /**
+             * @brief Sets how the consumer waits for items
+             * @details Call before the consumer starts waiting.
+             */
+            void set_wait_strategy(WaitStrategy const & value) { strategy = value; }
+
+            /**
+             * @return Where the consumer's waits ended
+             */
+            WaitStats const & wait_stats() const { return stats; }
+
+            /**
+             * @return The consumer wakeup, for its syscall counters
+             */
+            FutexNotifier const & wakeup() const { return notifier; }
+
         private:
             /**
              * @brief Determines in the underlying queue is empty
@@ -121,12 +229,30 @@ namespace management
              */
             void push(terminator term)
             {
-                std::lock_guard<std::mutex> lk{mutex};
+                {
+                    std::lock_guard<std::mutex> lk{mutex};
+
+                    /* should be convertible to our data_type */
+                    data_type data = term;
+                    data_queue.push(entry{std::move(data), std::chrono::steady_clock::now()});
+                    depth.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                notifier.notify();
+            }
 
-                /* should be convertible to our data_type */
-                data_type data = term;
-                data_queue.push(std::move(data));
-                condition.notify_one();
+            /**
+             * @brief Removes the front entry, mutex must be held
+             * @param enqueued Set to the time the entry was pushed
+             * @return The front value
+             */
+            data_type pop_front(time_point & enqueued)
+            {
+                data_type value = std::move(data_queue.front().data);
+                enqueued = data_queue.front().enqueued;
+                data_queue.pop();
+                depth.fetch_sub(1, std::memory_order_relaxed);
+                return value;
             }
         };
 
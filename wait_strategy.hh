@@ -0,0 +1,143 @@
+#ifndef _SHARED_WAIT_STRATEGY_H_
+#define _SHARED_WAIT_STRATEGY_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+/**
+ * @file wait_strategy.hh
+ * @author Anthony Clark <clark.anthony.g@gmail.com>
+ *
+ * Spin, then yield, then park. A consumer that gets its next message within a
+ * few microseconds never pays for a futex sleep and wake, one that waits
+ * longer gives the CPU back. The default strategy parks right away.
+ */
+
+namespace management
+{
+    /**
+     * @brief Where a wait was satisfied
+     */
+    enum class WaitPhase : std::uint8_t {
+        SPIN = 0, YIELD, PARK, COUNT
+    };
+
+    /**
+     * @brief How long a consumer stays awake before it parks
+     */
+    struct WaitStrategy
+    {
+        /**< Condition checks with a cpu pause in between, after the first one */
+        std::uint32_t spins;
+        /**< Condition checks with a std::this_thread::yield in between */
+        std::uint32_t yields;
+
+        WaitStrategy(std::uint32_t spin_count = 0, std::uint32_t yield_count = 0) :
+            spins(spin_count),
+            yields(yield_count)
+        { }
+
+        /**
+         * @return A strategy for latency sensitive pairs, a few microseconds of
+         *         spinning and a handful of yields
+         */
+        static WaitStrategy adaptive() { return WaitStrategy{2000, 16}; }
+    };
+
+    /**
+     * @brief How often waits ended in each phase
+     * @details Written by the waiting thread only, read by anyone.
+     */
+    class WaitStats final
+    {
+    private:
+        std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(WaitPhase::COUNT)> m_count;
+
+    public:
+        WaitStats()
+        {
+            for (auto & c : m_count)
+                c.store(0, std::memory_order_relaxed);
+        }
+
+        void record(WaitPhase phase)
+        {
+            auto & c = m_count[static_cast<std::size_t>(phase)];
+            c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        std::uint64_t load(WaitPhase phase) const
+        {
+            return m_count[static_cast<std::size_t>(phase)].load(std::memory_order_relaxed);
+        }
+    };
+
+    namespace detail
+    {
+        /**
+         * @brief Tells the CPU this is a spin loop
+         */
+        inline void cpu_relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            __asm__ __volatile__("yield" ::: "memory");
+#else
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+        }
+
+        /**
+         * @return T, if spinning can pay off: on a single CPU the thread we
+         *         wait for cannot run while we spin
+         */
+        inline bool can_spin()
+        {
+            static const bool multicore = std::thread::hardware_concurrency() > 1;
+            return multicore;
+        }
+
+        /**
+         * @brief The awake part of a wait
+         * @details Spins are skipped on a single CPU, see can_spin.
+         * @param strategy How long to stay awake
+         * @param ready Condition, checked without any lock held by this helper
+         * @param stats Records the phase, unless the caller has to park
+         * @return T, if ready became true; F, if the caller should park
+         */
+        template<typename Ready>
+            bool spin_wait(WaitStrategy const & strategy, Ready && ready, WaitStats & stats)
+            {
+                std::uint32_t spins = can_spin() ? strategy.spins : 0;
+
+                /* a wait that finds the condition already true counts as a spin */
+                for (std::uint32_t i = 0; i <= spins; ++i)
+                {
+                    if (ready()) {
+                        stats.record(WaitPhase::SPIN);
+                        return true;
+                    }
+                    if (i < spins)
+                        cpu_relax();
+                }
+
+                for (std::uint32_t i = 0; i < strategy.yields; ++i)
+                {
+                    if (ready()) {
+                        stats.record(WaitPhase::YIELD);
+                        return true;
+                    }
+                    std::this_thread::yield();
+                }
+
+                return false;
+            }
+    } /* end namespace detail */
+
+} // end namespace management
+
+#endif // guard